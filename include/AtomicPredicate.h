@@ -60,6 +60,13 @@ public:
   virtual void get_sample_differences(position_vector& positions) const = 0;
   virtual void get_feature_ids(storage_vector& features) const = 0;
   virtual bool is_indexable() const = 0;
+
+  // Returns true if the predicate is true exactly when one feature of one
+  // sample is equal to the instance value (these tests are evaluated on
+  // blocks of positions at once, see rule_batch.h).
+  virtual bool get_equality_test(relativePosType& sample_difference, featureIndexType& feature) const {
+    return false;
+  }
 };
 
 inline bool AtomicPredicate::test(const wordType2D&, int, const wordType) const {
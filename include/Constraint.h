@@ -32,6 +32,7 @@
 
 #include "typedef.h"
 #include <string>
+#include <iostream>
 #include "svector.h"
 #include "trie.h"
 #include "hash_wrapper.h"
@@ -56,7 +57,9 @@ public:
   typedef std::vector<wordType> wordTypeVector;
   typedef HASH_NAMESPACE::hash_map<wordTypeVector, bit_vector> rep_type;
 
-  Constraint(const std::string& str);
+  // insert_words adds the feature values that are not in the dictionary
+  // (otherwise their entries are skipped), for the compiled models.
+  Constraint(const std::string& str, bool insert_words = false);
   Constraint() {
   }
 
@@ -70,6 +73,19 @@ public:
     return test(feature_vector, target);
   }
 
+  // Binary I/O, used by the compiled models; the words are saved as
+  // dictionary indices.
+  void write_binary(std::ostream& ostr) const;
+  bool read_binary(std::istream& istr);
+
+  // True if the constraint looks at the given feature of the sample.
+  bool reads(featureIndexType feature) const {
+    for(wordTypeVector::const_iterator f=features.begin() ; f!=features.end() ; ++f)
+      if(*f == feature)
+	return true;
+    return false;
+  }
+
 private:
   void initialize_vector(std::vector<wordType>& v, const wordType1D& feature_vector) const {
     v.resize(features.size());
@@ -93,7 +109,10 @@ public:
 
   ConstraintSet() {}
 
-  void read(const std::string& file_name);
+  void read(const std::string& file_name, bool insert_words = false);
+
+  void write_binary(std::ostream& ostr) const;
+  bool read_binary(std::istream& istr);
 
   bool test(const wordType1D& feature_vector, int class_id) const {
     for(constraint_vector::const_iterator c=constraints.begin() ; c!=constraints.end() ; ++c)
@@ -124,6 +143,13 @@ public:
     return test(feature_vector, target);
   }
 
+  bool reads(featureIndexType feature) const {
+    for(constraint_vector::const_iterator c=constraints.begin() ; c!=constraints.end() ; ++c)
+      if(c->reads(feature))
+	return true;
+    return false;
+  }
+
 private:
   constraint_vector constraints;
 };
@@ -56,7 +56,7 @@ public:
 	const 
 	  string& infix = dict[value],
 	  &word = dict[corpus[sample_difference+sample_ind][feature_id]];
-	static string temp;
+	static THREAD_LOCAL string temp;
 	temp.assign(infix.begin(), infix.begin()+len);
 
 	string::size_type pos = word.find(temp);
@@ -117,13 +117,13 @@ public:
 };
 
 inline void ContainsStringPredicate::instantiate(const wordType2D& corpus, int sample_ind, wordTypeVector& instances) const {
-  static set<wordType> words;
+  static THREAD_LOCAL set<wordType> words;
   words.clear();
   const Dictionary& dict = Dictionary::GetDictionary();
   wordType word_id = corpus[sample_ind+sample_difference][feature_id];
   const string& word = dict[word_id];
   string::size_type word_len = word.size();
-  static string temp;
+  static THREAD_LOCAL string temp;
 
   static bool cache_word_lists = Params::GetParams().valueForParameter("CACHE_INTERNAL_WORD_LIST", true);
 
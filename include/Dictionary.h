@@ -28,26 +28,73 @@
 #define __DICTIONARY_H
 
 #include <vector>
-#include "hash_wrapper.h"
+#include <deque>
 #include <string>
 
 #include "typedef.h"
 #include "common.h"
-#include "indexed_map.h"
+#include "string_index.h"
+#include "mapped_file.h"
 #include "trie.h"
+#include "threads.h"
 
 class Dictionary {
 public:
-  typedef indexed_map<std::string, wordType> word_index_type;
-  typedef word_index_type::iterator iterator;
-  typedef word_index_type::const_iterator const_iterator;
+  typedef string_index word_index_type;
   typedef trie<char, bool> word_trie;
+
+  // Iterates on the words, in the order of their indices; the words are
+  // returned by value (see getString).
+  class const_iterator {
+  public:
+    typedef std::string value_type;
+    typedef int difference_type;
+
+    const_iterator(const Dictionary* d = 0, int i = 0): dict(d), index(i) {}
+
+    std::string operator*() const {
+      return dict->word_index.str(index);
+    }
+
+    const_iterator& operator++() {
+      ++index;
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator t = *this;
+      ++index;
+      return t;
+    }
+
+    bool operator == (const const_iterator& ot) const {
+      return index == ot.index;
+    }
+
+    bool operator != (const const_iterator& ot) const {
+      return index != ot.index;
+    }
+
+    friend difference_type operator- (const const_iterator& it1, const const_iterator& it2) {
+      return it1.index - it2.index;
+    }
+
+  private:
+    const Dictionary* dict;
+    int index;
+  };
+  typedef const_iterator iterator;
   
   Dictionary(void): unknown_index(-1), spelling_of_unknown("UNK") {
   }
 
   ~Dictionary() {}
 
+  // The words are kept in a string_index (all the spellings in a single
+  // array, used for the lookups); the std::string of each word, which
+  // getString returns, is built when the word is added, so that getString
+  // only reads and can be called from several threads.
+
   const std::string& getString(wordType index) const;
 
   wordType reverse_access(const std::string& word) const {
@@ -77,13 +124,28 @@ public:
   wordType increaseCount(int index, unsigned int count = 1);
 
   const_iterator find(const std::string& word) const {
-    return word_index.find(word);
+    int ind = word_index.find(word);
+    return ind == word_index_type::not_found ? end() : const_iterator(this, ind);
   }
 
-  iterator find(const std::string& word) {
-    return word_index.find(word);
+  // Compares the spellings of two words.
+  bool less(wordType i1, wordType i2) const {
+    return word_index.less(i1, i2);
   }
 
+  // Builds a perfect hash for the words in the dictionary, which makes
+  // their lookup faster; words can still be added afterwards.
+  void freeze() {
+    word_index.freeze();
+  }
+
+  // True if the words have a perfect hash (from freeze, or from a binary
+  // vocabulary file).
+  bool frozen() const {
+    return word_index.frozen();
+  }
+
+  // Whether the last lookup of the calling thread was of an unknown word.
   bool wasUnknown() const {
     return was_unknown;
   }
@@ -130,23 +192,17 @@ public:
       word_counts.resize(ind+1);
       word_counts[ind] = 0;
     }
+    if(ind >= spellings.size())
+      spellings.push_back(word);
     return ind;
   }
 
-  iterator begin() {
-    return word_index.begin();
-  }
-
   const_iterator begin() const {
-    return word_index.begin();
-  }
-
-  iterator end() {
-    return word_index.end();
+    return const_iterator(this, 0);
   }
 
   const_iterator end() const {
-    return word_index.end();
+    return const_iterator(this, word_index.size());
   }
 
   void insert_in_direct_trie(const std::string & w) {
@@ -171,9 +227,22 @@ public:
     return reverse_trie;
   }
 
-  void writeToFile(const std::string& file) const ;
+  // The vocabulary is written in binary form (the string_index, with the
+  // perfect hash of all its words, preceded by the class and real word
+  // ranges; the dictionary itself is not frozen), which
+  // readFromFile maps in memory instead of parsing it; text_format selects
+  // the old format, one word per line. readFromFile recognizes both.
+  void writeToFile(const std::string& file, bool text_format = false) const;
   void readFromFile(const std::string& file);
 
+  // The binary vocabulary, as written in a file, for the compiled models.
+  // mapVocabulary uses the words in place if the dictionary is empty (and
+  // returns true; the memory has to outlive the dictionary), otherwise it
+  // copies them after the existing words.
+  void writeBinary(std::ostream& out) const;
+  bool mapVocabulary(const char* data, unsigned long size, const std::string& name);
+  static bool isBinaryVocabulary(const char* data, unsigned long size);
+
   void set_start() {
     _real_word_start_index = size();
   }
@@ -193,19 +262,41 @@ public:
   void destroy() {
     int1D tmp1;
     word_counts.swap(tmp1);
-    word_index.destroy();
+    word_index.clear();
+    voc_file.close();
+    std::deque<std::string> tmp2;
+    spellings.swap(tmp2);
     direct_trie.destroy();
     reverse_trie.destroy();
   }
 
 private:
+  Dictionary(const Dictionary&);
+
+  bool mapFile(const std::string& file);
+
   int1D word_counts;
   word_index_type word_index;
-  mutable bool was_unknown;
+  mapped_file voc_file;
+  // The spellings of the words, by index (a deque, so that the references
+  // returned by getString stay valid when words are added).
+  std::deque<std::string> spellings;
+  static THREAD_LOCAL bool was_unknown;
   int unknown_index;
   std::string spelling_of_unknown;
   word_trie direct_trie, reverse_trie;
   wordType _real_word_start_index, _real_word_end_index;
 };
 
+// Sorts word indices by the spelling of the words.
+template <>
+struct ArrayIndexSorter<Dictionary> {
+  const Dictionary& dict;
+  ArrayIndexSorter(const Dictionary& d): dict(d) {}
+
+  bool operator() (int i1, int i2) const {
+    return dict.less(i1, i2);
+  }
+};
+
 #endif
@@ -71,8 +71,8 @@ public:
   }
 
   virtual void instantiate(const wordType2D& corpus, int feature_index, wordTypeVector& instances) const {
-	static bit_vector null_features;
-	static bool instantiated = false;
+	static THREAD_LOCAL bit_vector null_features;
+	static THREAD_LOCAL bool instantiated = false;
 	if (!instantiated) {
 	  instantiated = true;
 	  const Params& par = Params::GetParams();
@@ -90,7 +90,7 @@ public:
 	const wordType1D& vect = corpus[feature_index+pos];
 	
 	if(null_features.size()>0) {
-	  static wordTypeVector loc_insts;
+	  static THREAD_LOCAL wordTypeVector loc_insts;
 	  loc_insts.clear();
 
 	  for(feature_vector::const_iterator i=features.begin() ; i!=features.end() ; ++i)
@@ -0,0 +1,98 @@
+// -*- C++ -*-
+/*
+  ModelBundle - a compiled fnTBL model: the rule templates, the
+  vocabulary, the constraints, the rules (with the words as dictionary
+  indices) and, optionally, the probability tree, in a single binary
+  file. fnTBL maps the file in memory and uses the vocabulary in place,
+  so the processes loading the same model share its pages, and the rules
+  are read without parsing them.
+
+  The file starts with a magic string, the version, a byte order mark,
+  the size of wordType and the number of sections, followed by a table
+  with the id, offset and size of each section. The vocabulary section
+  has the format of the binary vocabulary files.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __ModelBundle_h__
+#define __ModelBundle_h__
+
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+#include "Rule.h"
+#include "Constraint.h"
+
+class ModelBundle {
+public:
+  enum section_id { TEMPLATES = 1, VOCABULARY, CONSTRAINTS, RULES, TREE };
+
+  ModelBundle(): sections(0), num_sections(0) {}
+
+  // Maps the file; returns false if it is not a compiled model.
+  bool open(const std::string& file);
+
+  bool is_open() const {
+    return model_file.is_open();
+  }
+
+  // These exit with an error if the section is missing or corrupted. The
+  // vocabulary has to be loaded in an empty dictionary (it is used in
+  // place), after the templates.
+  void loadTemplates() const;
+  void loadVocabulary() const;
+  void loadConstraints(ConstraintSet& constraints) const;
+  void loadRules(std::vector<Rule>& rules) const;
+
+  bool hasTree() const {
+    return find_section(TREE) != 0;
+  }
+
+  // The text of the probability tree file.
+  std::string tree() const;
+
+  // Saves the current templates, dictionary and constraints (Rule::Constraints),
+  // the rules and the text of the tree (if not empty) in file.
+  static void write(const std::string& file, const std::vector<Rule>& rules, const std::string& tree_text);
+
+private:
+  struct section {
+    int id;
+    unsigned int offset, size;
+  };
+
+  ModelBundle(const ModelBundle&);
+  ModelBundle& operator = (const ModelBundle&);
+
+  const section* find_section(int id) const;
+  const section& get_section(int id) const;
+
+  mapped_file model_file;
+  std::string name;
+  const section* sections;
+  int num_sections;
+};
+
+#endif
@@ -33,6 +33,7 @@
 #include "typedef.h"
 #include "Dictionary.h"
 #include "svector.h"
+#include "open_hash.h"
 #include "hash_wrapper.h"
 #include <vector>
 
@@ -66,10 +67,21 @@ public:
   typedef vector<ptest_type> test_vector_type;
   typedef PredicateTemplate self;
 
-  PredicateTemplate(): tests(0), dependencies(0) {}
+  // The compiled form of an atomic predicate, used by Predicate::test: the
+  // equality tests (test == 0) compare the feature of the sample at
+  // sample_difference with the value directly, the other ones go through
+  // the virtual AtomicPredicate::test.
+  struct compiled_op {
+    relativePosType sample_difference;
+    featureIndexType feature;
+    const AtomicPredicate* test;
+  };
+  typedef vector<compiled_op> op_vector;
+
+  PredicateTemplate(): tests(0), dependencies(0), equality_only(false) {}
   PredicateTemplate(const vector<string>& pred_features);
 
-  PredicateTemplate(const PredicateTemplate& pt): tests(pt.tests) {
+  PredicateTemplate(const PredicateTemplate& pt): tests(pt.tests), ops(pt.ops), equality_only(pt.equality_only) {
   }
   
   ~PredicateTemplate() {}
@@ -129,11 +141,19 @@ public:
   void swap(self& t) {
     tests.swap(t.tests);
     dependencies.swap(t.dependencies);
+    ops.swap(t.ops);
+    std::swap(equality_only, t.equality_only);
   }
 
+  // Builds ops out of tests.
+  void compile();
+
 public:
   test_vector_type tests;
   vector<bit_vector> dependencies;
+  op_vector ops;
+  // True if all the atomic predicates are equality tests.
+  bool equality_only;
 };
 
 // Each predicate has an attached template and an associated vector of values.
@@ -149,7 +169,7 @@ public:
   Predicate(int tid, const wordType1D& tok): template_id(tid){
     static int feature_set_size = PredicateTemplate::name_map.size();
     tokens.resize(feature_set_size);
-    copy(tok, tok+feature_set_size, tokens.begin());
+    tok.copy(0, feature_set_size, tokens.begin());
 
     create_order();
 
@@ -188,7 +208,7 @@ public:
     static Dictionary& dict = Dictionary::GetDictionary();
     int sz = tokens.size();
 
-    static vector<int> counts;
+    static THREAD_LOCAL vector<int> counts;
 
     counts.resize(sz);
     // 	counts.clear();
@@ -216,11 +236,11 @@ public:
 
 public:
   int hashVal() {
-    int value = 0;
+    unsigned int value = 0;
     for (token_vector_type::iterator tok = tokens.begin(); tok != tokens.end(); ++tok)
-      value = 5*value + (*tok);
+      value = hash_combine(value, *tok);
 
-    return 5*value + template_id;
+    return hash_finalize(hash_combine(value, template_id));
   }
 
   string printMe() const {
@@ -291,7 +311,7 @@ public:
   }
 
 protected:
-  static sized_memory_pool<order_rep_type> memory_pool;
+  static THREAD_LOCAL sized_memory_pool<order_rep_type> memory_pool;
 
   void allocate_order() {
     order = memory_pool.allocate(tokens.size());
@@ -303,11 +323,25 @@ protected:
 };
 
 inline bool Predicate::test(const wordType2D& corpus, int word) const {
-  PredicateTemplate& pred_template = PredicateTemplate::Templates[template_id];
+  const PredicateTemplate& pred_template = PredicateTemplate::Templates[template_id];
+  const PredicateTemplate::op_vector& ops = pred_template.ops;
   int sz = tokens.size();
-  for(order_rep_type* feature=order ; feature!=order+sz ; ++feature)
-    if(! pred_template[*feature].test(corpus, word, tokens[*feature]))
+  if(pred_template.equality_only) {
+    for(order_rep_type* feature=order ; feature!=order+sz ; ++feature) {
+      const PredicateTemplate::compiled_op& op = ops[*feature];
+      if(corpus[word+op.sample_difference][op.feature] != tokens[*feature])
+	return false;
+    }
+    return true;
+  }
+
+  for(order_rep_type* feature=order ; feature!=order+sz ; ++feature) {
+    const PredicateTemplate::compiled_op& op = ops[*feature];
+    if(op.test ? 
+       ! op.test->test(corpus, word, tokens[*feature]) :
+       corpus[word+op.sample_difference][op.feature] != tokens[*feature])
       return false;
+  }
 
   return true;
 }
@@ -65,7 +65,7 @@ public:
 	     );
     const string& word = dict[corpus[sample_difference+sample_ind][feature_id]];
 
-    static string str;
+    static THREAD_LOCAL string str;
     str.resize(0);
 
     if(is_prefix) {
@@ -146,7 +146,7 @@ inline void PrefixSuffixAddPredicate::instantiate(const wordType2D& corpus, int
   string::size_type word_len = word.size();
   //   if(word_len<len)
   // 	return;
-  static vector<char> v;
+  static THREAD_LOCAL vector<char> v;
   v.resize(word_len);
 
   static bool cache_word_lists = Params::GetParams().valueForParameter("CACHE_INTERNAL_WORD_LIST", true)==true;
@@ -213,7 +213,7 @@ inline void PrefixSuffixAddPredicate::instantiate(const wordType2D& corpus, int
 
 	if(vect.size() == word_len+len && (*p).second==true) {
 	  // Here we have identified a candidate
-	  static string s;
+	  static THREAD_LOCAL string s;
 	  s.resize(len);
 	  // 		for(int i=word_len+len-1 ; i>=word_len ; --i)
 	  // 		  s.push_back(const_cast<char&>(vect[i]));
@@ -267,7 +267,7 @@ inline void PrefixSuffixAddPredicate::instantiate(const wordType2D& corpus, int
 	  break;
 
 	if(vect.size() == word_len+len && (*p).second==true) {
-	  static string s;
+	  static THREAD_LOCAL string s;
 	  s.resize(len);
 	  copy(vect.begin()+word_len, vect.begin()+word_len+len, s.begin());
 	  instances.push_back(dict["++"+s]);
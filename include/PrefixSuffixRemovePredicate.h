@@ -114,7 +114,7 @@ inline void PrefixSuffixRemovePredicate::instantiate(const wordType2D& corpus, i
   if(word_len<=len)
 	return;
 
-  static string temp, minusminus = "--";
+  static THREAD_LOCAL string temp, minusminus = "--";
   if(is_prefix) {
 	temp.assign(word, len, word_len-len);
 	if( dict.find(temp) != dict.end() ) {
@@ -41,12 +41,20 @@
 #endif
 
 #include <string>
+#include <deque>
 #include "typedef.h"
 #include "Dictionary.h"
 #include "Predicate.h"
 #include "Constraint.h"
 #include "Target.h"
 #include "Params.h"
+#include "open_hash.h"
+
+// The rules of a rule_hash are addressed by dense 32-bit ids.
+typedef unsigned int rule_id;
+const rule_id NO_RULE = static_cast<rule_id>(-1);
+
+class rule_ref;
 
 // This is an abstract class specifying the interface for the AtomicPredicate
 // category.
@@ -66,20 +74,25 @@ public:
     rule_name(anotherRule.rule_name),
 #endif
     good(anotherRule.good),
-    bad(anotherRule.bad)
+    bad(anotherRule.bad),
+    heap_index(-1)
   {}
 
+  // Copies a rule out of a rule_hash.
+  Rule(const rule_ref& rule);
+
   Rule(const Predicate& p, const Target& t):
     predicate(p),
     target(t),
     good(0),
-    bad(0)
+    bad(0),
+    heap_index(-1)
   {
     ON_DEBUG(rule_name = printMe());
     hashIndex = hashVal();
   }
 
-  Rule(): target(0), hashIndex(0)
+  Rule(): target(0), hashIndex(0), heap_index(-1)
   {
     ON_DEBUG(rule_name = "");
   }
@@ -101,12 +114,18 @@ public:
   bool test(const wordType2D &corpus, int word) const;
   int hashVal(void) const;
 
-  // A probabilistic version of the applicability of a rule: 
+  // A probabilistic version of the applicability of a rule:
   // based on the context probabilities, return the probability of firing.
   double test(const wordType2D& corpus, int word, const float2D& context_prob) const;
 
   string printMe() const;
 
+  // Binary I/O of the rule and its counts (the words are stored as their
+  // dictionary indices; translation, if given, maps the stored indices to
+  // the ones of the current dictionary).
+  void write_binary(ostream& ostr) const;
+  bool read_binary(istream& istr, const wordTypeVector* translation = 0);
+
   // Updates the counts of the rule as it would do if the rule applies to
   // the given vector
   void update_counts(const wordType1D& vect, int factor) const {
@@ -120,99 +139,248 @@ public:
   Predicate predicate;
   Target target;
   // change word to this state if constraints hold
-  //   wordType targetState;  
+  //   wordType targetState;
 
   // the stuff that identifies each unique rule.
   int hashIndex;
-  
+
   ON_DEBUG(string rule_name);
   mutable scoreType good;
   mutable scoreType bad;
+  // Only there such that a rule_ref can be made out of the rule (the rules
+  // in a rule_heap are in a rule_hash, which keeps their positions).
+  mutable int heap_index;
 
   // checks if two rules are equal.
-  bool operator< (const Rule& rule) const {
-    return rule.better(*this, rule.good-rule.bad);
-  }
-  
+  bool operator< (const Rule& rule) const;
+
   static const int MORE_PREDICATES_FIRST = 0;
   static const int LESS_PREDICATES_FIRST = 1;
   static const int TEMPLATE_FILE_ORDER = 2;
+  // See rule_ref::better.
+  bool better(const rule_ref& rule, int score) const;
+
+  bool operator==(const Rule& rule) const {
+    return target == rule.target && predicate == rule.predicate;
+  }
+
+  Rule& operator= (const Rule& rule) {
+    if (this != &rule) {
+      predicate = rule.predicate;
+      target = rule.target;
+      good = rule.good;
+      bad = rule.bad;
+      hashIndex = rule.hashIndex;
+      ON_DEBUG(rule_name = rule.rule_name);
+    }
+    return *this;
+  }
+
+  int get_least_frequent_feature_position() const {
+    return predicate.get_least_frequent_feature_position();
+  }
+
+  bool get_intersection_features(int& first, relativePosType& d1, int& second, relativePosType& d2) const;
+
+  // read_constraints is false when the constraints come from a compiled
+  // model (see ModelBundle.h).
+  static void Initialize(bool read_constraints = true);
+
+  static ConstraintSet Constraints;
+};
+
+// A rule seen through references to its parts. The rules of a rule_hash
+// are not stored as Rule objects, so its iterators return rule_refs: the
+// predicate and the target are the ones shared by all the rules of the
+// store, and good, bad and heap_index refer to the entries of the rule in
+// its count arrays (so the counts can be changed through the rule_ref).
+// A Rule converts to a rule_ref to its own members, so the functions that
+// score rules take a rule_ref and work on both.
+class rule_ref {
+public:
+  rule_ref(const Rule& rule):
+    id(NO_RULE),
+    predicate(rule.predicate),
+    target(rule.target),
+    hashIndex(rule.hashIndex),
+    good(rule.good),
+    bad(rule.bad),
+    heap_index(rule.heap_index)
+  {}
+
+  rule_ref(rule_id i, const Predicate& p, const Target& t, int h, scoreType& g, scoreType& b, int& hi):
+    id(i), predicate(p), target(t), hashIndex(h), good(g), bad(b), heap_index(hi)
+  {}
+
+  bool constraint_test(const wordType1D& features) const {
+    return Rule::Constraints.test(features, target);
+  }
+
+  // Returns true iff the target state is not the correct one, the
+  // predicate matches and the transformation does not break any
+  // constraints.
+  bool test(const wordType2D &corpus, int word) const {
+    return target.affects(corpus[word]) && predicate.test(corpus, word) && Rule::Constraints(corpus[word], target);
+  }
+
+  string printMe() const {
+    return predicate.printMe() + " => " + target.printMe();
+  }
+
+  void write_binary(ostream& ostr) const;
+
+  void update_counts(const wordType1D& vect, int factor) const {
+    target.update_counts(vect, factor, good, bad);
+  }
+
+  void update_bad_counts(const wordType1D& vect, int factor) const {
+    target.update_bad_counts(vect, factor, bad);
+  }
+
+  bool operator< (const rule_ref& rule) const {
+    return rule.better(*this, rule.good-rule.bad);
+  }
+
+  bool operator== (const rule_ref& rule) const {
+    return target == rule.target && predicate == rule.predicate;
+  }
+
   // The choice of rules is done as follows:
   // 1. Choose the rule with higher score.
   // 2. If scores are equal, choose the one that's more specific (has more predicates intantiated).
   // 3. If equal, choose the one with a higher targetStateID.
   // 4. If equal, choose the one with a lower predicate ID.
   // 5. If equal, choose the one that whose tokens are lower in lexicographic distance.
-  bool better(const Rule& rule, int score) const {
+  bool better(const rule_ref& rule, int score) const {
     int r_score = rule.good-rule.bad;
-    static int size_ordering = Params::GetParams().valueForParameter("ORDER_BASED_ON_SIZE", MORE_PREDICATES_FIRST);
+    static int size_ordering = Params::GetParams().valueForParameter("ORDER_BASED_ON_SIZE", Rule::MORE_PREDICATES_FIRST);
 
     switch(size_ordering) {
-    case LESS_PREDICATES_FIRST:
+    case Rule::LESS_PREDICATES_FIRST:
       return score > r_score ||
-	score==r_score && 
-	( 
+	score==r_score &&
+	(
 	 predicate.tokens.size() < rule.predicate.tokens.size() ||
-	 predicate.tokens.size() == rule.predicate.tokens.size() && 
-	 ( 
+	 predicate.tokens.size() == rule.predicate.tokens.size() &&
+	 (
 	  rule.target < target ||
-	  target == rule.target && 
-	  ( predicate.template_id < rule.predicate.template_id || 
+	  target == rule.target &&
+	  ( predicate.template_id < rule.predicate.template_id ||
 	    predicate.template_id == rule.predicate.template_id && rule.predicate.tokens < predicate.tokens
 	    )
 	  )
 	 );
-    case MORE_PREDICATES_FIRST:
+    case Rule::MORE_PREDICATES_FIRST:
       return score > r_score ||
-	score==r_score && 
+	score==r_score &&
 	( predicate.tokens.size() > rule.predicate.tokens.size() ||
-	  predicate.tokens.size() == rule.predicate.tokens.size() && 
+	  predicate.tokens.size() == rule.predicate.tokens.size() &&
 	  (
 	   rule.target < target ||
-	   target == rule.target && 
-	   ( predicate.template_id < rule.predicate.template_id || 
+	   target == rule.target &&
+	   ( predicate.template_id < rule.predicate.template_id ||
 	     predicate.template_id == rule.predicate.template_id && rule.predicate.tokens < predicate.tokens
 	     )
 	   )
 	  );
-    case TEMPLATE_FILE_ORDER:
+    case Rule::TEMPLATE_FILE_ORDER:
     default:
-      return 
+      return
 	score > r_score ||
 	score==r_score &&
-	( 
+	(
 	 rule.target < target ||
-	 target == rule.target && 
-	 ( predicate.template_id < rule.predicate.template_id || 
+	 target == rule.target &&
+	 ( predicate.template_id < rule.predicate.template_id ||
 	   predicate.template_id == rule.predicate.template_id && rule.predicate.tokens < predicate.tokens
 	   )
 	 );
     }
   }
 
-  bool operator==(const Rule& rule) const {
-    return target == rule.target && predicate == rule.predicate;
+  int get_least_frequent_feature_position() const {
+    return predicate.get_least_frequent_feature_position();
   }
 
-  Rule& operator= (const Rule& rule) {
-    if (this != &rule) {
-      predicate = rule.predicate;
-      target = rule.target;
-      good = rule.good;
-      bad = rule.bad;
-      hashIndex = rule.hashIndex;
-      ON_DEBUG(rule_name = rule.rule_name);
+  // Finds the two least frequent features of the predicate that can be looked
+  // up in the index of the (non-state) features, at a single sample
+  // difference each, so that their posting lists can be intersected. Returns
+  // false if the least frequent indexable feature is not one of them, or if
+  // there is no second one.
+  bool get_intersection_features(int& first, relativePosType& d1, int& second, relativePosType& d2) const {
+    const PredicateTemplate& pred_template = PredicateTemplate::Templates[predicate.template_id];
+    static THREAD_LOCAL AtomicPredicate::storage_vector features;
+    static THREAD_LOCAL AtomicPredicate::position_vector offsets;
+    first = -1;
+    for(int k=0 ; k<predicate.tokens.size() ; ++k) {
+      const AtomicPredicate& test = *pred_template.tests[predicate.order[k]];
+      if(! test.is_indexable())
+	continue;
+      features.clear();
+      offsets.clear();
+      test.get_feature_ids(features);
+      test.get_sample_differences(offsets);
+      bool usable = features.size() == 1 && offsets.size() == 1 &&
+	(features[0] < TargetTemplate::STATE_START || features[0] >= TargetTemplate::STATE_START+TargetTemplate::TRUTH_SIZE);
+      if(first == -1) {
+	if(! usable)
+	  return false;
+	first = predicate.order[k];
+	d1 = offsets[0];
+      } else if(usable) {
+	second = predicate.order[k];
+	d2 = offsets[0];
+	return true;
+      }
     }
-    return *this;
+    return false;
   }
 
-  int get_least_frequent_feature_position() const {
-    return predicate.get_least_frequent_feature_position();
-  }
+  // The id of the rule in its rule_hash (NO_RULE for a Rule).
+  rule_id id;
+  const Predicate& predicate;
+  const Target& target;
+  int hashIndex;
+  scoreType& good;
+  scoreType& bad;
+  int& heap_index;
+};
 
-  static void Initialize();
+inline Rule::Rule(const rule_ref& rule):
+  predicate(rule.predicate),
+  target(rule.target),
+  hashIndex(rule.hashIndex),
+  good(rule.good),
+  bad(rule.bad),
+  heap_index(-1)
+{
+  ON_DEBUG(rule_name = printMe());
+}
 
-  static ConstraintSet Constraints;
+inline bool Rule::operator< (const Rule& rule) const {
+  return rule_ref(rule).better(*this, rule.good-rule.bad);
+}
+
+inline bool Rule::better(const rule_ref& rule, int score) const {
+  return rule_ref(*this).better(rule, score);
+}
+
+inline bool Rule::get_intersection_features(int& first, relativePosType& d1, int& second, relativePosType& d2) const {
+  return rule_ref(*this).get_intersection_features(first, d1, second, d2);
+}
+
+// What operator-> of the rule_hash iterators returns: the rule_ref
+// lives as long as the pointer does.
+class rule_pointer {
+public:
+  rule_pointer(const rule_ref& r): rule(r) {}
+
+  const rule_ref* operator-> () const {
+    return &rule;
+  }
+
+private:
+  rule_ref rule;
 };
 
 namespace HASH_NAMESPACE {
@@ -232,6 +400,13 @@ namespace HASH_NAMESPACE {
     }
   };
 
+  template <>
+  struct hash<Target> {
+    size_t operator()(const Target& t) const {
+      return hash_finalize(t.hashVal(t.tid));
+    }
+  };
+
   template <>
   struct hash<const Predicate*> {
     size_t operator()(const Predicate* p) const {
@@ -257,39 +432,178 @@ namespace std {
   
 }
 
-struct equalto {
-  bool operator() (const Predicate* p1, const Predicate* p2) {
-    return *p1 == *p2;
+  
+// Keeps one copy of each of the distinct values (predicates or targets)
+// given to it, addressed by dense ids. The uses of each value are counted,
+// and the id of a value that is not used anymore is reused. The values are
+// kept in a deque, so they do not move when new ones are added.
+template <class T, class HashFcn = HASH_NAMESPACE::hash<T> >
+class intern_table {
+public:
+  typedef unsigned int id_type;
+  static const id_type NONE = id_hash_table::EMPTY;
+
+  // Returns the id of the value (adding it, if needed), and counts one
+  // more use of it.
+  id_type acquire(const T& value) {
+    unsigned int h = hasher(value);
+    id_type id = table.find(h, value_matches(values, value));
+    if(id == NONE) {
+      if(free_ids.empty()) {
+	id = values.size();
+	values.push_back(value);
+	uses.push_back(0);
+      } else {
+	id = free_ids.back();
+	free_ids.pop_back();
+	values[id] = value;
+      }
+      table.insert(h, id);
+    }
+    uses[id]++;
+    return id;
+  }
+
+  // Counts one less use of the value; returns true if it was the last one.
+  bool release(id_type id) {
+    if(--uses[id] > 0)
+      return false;
+    table.erase(hasher(values[id]), id);
+    free_ids.push_back(id);
+    return true;
+  }
+
+  id_type find(const T& value) const {
+    return table.find(hasher(value), value_matches(values, value));
+  }
+
+  const T& operator[] (id_type id) const {
+    return values[id];
   }
+
+  size_t size() const {
+    return table.size();
+  }
+
+  void swap(intern_table& t) {
+    values.swap(t.values);
+    uses.swap(t.uses);
+    free_ids.swap(t.free_ids);
+    table.swap(t.table);
+  }
+
+  void clear() {
+    values.clear();
+    uses.clear();
+    free_ids.clear();
+    table.clear();
+  }
+
+  void destroy() {
+    intern_table tmp;
+    swap(tmp);
+  }
+
+  // The number of values stored, including the ones not used anymore.
+  size_t slots() const {
+    return values.size();
+  }
+
+  const id_hash_table& hash_table() const {
+    return table;
+  }
+
+private:
+  struct value_matches {
+    const std::deque<T>& values;
+    const T& value;
+
+    value_matches(const std::deque<T>& v, const T& val): values(v), value(val) {}
+
+    bool operator() (id_type id) const {
+      return values[id] == value;
+    }
+  };
+
+  static unsigned int hasher(const T& value) {
+    return static_cast<unsigned int>(HashFcn()(value));
+  }
+
+  std::deque<T> values;
+  std::vector<unsigned int> uses;
+  std::vector<id_type> free_ids;
+  id_hash_table table;
 };
-  
+
+class rule_hash;
+
+// Iterates through the rules of a rule_hash, in the order of their ids.
+class rule_hash_iterator {
+public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef Rule value_type;
+  typedef ptrdiff_t difference_type;
+  typedef rule_pointer pointer;
+  typedef rule_ref reference;
+  typedef rule_hash_iterator self;
+
+  rule_hash_iterator(): parent(0), rid(NO_RULE) {}
+
+  rule_hash_iterator(const rule_hash& p, rule_id id): parent(&p), rid(id) {}
+
+  rule_ref operator* () const;
+
+  rule_pointer operator-> () const {
+    return operator*();
+  }
+
+  self& operator++ ();
+
+  self operator++ (int) {
+    self obj = *this;
+    ++*this;
+    return obj;
+  }
+
+  bool operator== (const self& it) const {
+    return rid == it.rid;
+  }
+
+  bool operator!= (const self& it) const {
+    return rid != it.rid;
+  }
+
+  rule_id id() const {
+    return rid;
+  }
+
+private:
+  const rule_hash* parent;
+  rule_id rid;
+};
+
 // This is a cooked up structure that acts just a hash of rules
 // but it represents them based on a hash table of predicates.
-// It helps saving up space (since all the rules with the same 
+// It helps saving up space (since all the rules with the same
 // predicate share it) and it's easier to identify all rules with
 // the same predicate (needed to generate "bad counts").
-typedef vector<Rule*> rule_list_type;
-
-typedef HASH_NAMESPACE::hash_map<const Predicate*, rule_list_type, HASH_NAMESPACE::hash<const Predicate*>, equalto > predicate_list_hash_map;
-
-class rule_hash;
+typedef vector<rule_id> rule_list_type;
 
+// Iterates through the rules with a given predicate (or through all the
+// rules, grouped by predicate).
 class rule_hash_const_iterator {
 public:
-  typedef std::pair<predicate_list_hash_map::const_iterator, rule_list_type::const_iterator> rep_type;
-  typedef predicate_list_hash_map::const_iterator predicate_iterator;
-  typedef rule_list_type::const_iterator list_iterator;
   typedef Rule value_type;
   typedef rule_hash_const_iterator self;
 
-  rule_hash_const_iterator(rule_hash& p, const predicate_iterator& p_it, const list_iterator& l_it): parent(&p), pred_it(p_it), list_it(l_it) {
+  rule_hash_const_iterator(rule_hash& p, unsigned int l, int pos): parent(&p), list(l), list_pos(pos) {
   }
 
   ~rule_hash_const_iterator() {}
 
   void increment();
 
-  Rule& operator* ();
+  rule_ref operator* ();
 
   rule_hash_const_iterator& operator ++ () {
     increment();
@@ -303,109 +617,128 @@ public:
   }
 
   bool operator == (const rule_hash_const_iterator& it) const {
-    return pred_it == it.pred_it && list_it == it.list_it;
+    return list == it.list && list_pos == it.list_pos;
   }
 
   bool operator != (const rule_hash_const_iterator& it) const {
     return !operator == (it);
   }
 
-  Rule* operator->();
+  rule_pointer operator->() {
+    return operator*();
+  }
 
-  HASH_NAMESPACE::hash_set<Rule>::iterator rule_iterator();
+  rule_id id() const;
 
 private:
   rule_hash* parent;
-  predicate_iterator pred_it;
-  list_iterator list_it;
+  unsigned int list;
+  int list_pos;
 };
 
+// The rules are not stored as Rule objects. Each distinct predicate and
+// target is interned once, in an intern_table, and a rule is a record of
+// the ids of its predicate and target (and its hash value), addressed by
+// its rule_id. The counts of the rules and their positions in a rule_heap
+// are kept in separate arrays, indexed by the rule ids. All of them are
+// deques, so the entries of a rule do not move while it is stored, and
+// the ids of the erased rules are reused.
+//
+// The rule table is an open addressing table of rule ids. When the store
+// is on, pred_lists has, for each predicate id, the ids of the rules with
+// that predicate.
 class rule_hash {
   friend class rule_hash_const_iterator;
 public:
-  typedef predicate_list_hash_map pred_list_rep_type;
-  typedef HASH_NAMESPACE::hash_set<Rule> real_rep_type;
-  typedef real_rep_type::iterator iterator;
-  typedef real_rep_type::value_type value_type;
-  typedef real_rep_type::key_type key_type;
+  typedef rule_hash_iterator iterator;
+  typedef Rule value_type;
+  typedef Rule key_type;
 
-  rule_hash():on(false) {}
-  
-  rule_hash(const rule_hash& other_hash): storage(other_hash.storage), pred_list(other_hash.pred_list), on(other_hash.on) {
-  }
+  rule_hash(): on(false) {}
 
-  rule_hash& operator= (const rule_hash& rh) {
-    if(&rh != this) {
-      storage = rh.storage;
-      pred_list = rh.pred_list;
-      on = rh.on;
+  pair<iterator, bool> insert(const rule_ref& key) {
+    // First, check whether the rule is already stored
+    rule_id id = lookup(key);
+    if(id != NO_RULE)
+      return make_pair(iterator(*this, id), false);
+
+    // Then add the rule to the storage
+    rule_record record;
+    record.predicate = predicates.acquire(key.predicate);
+    record.target = targets.acquire(key.target);
+    record.hashIndex = key.hashIndex;
+    if(free_ids.empty()) {
+      id = records.size();
+      records.push_back(record);
+      goods.push_back(key.good);
+      bads.push_back(key.bad);
+      heap_positions.push_back(-1);
+    } else {
+      id = free_ids.back();
+      free_ids.pop_back();
+      records[id] = record;
+      goods[id] = key.good;
+      bads[id] = key.bad;
+      heap_positions[id] = -1;
     }
-    return *this;
-  }
+    table.insert(hash_value(key), id);
 
-  pair<iterator, bool> insert(const value_type& key) {
-    // First, try to add the target to the known list, if it's not already there
-    pair<real_rep_type::iterator,bool> p = storage.insert(key);
-    if(on && p.second) {				// The rule is not in the rule set => we need to add it.
-      const Predicate* key = &p.first->predicate;
-      rule_list_type& list = pred_list[key];
-      rule_list_type::iterator lit = ::find(list.begin(), list.end(), &(*p.first));
-      if(lit == list.end())
-	list.push_back(const_cast<Rule*>(&(*p.first)));
+    // and to the list of rules with the same predicate.
+    if(on) {
+      if(pred_lists.size() <= record.predicate)
+	pred_lists.resize(record.predicate+1);
+      pred_lists[record.predicate].push_back(id);
     }
 
-    // Then add the rule to the storage
-    return p;
+    return make_pair(iterator(*this, id), true);
   }
 
   void swap(rule_hash& hash_set) {
-    storage.swap(hash_set.storage);
-    pred_list.swap(hash_set.pred_list);
+    records.swap(hash_set.records);
+    goods.swap(hash_set.goods);
+    bads.swap(hash_set.bads);
+    heap_positions.swap(hash_set.heap_positions);
+    free_ids.swap(hash_set.free_ids);
+    table.swap(hash_set.table);
+    predicates.swap(hash_set.predicates);
+    targets.swap(hash_set.targets);
+    pred_lists.swap(hash_set.pred_lists);
     ::swap(hash_set.on, on);
   }
 
   void clear() {
-    if(on) {
-      for(pred_list_rep_type::iterator it = pred_list.begin();
-	  it!=pred_list.end();
-	  ++it) {
-	it->second.clear();
-      }
-      pred_list.clear();
-    }
-    storage.clear();
+    records.clear();
+    goods.clear();
+    bads.clear();
+    heap_positions.clear();
+    free_ids.clear();
+    table.clear();
+    predicates.clear();
+    targets.clear();
+    pred_lists.clear();
   }
 
   void destroy() {
-    pred_list.clear();
-    storage.clear();
-    real_rep_type tmp1;
-    tmp1.swap(storage);
-    pred_list_rep_type tmp2;
-    pred_list.swap(tmp2);
+    rule_hash tmp;
+    tmp.on = on;
+    swap(tmp);
   }
 
   void erase(iterator pos) {
-    if(on) {
-      pred_list_rep_type::iterator it = pred_list.find(&pos->predicate);
-      if(it != pred_list.end()) {
-	rule_list_type::iterator lit = ::find(it->second.begin(), it->second.end(), &(*pos));
-	if(lit == it->second.begin() && it->second.size()>1) {
-	  // This is the more complicated case - we need to recreate the pairing betweeen the
-	  // predicate pointer of the first rule and the list of rule pointers.
-	  static rule_list_type lst;
-	  it->second.erase(lit);
-	  lst = it->second;
-	  pred_list.erase(it);
-	  pred_list.insert(make_pair(&(lst[0]->predicate),lst));
-	} else {
-	  it->second.erase(lit);
-	  if(it->second.size() == 0)
-	    pred_list.erase(it);
-	}
-      }
+    rule_id id = pos.id();
+    rule_record& record = records[id];
+    if(on && record.predicate < pred_lists.size()) {
+      rule_list_type& lst = pred_lists[record.predicate];
+      rule_list_type::iterator it = ::find(lst.begin(), lst.end(), id);
+      if(it != lst.end())
+	lst.erase(it);
     }
-    storage.erase(pos);
+
+    table.erase(record.hashIndex, id);
+    predicates.release(record.predicate);
+    targets.release(record.target);
+    record.predicate = NO_RULE;
+    free_ids.push_back(id);
   }
 
   void turn_on() {
@@ -421,124 +754,191 @@ public:
   }
 
   size_t size() {
-    return storage.size();
+    return table.size();
   }
 
-  iterator find(const Rule& rule) const {
-    return storage.find(rule);
+  iterator find(const rule_ref& rule) const {
+    return iterator(*this, lookup(rule));
   }
 
-  iterator find(Rule& rule) {
-    return storage.find(rule);
+  iterator begin() const {
+    return iterator(*this, next_live(0));
   }
 
-  iterator begin() {
-    return storage.begin();
+  iterator end() const {
+    return iterator(*this, NO_RULE);
   }
 
-  iterator end() const {
-    return storage.end();
+  rule_ref operator[] (rule_id id) const {
+    const rule_record& record = records[id];
+    return rule_ref(id, predicates[record.predicate], targets[record.target], record.hashIndex,
+		    goods[id], bads[id], heap_positions[id]);
+  }
+
+  scoreType score(rule_id id) const {
+    return goods[id] - bads[id];
+  }
+
+  int& heap_index(rule_id id) const {
+    return heap_positions[id];
+  }
+
+  // Returns the first rule id >= id that is in use, or NO_RULE.
+  rule_id next_live(rule_id id) const {
+    for( ; id<records.size() ; id++)
+      if(records[id].predicate != NO_RULE)
+	return id;
+    return NO_RULE;
   }
 
   rule_hash_const_iterator pbegin() {
     ON_DEBUG(assert(on));
-    if(pred_list.size() > 0)
-      return rule_hash_const_iterator(*this, pred_list.begin(), pred_list.begin()->second.begin());
-    return pend();
+    return rule_hash_const_iterator(*this, next_list(0), 0);
   }
 
   rule_hash_const_iterator pend() {
     ON_DEBUG(assert(on));
-    return rule_hash_const_iterator(*this, pred_list.end(), fake_list.end());
+    return rule_hash_const_iterator(*this, pred_lists.size(), 0);
   }
 
   rule_hash_const_iterator pbegin(const Predicate& pred) {
     ON_DEBUG(assert(on));
-    pred_list_rep_type::iterator it = pred_list.find(&pred);
-    if (it == pred_list.end())
-      return rule_hash_const_iterator(*this, pred_list.end(), fake_list.end());
-    else 
-      return rule_hash_const_iterator(*this, it, it->second.begin());
+    unsigned int list = find_list(pred);
+    if (list == id_hash_table::EMPTY)
+      return pend();
+    else
+      return rule_hash_const_iterator(*this, list, 0);
   }
 
   rule_hash_const_iterator pend(const Predicate& pred) {
     ON_DEBUG(assert(on));
-    pred_list_rep_type::const_iterator it = pred_list.find(&pred);
-    if (it == pred_list.end())
-      return rule_hash_const_iterator(*this, pred_list.end(), fake_list.end());
-    else {
-      pred_list_rep_type::const_iterator it1 = it;
-      ++it1;
-      if(it1 == pred_list.end())
-	return rule_hash_const_iterator(*this, it1, fake_list.end());
-      else
-	return rule_hash_const_iterator(*this, it1, it1->second.begin());
-    }
+    unsigned int list = find_list(pred);
+    if (list == id_hash_table::EMPTY)
+      return pend();
+    else
+      return rule_hash_const_iterator(*this, next_list(list+1), 0);
   }
 
   void compute_space(int& s1, int& s2) {
     s1 = s2 = 0;
-    for(pred_list_rep_type::const_iterator it = pred_list.begin() ;
-	it!=pred_list.end() ; ++it) {
-      s1 += it->second.size();
-      s2 += it->second.capacity();
+    for(vector<rule_list_type>::const_iterator it = pred_lists.begin() ;
+	it!=pred_lists.end() ; ++it) {
+      s1 += it->size();
+      s2 += it->capacity();
     }
   }
 
-  static rule_list_type fake_list;
-	
-public:
-  // A pointer to the hash_set containing the rules
-  real_rep_type storage;
-  pred_list_rep_type pred_list;
+  // Dumps the load and the probe lengths of the hash tables, and the
+  // memory taken by the rules (without the overhead of the allocators).
+  void print_statistics(ostream& ostr) const {
+    table.print_statistics(ostr, "Rule table");
+    predicates.hash_table().print_statistics(ostr, "Predicate table");
+
+    size_t rule_bytes = records.size() * (sizeof(rule_record) + 2*sizeof(scoreType) + sizeof(int)) +
+      table.capacity() * 2*sizeof(unsigned int) + free_ids.capacity() * sizeof(rule_id);
+    size_t predicate_bytes = predicates.hash_table().capacity() * 2*sizeof(unsigned int);
+    for(unsigned int p=0 ; p<predicates.slots() ; p++)
+      predicate_bytes += sizeof(Predicate) + sizeof(unsigned int) +
+	predicates[p].tokens.size() * (sizeof(wordType) + sizeof(Predicate::order_rep_type));
+    for(vector<rule_list_type>::const_iterator it = pred_lists.begin() ; it!=pred_lists.end() ; ++it)
+      predicate_bytes += sizeof(rule_list_type) + it->capacity() * sizeof(rule_id);
+    size_t target_bytes = targets.hash_table().capacity() * 2*sizeof(unsigned int);
+    for(unsigned int t=0 ; t<targets.slots() ; t++)
+      target_bytes += sizeof(Target) + sizeof(unsigned int) + targets[t].vals.size() * sizeof(wordType);
+
+    size_t rules = table.size(), total = rule_bytes + predicate_bytes + target_bytes;
+    ostr << "Rule store: " << rules << " rules (" << rule_bytes << " bytes), "
+	 << predicates.size() << " predicates (" << predicate_bytes << " bytes), "
+	 << targets.size() << " targets (" << target_bytes << " bytes); "
+	 << (rules == 0 ? 0 : total/rules) << " bytes per rule" << endl;
+  }
+
+private:
+  struct rule_record {
+    unsigned int predicate, target;
+    int hashIndex;
+  };
+
+  struct rule_matches {
+    const rule_hash& parent;
+    const rule_ref& rule;
+
+    rule_matches(const rule_hash& p, const rule_ref& r): parent(p), rule(r) {}
+
+    bool operator() (rule_id id) const {
+      const rule_record& record = parent.records[id];
+      return parent.targets[record.target] == rule.target && parent.predicates[record.predicate] == rule.predicate;
+    }
+  };
+
+  static unsigned int hash_value(const rule_ref& rule) {
+    return static_cast<unsigned int>(rule.hashIndex);
+  }
+
+  rule_id lookup(const rule_ref& rule) const {
+    return table.find(hash_value(rule), rule_matches(*this, rule));
+  }
+
+  // The list of the rules with the predicate, or EMPTY if there is none.
+  unsigned int find_list(const Predicate& pred) const {
+    unsigned int list = predicates.find(pred);
+    if(list == id_hash_table::EMPTY || list >= pred_lists.size() || pred_lists[list].empty())
+      return id_hash_table::EMPTY;
+    return list;
+  }
+
+  // Returns the first non-empty list, starting with list, or pred_lists.size().
+  unsigned int next_list(unsigned int list) const {
+    while(list < pred_lists.size() && pred_lists[list].empty())
+      list++;
+    return list;
+  }
+
+  std::deque<rule_record> records;
+  mutable std::deque<scoreType> goods, bads;
+  mutable std::deque<int> heap_positions;
+  vector<rule_id> free_ids;
+  id_hash_table table;
+  intern_table<Predicate> predicates;
+  intern_table<Target> targets;
+  vector<rule_list_type> pred_lists;
   bool on;
 };
 
+inline rule_ref rule_hash_iterator::operator* () const {
+  return (*parent)[rid];
+}
+
+inline rule_hash_iterator& rule_hash_iterator::operator++ () {
+  rid = parent->next_live(rid+1);
+  return *this;
+}
 
 inline void rule_hash_const_iterator::increment() {
-  if (pred_it == parent->pred_list.end())
+  if (list >= parent->pred_lists.size())
     return;
-  ++list_it;
-  if (list_it == pred_it->second.end()) {
-    pred_it++;
-    if(pred_it == parent->pred_list.end()) { // We reached the end of the world.. :)
-      list_it = parent->fake_list.end();
-      return;
-    }
-    list_it = pred_it->second.begin();
+  if (++list_pos >= parent->pred_lists[list].size()) {
+    // We might reach the end of the world.. :)
+    list = parent->next_list(list+1);
+    list_pos = 0;
   }
 }
 
-inline Rule& rule_hash_const_iterator::operator*()  {
+inline rule_ref rule_hash_const_iterator::operator*()  {
   static Rule fake_rule;
-  if(pred_it == parent->pred_list.end() || list_it == pred_it->second.end()) {
+  if(list >= parent->pred_lists.size()) {
     cerr << "Trying to access a rule at the end of the world" << endl;
     return fake_rule;
   }
-  
-  return const_cast<Rule&>(*const_cast<const Rule*>(*list_it));
-}
 
-inline Rule* rule_hash_const_iterator::operator->()  {
-  static Rule fake_rule;
-  if(pred_it == parent->pred_list.end() || list_it == pred_it->second.end()) {
-    cerr << "Trying to access a rule at the end of the world" << endl;
-    return &fake_rule;
-  }
-  return const_cast<Rule*>(*list_it);
+  return (*parent)[parent->pred_lists[list][list_pos]];
 }
 
-inline HASH_NAMESPACE::hash_set<Rule>::iterator rule_hash_const_iterator::rule_iterator() {
-  static Rule fake_rule;
-  if(pred_it == parent->pred_list.end() || list_it == pred_it->second.end()) {
-    cerr << "Trying to access a rule at the end of the world" << endl;
-    return parent->end();
-  }
-  static Rule r;
-  r = **list_it;
-
-  return parent->find(r);
-}  
+inline rule_id rule_hash_const_iterator::id() const {
+  if(list >= parent->pred_lists.size())
+    return NO_RULE;
+  return parent->pred_lists[list][list_pos];
+}
 
 class RuleTemplate {
 public:
@@ -553,6 +953,10 @@ public:
   }
 
   static string1D TemplateNames;
+  // The feature line and the rule template lines the templates were built
+  // from, kept to be saved in a compiled model.
+  static string FeatureLine;
+  static string1D TemplateLines;
   static RuleTemplate_vector Templates;
   static Dictionary name_map;
   static int2D pt_list;
@@ -578,6 +982,7 @@ public:
   }
 
   static void Initialize();
+  static void Initialize(const string& feature_line, const string1D& template_lines, const string& source);
   
 protected:
   int pred_tid, target_tid;
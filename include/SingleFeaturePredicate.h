@@ -94,6 +94,12 @@ public:
   virtual bool is_indexable() const { 
 	return true;
   }
+
+  virtual bool get_equality_test(relativePosType& sample, featureIndexType& feature) const {
+	sample = sample_difference;
+	feature = feature_id;
+	return true;
+  }
 };
 
 #include "Predicate.h"
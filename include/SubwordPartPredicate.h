@@ -78,6 +78,10 @@ public:
   bool is_indexable() const {
 	return true;
   }
+
+  bool get_equality_test(relativePosType& sample, featureIndexType& feature) const {
+	return false;
+  }
 };
 
 #endif
@@ -52,7 +52,9 @@ public:
   TBLTree(const string& file);
 
   void readInTextFormat(const string& file);
+  void readInTextFormat(istream& istr);
   void readClasses(const string& file);
+  void readClasses(istream& istr);
 
   frontier_iterator frontier_begin() {
     return frontier1.begin();
@@ -31,7 +31,9 @@
 #define _Target_h_
 
 #include "svector.h"
+#include "open_hash.h"
 #include <string.h>
+#include <algorithm>
 #include "Dictionary.h"
 #include "typedef.h"
 #include "Params.h"
@@ -59,26 +61,35 @@ public:
   TargetTemplate(const self& t): positions(t.positions) {
   }
 
+  // When TRUTH_SEPARATOR is defined, a truth value can list several correct
+  // values; the ones that do are split once by InitializeTruthSets, and the
+  // sorted indices of the values of truth t are stored in
+  // truth_set_values[truth_set_start[t]..truth_set_start[t+1]-1] (an empty
+  // range means that t is a simple value). The tables are not modified
+  // afterwards, so they can be read from any thread.
+  static bool multiple_truths;
+  static int1D truth_set_start;
+  static wordTypeVector truth_set_values;
+
+  static void InitializeTruthSets();
+
   static bool value_is_correct(wordType val, wordType truth) {
-	static std::string truth_sep = Params::GetParams()["TRUTH_SEPARATOR"];
-	if(truth_sep == "") // the simple case - there is only one true value per example
+	if(! multiple_truths) // the simple case - there is only one true value per example
 	  return val == truth;
-	else {
-	  static line_splitter ts(truth_sep);
-	  static const Dictionary& dict = Dictionary::GetDictionary();
-	  ts.split(dict[truth]);
-	  if(ts.size()==1)
+	if(static_cast<unsigned int>(truth) + 1 < truth_set_start.size()) {
+	  wordTypeVector::const_iterator 
+		first = truth_set_values.begin() + truth_set_start[truth],
+		last = truth_set_values.begin() + truth_set_start[truth+1];
+	  if(first == last)
 		return val == truth;
-	  else {
-		const std::string& val_str = dict[val];
-		for(int i=0 ; i<ts.size() ; i++)
-		  if(val_str == ts[i])
-			return true;
-		return false;
-	  }
+	  return std::binary_search(first, last, val);
 	}
+	// a value added to the dictionary after the tables were built
+	return value_is_in_truth_string(val, truth);
   }
 
+  static bool value_is_in_truth_string(wordType val, wordType truth);
+
   scoreType goods(const wordType1D& corpus) const {
 	scoreType g = 0;
 
@@ -231,7 +242,7 @@ public:
 
   int hashVal(int val = 0) const {
 	for(unsigned short k=0 ; k<vals.size() ; ++k)
-	  val = 7*val + vals[k];
+	  val = hash_combine(val, vals[k]);
 	return val;
   }
 
@@ -0,0 +1,280 @@
+// -*- C++ -*-
+/*
+  The storage of the corpus: all the samples are kept in one contiguous
+  array (row major - the features of a sample are consecutive, and so are
+  the samples of a sentence), and each sentence is addressed through its
+  offset in the array. corpus[i] is a sentence_view, a small value type
+  with the interface of the old vector of pointers: corpus[i][j] refers to
+  the features of sample j of sentence i, and corpus[i][j][f] is feature f.
+  The array can also be stored by columns (one array per feature, with
+  room at the end of each for the sentences that are added).
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __corpus_h__
+#define __corpus_h__
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+// This header is included by typedef.h, after the definition of wordType.
+
+// The features of one sample: feature f is at data[f*step] (step is 1 when
+// the corpus is stored by rows, and the length of the columns when it is
+// stored by columns).
+class sample_ref {
+public:
+  sample_ref(): data(0), step(1) {}
+
+  sample_ref(wordType* d, size_t s): data(d), step(s) {}
+
+  wordType& operator[] (int f) const {
+    return data[f*step];
+  }
+
+  // Copies the features [first, last) to out.
+  template <class iterator>
+  void copy(int first, int last, iterator out) const {
+    for(int f=first ; f<last ; ++f, ++out)
+      *out = data[f*step];
+  }
+
+  void fill(int first, int last, wordType value) const {
+    for(int f=first ; f<last ; f++)
+      data[f*step] = value;
+  }
+
+private:
+  wordType* data;
+  size_t step;
+};
+
+class sentence_view {
+public:
+  sentence_view(): data(0), length(0), sample_step(0), feature_step(1) {}
+
+  sentence_view(wordType* d, int len, size_t s_step, size_t f_step):
+    data(d), length(len), sample_step(s_step), feature_step(f_step) {}
+
+  sample_ref operator[] (int j) const {
+    return sample_ref(data + j*sample_step, feature_step);
+  }
+
+  int size() const {
+    return length;
+  }
+
+  bool empty() const {
+    return length == 0;
+  }
+
+private:
+  wordType* data;
+  int length;
+  size_t sample_step, feature_step;
+};
+
+class corpus_arena {
+public:
+  // The way the features are arranged in the array: by ROWS, all the
+  // features of a sample are consecutive; by COLUMNS, each feature is stored
+  // in its own array, with the samples in the same order as the rows, so a
+  // scan over one feature touches only the values of that feature.
+  enum layout_type { ROWS, COLUMNS };
+
+  corpus_arena(): used(0), stride(0), num_sentences(0), width(0), current(ROWS) {}
+
+  explicit corpus_arena(int n): used(0), stride(0), num_sentences(0), width(0), current(ROWS) {
+    resize(n);
+  }
+
+  sentence_view operator[] (int i) const {
+    wordType* base = const_cast<wordType*>(data.empty() ? 0 : &data[0]);
+    if(current == ROWS)
+      return sentence_view(base + offsets[i]*width, sizes[i], width, 1);
+    else
+      return sentence_view(base + offsets[i], sizes[i], 1, stride);
+  }
+
+  int size() const {
+    return num_sentences;
+  }
+
+  bool empty() const {
+    return num_sentences == 0;
+  }
+
+  // The number of features of each sample; it has to be set before the
+  // first call to resize_sentence.
+  int sample_width() const {
+    return width;
+  }
+
+  void set_sample_width(int w) {
+    width = w;
+  }
+
+  layout_type layout() const {
+    return current;
+  }
+
+  // Selects the layout of the corpus, and rearranges the samples that are
+  // already stored.
+  void set_layout(layout_type l) {
+    if(l != current)
+      transpose();
+  }
+
+  // Changes the number of sentences. The space of the sentences that are
+  // removed is kept, and reused if the sentences are added back (as when
+  // the data is processed in batches).
+  void resize(int n) {
+    if(n > static_cast<int>(offsets.size())) {
+      offsets.resize(n, 0);
+      sizes.resize(n, 0);
+      capacities.resize(n, 0);
+    }
+    for(int i=num_sentences ; i<n ; i++)
+      sizes[i] = 0;
+    num_sentences = n;
+  }
+
+  // Makes sentence i have len samples. If the sentence does not fit in its
+  // current space, it gets new space after the samples of the other
+  // sentences (the values of its samples are not preserved). By columns,
+  // the new samples are taken from the room at the end of each column; when
+  // there is none left, the columns are copied to longer ones, twice as
+  // long at least.
+  void resize_sentence(int i, int len) {
+    if(len > capacities[i]) {
+      offsets[i] = used;
+      capacities[i] = len;
+      used += len;
+      if(current == ROWS)
+	data.resize(used*width);
+      else if(used > stride)
+	grow_columns(std::max(used, 2*stride));
+    }
+    sizes[i] = len;
+  }
+
+  // Reserves space for the given number of samples.
+  void reserve(size_t samples) {
+    if(current == ROWS)
+      data.reserve(samples*width);
+    else if(samples > stride)
+      grow_columns(samples);
+  }
+
+  // Direct access to the array: feature f of sample j of sentence i is
+  // array()[(sample_offset(i)+j)*sample_step() + f*feature_step()].
+  const wordType* array() const {
+    return data.empty() ? 0 : &data[0];
+  }
+
+  size_t array_size() const {
+    return data.size();
+  }
+
+  size_t sample_offset(int i) const {
+    return offsets[i];
+  }
+
+  size_t sample_step() const {
+    return current == ROWS ? width : 1;
+  }
+
+  size_t feature_step() const {
+    return current == ROWS ? 1 : stride;
+  }
+
+  // The total number of samples given to the sentences, including the
+  // padding.
+  size_t samples() const {
+    return used;
+  }
+
+  void swap(corpus_arena& c) {
+    data.swap(c.data);
+    offsets.swap(c.offsets);
+    sizes.swap(c.sizes);
+    capacities.swap(c.capacities);
+    std::swap(used, c.used);
+    std::swap(stride, c.stride);
+    std::swap(num_sentences, c.num_sentences);
+    std::swap(width, c.width);
+    std::swap(current, c.current);
+  }
+
+  void clear() {
+    corpus_arena empty;
+    empty.width = width;
+    empty.current = current;
+    swap(empty);
+  }
+
+private:
+  // Switches the array between rows and columns; the offsets of the
+  // sentences (counted in samples) stay the same.
+  void transpose() {
+    size_t n = used;
+    std::vector<wordType> other(n*width);
+    if(current == ROWS) {
+      for(size_t s=0 ; s<n ; s++)
+	for(int f=0 ; f<width ; f++)
+	  other[f*n+s] = data[s*width+f];
+      stride = n;
+    } else {
+      for(int f=0 ; f<width ; f++)
+	for(size_t s=0 ; s<n ; s++)
+	  other[s*width+f] = data[f*stride+s];
+      stride = 0;
+    }
+    data.swap(other);
+    current = current == ROWS ? COLUMNS : ROWS;
+  }
+
+  // Copies the columns to columns of length n.
+  void grow_columns(size_t n) {
+    std::vector<wordType> other(n*width);
+    for(int f=0 ; f<width ; f++)
+      std::copy(data.begin()+f*stride, data.begin()+(f+1)*stride, other.begin()+f*n);
+    data.swap(other);
+    stride = n;
+  }
+
+  std::vector<wordType> data;
+  std::vector<size_t> offsets;
+  std::vector<int> sizes, capacities;
+  // The number of samples given to the sentences, and, by columns, the
+  // length of each column (0 by rows).
+  size_t used, stride;
+  int num_sentences;
+  int width;
+  layout_type current;
+};
+
+#endif
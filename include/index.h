@@ -44,6 +44,8 @@
 #include "common.h"
 #include "indexed_map.h"
 #include "hash_wrapper.h"
+#include "posting_list.h"
+#include "position_set.h"
 
 #include <cassert>
 
@@ -53,22 +55,21 @@ class word_index;
 template <typename T1=unsigned int, typename T2=unsigned short>
 class word_index_reference {
 public:
-  typedef unsigned int rep_type;
-  typedef word_index_reference<rep_type> self;  
-  word_index_reference(word_index<T1, T2>& p, rep_type i):parent_index(p), index(i) {
+  typedef word_index_reference<T1, T2> self;  
+  word_index_reference(T1 l, T2 w): line(l), word(w) {
   }
 
   T1 line_id() {
-    return parent_index.pair_map[index].first;
+    return line;
   }
 
   T2 word_id() {
-    return parent_index.pair_map[index].second;
+    return word;
   }
 
 private:
-  word_index<T1, T2>& parent_index;
-  rep_type index;
+  T1 line;
+  T2 word;
 };
 
 template <typename T1=unsigned int, typename T2=unsigned short>
@@ -77,49 +78,47 @@ public:
   //   typedef std::pair<T1, T2> rep_type;
   typedef word_index_reference<T1, T2> rep_type;
   typedef word_index_iterator<T1, T2> self;
-  typedef std::vector<T1> slist_type;
-  typedef std::set<T1> set_type;
+  typedef position_set set_type;
   typedef word_index<T1, T2> index_type;
 
-  word_index_iterator(index_type& p, typename slist_type::iterator it): parent(p), type(0) {
-    real_it.slist_it = it;
+  word_index_iterator(index_type& p, posting_view::const_iterator it): parent(p), type(0), line_hint(0) {
+    real_it.posting_it = it;
   }
 
-  word_index_iterator(index_type& p, typename set_type::iterator it): parent(p), type(1) {
+  word_index_iterator(index_type& p, unsigned int position): parent(p), type(2), line_hint(0) {
+    real_it.position = position;
+  }
+
+  word_index_iterator(index_type& p, set_type::const_iterator it): parent(p), type(1), line_hint(0) {
     real_it.set_it = it; 
   }
 
   rep_type operator*() {
     switch(type) {
     case 0:
-    case 2:
-      return rep_type(parent, *real_it.slist_it);
+      return rep_type(real_it.posting_it.line_id(), real_it.posting_it.word_id());
     case 1:
-      return rep_type(parent, *real_it.set_it);
+      return reference(*real_it.set_it);
+    case 2:
     default:
-      return rep_type(parent, *real_it.slist_it);
+      return reference(real_it.position);
     }	  
   }
 
   std::auto_ptr<rep_type> operator ->() const {
-    switch(type) {
-    case 1:
-      return std::auto_ptr<rep_type>(new rep_type (parent, *real_it.set_it));
-    case 0:
-    case 2:
-    default:
-      return std::auto_ptr<rep_type>(new rep_type (parent, *real_it.slist_it));
-    }
+    return std::auto_ptr<rep_type>(new rep_type (const_cast<self*>(this)->operator*()));
   }
 
   self& operator++() {
     switch(type) {
     case 0:
+      ++real_it.posting_it;
+      break;
     case 2:
-      real_it.slist_it++;
+      real_it.position++;
       break;
     case 1:
-      real_it.set_it++;
+      ++real_it.set_it;
       break;
     }
     return *this;
@@ -127,15 +126,7 @@ public:
 
   self operator++(int) {
     self temp = *this;
-    switch(type) {
-    case 0:
-    case 2:
-      real_it.slist_it++;
-      break;
-    case1:
-      real_it.set_it++;
-      break;
-    }
+    operator++();
     return temp;
   }
 
@@ -145,12 +136,12 @@ public:
 
     switch(type) {
     case 0:
-    case 2:
-      return real_it.slist_it == ot.real_it.slist_it;
+      return real_it.posting_it == ot.real_it.posting_it;
     case 1:
       return real_it.set_it == ot.real_it.set_it;
+    case 2:
     default:
-      return real_it.slist_it == ot.real_it.slist_it;
+      return real_it.position == ot.real_it.position;
     }
   }
 
@@ -159,12 +150,21 @@ public:
   }
 
 protected:
+  // The positions are visited in increasing order, so the sentence of the
+  // previous one is tried first.
+  rep_type reference(unsigned int position) {
+    line_hint = index_type::line_of(position, line_hint);
+    return rep_type(line_hint, position - index_type::sentence_start[line_hint]);
+  }
+
   word_index<T1, T2>& parent;
   struct {
-    typename slist_type::iterator slist_it;
-    typename set_type::iterator set_it;
+    posting_view::const_iterator posting_it;
+    unsigned int position;
+    set_type::const_iterator set_it;
   } real_it;
   int type;
+  T1 line_hint;
 };
 
 template <typename T1=unsigned int, typename T2=unsigned short>
@@ -175,14 +175,17 @@ public:
   typedef T1 index_type1;
   typedef T2 index_type2;
   typedef std::pair<index_type1, index_type2> indices_pair_type;
-  typedef indexed_map<indices_pair_type, unsigned int> bimap_type;
 
-  typedef std::vector<unsigned int> slist_type;
-  typedef std::set<unsigned int> set_type;
+  typedef position_set set_type;
 
   typedef word_index_iterator<T1, T2> iterator;
   typedef word_index<T1, T2>   self;
 
+  // The type 0 indices store, for each token, the positions where it appears as a
+  // compressed posting_list, packed in a posting_table by finalize(); type 1
+  // indices keep the positions of each value in a position_set, as they are
+  // changed while the rules are applied; type 2 indices contain all the
+  // positions of the corpus, for any token.
   word_index(int t=0): type(t) {
     assert(t==0 || t==1 || t==2);
   }
@@ -190,45 +193,31 @@ public:
 
   iterator begin(int n) {
     switch(type) {
-    case 2:
-      n = 0;
     case 0:
-      if(n>=data.slist_field.size())
-	return iterator(*this, static_cast<slist_type::iterator>(fake.slist_field.end()));
-      else 
-	return iterator(*this, data.slist_field[n].begin());
+      return iterator(*this, postings(n).begin());
     case 1:
       if(n>=data.set_field.size())
 	return iterator(*this, fake.set_field.end());
       else
 	return iterator(*this, data.set_field[n].begin());
+    case 2:
     default:
-      if(n>=data.slist_field.size())
-	return iterator(*this, fake.slist_field.end());
-      else 
-	return iterator(*this, data.slist_field[n].end());	  
+      return iterator(*this, 0u);
     }
   }
 
   iterator end(int n) {
     switch(type) {
-    case 2:
-      n = 0;
     case 0:
-      if(n>=data.slist_field.size())
-	return iterator(*this, fake.slist_field.end());
-      else 
-	return iterator(*this, data.slist_field[n].end());
+      return iterator(*this, postings(n).end());
     case 1:
       if(n>=data.set_field.size())
 	return iterator(*this, fake.set_field.end());
       else 
 	return iterator(*this, data.set_field[n].end());
+    case 2:
     default:
-      if(n>=data.slist_field.size())
-	return iterator(*this, fake.slist_field.end());
-      else 
-	return iterator(*this, data.slist_field[n].end());	  
+      return iterator(*this, sentence_start.empty() ? 0u : sentence_start.back());
     }
   }
 
@@ -237,10 +226,9 @@ public:
     case 1:
       if(n>=data.set_field.size())
 	return iterator(*this, fake.set_field.end());
-      return iterator(*this, data.set_field[n].find(pair_map[std::make_pair(i,j)]));
-    case 2:
-      n = 0;
+      return iterator(*this, data.set_field[n].find(position(i,j)));
     case 0:
+    case 2:
     default:
       return begin(n);
     }
@@ -248,96 +236,104 @@ public:
 
   void resize(int new_size) {
     switch (type) {
-    case 2:
-      new_size = 1;
     case 0:
-      data.slist_field.resize(new_size);
+      if(data.packed_postings.size() == 0)
+	data.posting_field.resize(new_size);
       break;
     case 1:
       data.set_field.resize(new_size);
       break;
+    case 2:
+      break;
     }
   }
 
-  void resize(int wrd_index, int new_size) {
-    if(type == 2)
-      wrd_index = 0;
-    if(type==0 || type==2)
-      data.slist_field[wrd_index].resize(new_size);
-  }
-
   void clear(int wrd_index) {
     switch (type) {
-    case 2:
-      wrd_index = 0;
     case 0:
-      data.slist_field[wrd_index].clear();
+      if(wrd_index < data.posting_field.size())
+	data.posting_field[wrd_index].clear();
       break;
     case 1:
       data.set_field[wrd_index].clear();
       break;
+    case 2:
+      break;
     }
   }
 
   void clear() {
     switch (type) {
-    case 2:
     case 0:
-      data.slist_field.clear();
+      data.posting_field.clear();
+      data.packed_postings.clear();
       break;
     case 1:
       data.set_field.clear();
       break;
+    case 2:
+      break;
     }
   }
 
   void insert(int wrd_index, const index_type1& t1, const index_type2& t2) {
     switch (type) {
-    case 2:
-      wrd_index = 0;
     case 0:
-      if(data.slist_field.size() <= wrd_index) 
-	data.slist_field.resize(wrd_index+1);
-      data.slist_field[wrd_index].push_back(pair_map.insert(make_pair(t1,t2)));
+      if(data.packed_postings.size() != 0) {
+	std::cerr << "Error - we were not supposed to add elements to a finalized index!" << "\n";
+	break;
+      }
+      if(data.posting_field.size() <= wrd_index) 
+	data.posting_field.resize(wrd_index+1);
+      data.posting_field[wrd_index].push_back(t1, t2);
       break;
     case 1:
       if(data.set_field.size() <= wrd_index)
 	data.set_field.resize(wrd_index+1);
-      data.set_field[wrd_index].insert(pair_map.insert(make_pair(t1, t2)));
+      data.set_field[wrd_index].insert(position(t1, t2));
+      break;
+    case 2:
       break;
     }
   }
 
   void erase(int wrd_index, const index_type1& t1, const index_type2& t2) {
     switch (type) {
-    case 2:
-      wrd_index = 0;
     case 0:
+    case 2:
       std::cerr << "Error - we were not supposed to remove elements from slist kind of a index!" << "\n";
       break;
     case 1:
-      if(wrd_index>data.set_field.size())
+      if(wrd_index>=data.set_field.size())
 	std::cerr << "Error - trying to erase an element that does not exits" << "\n";
       else
-	data.set_field[wrd_index].erase(pair_map[make_pair(t1, t2)]);
+	data.set_field[wrd_index].erase(position(t1, t2));
       break;
     }
   }
 
+  // Copies the positions of wrd_index from obj; for type 1 indices, the copy
+  // shares the data with obj until one of them is changed, so it can be used
+  // as a snapshot to iterate on while obj is updated.
   void copy_data_field(const self& obj, int wrd_index) {
-    pair_map = obj.pair_map;
     switch (type) {
-    case 2:
-      wrd_index = 0;
-    case 0:
-      if(data.slist_field.size()<=wrd_index)
-	data.slist_field.resize(wrd_index+1);
-      data.slist_field[wrd_index] = obj.data.slist_field[wrd_index];
+    case 0: {
+      if(data.posting_field.size()<=wrd_index)
+	data.posting_field.resize(wrd_index+1);
+      posting_list& l = data.posting_field[wrd_index];
+      l.clear();
+      posting_view v = obj.postings(wrd_index);
+      for(posting_view::const_iterator p=v.begin() ; p!=v.end() ; ++p)
+	l.push_back(p.line_id(), p.word_id());
       break;
+    }
     case 1:
       if(data.set_field.size() <= wrd_index) 
 	data.set_field.resize(wrd_index+1);
-      data.set_field[wrd_index] = obj.data.set_field[wrd_index];
+      if(wrd_index < obj.data.set_field.size())
+	data.set_field[wrd_index] = obj.data.set_field[wrd_index];
+      break;
+    case 2:
       break;
     }
   }
@@ -346,52 +342,79 @@ public:
     return type;
   }
 
+  // Numbers the positions of the corpus, whose sentences have the given
+  // sizes: the word j of the sentence i is sentence_start[i]+j. Each sentence
+  // gets one more number, for the position just after its end (which is
+  // indexed for the fake word).
   static void create_map(std::vector<int>& counts) {
-    pair_map.clear();
+    sentence_start.resize(counts.size()+1);
+    sentence_start[0] = 0;
     for(unsigned int i=0 ; i<counts.size() ; ++i)
-      for(unsigned short int j=0 ; j<counts[i] ; ++j)
-	pair_map.insert(std::make_pair(i, j));
+      sentence_start[i+1] = sentence_start[i] + counts[i] + 1;
+  }
+
+  static unsigned int position(index_type1 i, index_type2 j) {
+    ON_DEBUG(assert(i+1 < sentence_start.size() && sentence_start[i]+j < sentence_start[i+1]));
+    return sentence_start[i] + j;
+  }
+
+  // The sentence of a position; hint is checked first, then the sentence after it.
+  static index_type1 line_of(unsigned int p, index_type1 hint = 0) {
+    if(hint+1 < sentence_start.size() && sentence_start[hint] <= p) {
+      if(p < sentence_start[hint+1])
+	return hint;
+      if(hint+2 < sentence_start.size() && p < sentence_start[hint+2])
+	return hint+1;
+    }
+    return std::upper_bound(sentence_start.begin(), sentence_start.end(), p) - sentence_start.begin() - 1;
   }
 
   void finalize() {
     switch(type) {
-    case 0:
-      for(int i=0 ; i<data.slist_field.size() ; i++) {
-	slist_type temp = data.slist_field[i];
-	temp.swap(data.slist_field[i]);
-      }
-      break;
-    case 2:
-      data.slist_field.resize(1);
-      data.slist_field[0].resize(pair_map.size());
-      iota(data.slist_field[0].begin(), data.slist_field[0].end(), 0);
+    case 0: {
+      data.packed_postings.pack(data.posting_field);
+      std::vector<posting_list> tmp;
+      data.posting_field.swap(tmp);
       break;
+    }
     case 1:
+    case 2:
       break;
     }
   }
 
+  // s1 is the number of positions stored in the index, s2 the memory used by them.
   void compute_sizes(int& s1, int& s2) {
-    s1 = s2 = 0;
-    for(int i=0 ; i<data.slist_field.size() ; i++) {
-      s1 += data.slist_field[i].size();
-      s2 += data.slist_field[i].capacity();
-    }
+    s1 = 0;
+    s2 = data.packed_postings.memory();
+    for(int i=0 ; i<data.packed_postings.size() ; i++)
+      for(posting_view::const_iterator p=data.packed_postings[i].begin() ; p!=data.packed_postings[i].end() ; ++p)
+	s1++;
+  }
+
+  // The positions of the token n, in a type 0 index.
+  posting_view postings(int n) const {
+    if(n < data.packed_postings.size())
+      return data.packed_postings[n];
+    if(n < data.posting_field.size())
+      return data.posting_field[n].view();
+    return posting_view();
   }
 
 protected:
+
   struct {
-    std::vector<slist_type> slist_field;
+    std::vector<posting_list> posting_field;
+    posting_table packed_postings;
     std::vector<set_type> set_field;
   } data;
   
   struct {
-    slist_type slist_field;
     set_type set_field;
   } fake;
   
   unsigned short int type;
-  static indexed_map<std::pair<T1, T2> > pair_map;
+  static std::vector<unsigned int> sentence_start;
 };
 
 namespace HASH_NAMESPACE {
@@ -404,5 +427,5 @@ namespace HASH_NAMESPACE {
 }
 
 template <typename T1, typename T2>
-indexed_map<std::pair<T1, T2> > word_index<T1, T2>::pair_map;
+std::vector<unsigned int> word_index<T1, T2>::sentence_start;
 #endif
@@ -33,10 +33,32 @@
 using namespace std;
 
 void process_line(const string1D& features, int line_no);
-void studyData(const string&, const string& = "");
-void readInData(char*);
-bool read_lines(istream&, int num_lines=1);
+// The training vocabulary is read from train_file, unless it was already
+// loaded (from a compiled model) - vocabulary_loaded. The data in
+// appended_file (if any) is studied after the one in the first file.
+void studyData(const string&, const string& train_file = "", bool vocabulary_loaded = false, 
+	       const string& appended_file = "");
+int readInData(char*, int shard=0, int num_shards=1, int first_line=0);
+bool read_lines(istream&, int num_lines=1, string* error=0);
 void generate_index(const set<int>& = set<int>());
 void clear_corpus();
 void printCorpusState(ostream&, bool printRT=false);
+void writeCorpusState(ostream&);
+bool readCorpusState(istream&, int num_lines=-1, const wordTypeVector* translation=0);
+
+// Length-prefixed messages over a file descriptor (a pipe or a socket),
+// used between the processes of the sharded training.
+bool write_message(int fd, const string& message);
+bool read_message(int fd, string& message);
+
+// Raw binary I/O of plain values, used for the checkpoints of fnTBL-train.
+template <class T>
+inline void write_binary(ostream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+inline bool read_binary(istream& in, T& value) {
+  return ! in.read(reinterpret_cast<char*>(&value), sizeof(T)).fail();
+}
 #endif
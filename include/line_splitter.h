@@ -33,6 +33,7 @@
 #include <cstdlib>
 #include <string>
 #include <vector>
+#include "threads.h"
 
 class line_splitter {
 protected:
@@ -126,7 +127,7 @@ inline void line_splitter::split(const std::string& line) {
   unsigned char prev = ' ', curr;
   noWords = 0;
   const char * temp = line.c_str();
-  static char word[100000];
+  static THREAD_LOCAL char word[100000];
   word[0] = '\0';
   bool prev_separator = true;
 
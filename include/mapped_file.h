@@ -0,0 +1,97 @@
+// -*- C++ -*-
+/*
+  mapped_file - a file mapped read-only in memory (with mmap). The pages
+  are shared with the other processes mapping the same file, and are read
+  from the disk only when they are first accessed.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __mapped_file_h__
+#define __mapped_file_h__
+
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+class mapped_file {
+public:
+  mapped_file(): start(0), length(0) {}
+
+  ~mapped_file() {
+    close();
+  }
+
+  // Maps the whole file; returns false if it cannot be opened or mapped
+  // (or is empty).
+  bool open(const std::string& name) {
+    close();
+    int fd = ::open(name.c_str(), O_RDONLY);
+    if(fd < 0)
+      return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      return false;
+    }
+    void* p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED)
+      return false;
+    start = static_cast<const char*>(p);
+    length = st.st_size;
+    return true;
+  }
+
+  void close() {
+    if(start != 0)
+      munmap(const_cast<char*>(start), length);
+    start = 0;
+    length = 0;
+  }
+
+  bool is_open() const {
+    return start != 0;
+  }
+
+  const char* data() const {
+    return start;
+  }
+
+  unsigned long size() const {
+    return length;
+  }
+
+private:
+  mapped_file(const mapped_file&);
+  mapped_file& operator = (const mapped_file&);
+
+  const char* start;
+  unsigned long length;
+};
+
+#endif
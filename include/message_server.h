@@ -0,0 +1,101 @@
+// -*- C++ -*-
+/*
+  message_server - answers requests sent as length-prefixed messages (the
+  format of read_message and write_message in io.h: the length of the
+  message, as a native unsigned int, followed by its bytes), either on a
+  Unix domain socket or on the standard input and output.
+
+  The requests are answered one at a time, in a single thread, by a
+  message_handler, so the handler can use the global state of the
+  program. On the socket, the server keeps up to max_clients connections
+  open and takes the requests of the clients in turn; the ones that
+  connect beyond that wait in the listen queue. A client is not read from
+  while it has a complete request waiting or a reply that was not sent
+  yet, so a client that sends faster than it is served, or does not read
+  its replies, fills its socket buffers and blocks, without holding
+  memory in the server. The time from the moment a request is complete
+  to the moment its reply is ready is added to the latency histogram.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __message_server_h__
+#define __message_server_h__
+
+#include <string>
+#include <vector>
+#include "telemetry.h"
+
+class message_handler {
+public:
+  virtual ~message_handler() {}
+
+  // Computes the reply to a request.
+  virtual void handle(const std::string& request, std::string& reply) = 0;
+};
+
+class message_server {
+public:
+  // Requests longer than max_message bytes close the connection.
+  message_server(message_handler& h, latency_histogram& l, int max_clients = 64, unsigned int max_message = 1u << 26):
+    handler(h), latencies(l), max_clients(max_clients), max_message(max_message) {}
+
+  // Serves the clients of the socket at path (which is replaced if it
+  // exists) until the process gets SIGINT or SIGTERM; exits with an error
+  // if the socket cannot be created.
+  void serve_socket(const std::string& path);
+
+  // Serves the requests on the standard input, until its end, with the
+  // replies on the standard output.
+  void serve_stdio();
+
+private:
+  struct client {
+    int fd;
+    std::string input, output;
+    std::string::size_type written;
+    // The time at which the first request in input was complete (0 if
+    // there is none).
+    double ready;
+    bool closed;
+
+    client(int f): fd(f), written(0), ready(0), closed(false) {}
+  };
+
+  message_server(const message_server&);
+  message_server& operator = (const message_server&);
+
+  bool read_input(client& c);
+  bool write_output(client& c);
+  int complete_request(const client& c) const;
+  void answer(client& c);
+
+  message_handler& handler;
+  latency_histogram& latencies;
+  int max_clients;
+  unsigned int max_message;
+  std::vector<client> clients;
+};
+
+#endif
@@ -0,0 +1,201 @@
+// -*- C++ -*-
+/*
+  id_hash_table - a flat, open addressing hash table of 32-bit ids.
+
+  The table stores only the ids and the hash values of the keys; the keys
+  themselves live elsewhere (e.g. in a rule_arena), and are compared
+  through the functor passed to find(). Collisions are resolved by linear
+  probing on a power-of-two sized array, and erasing is done by shifting
+  back the following entries, so there are no tombstones.
+
+  Also defines the hash mixing functions used by the Predicate, Target and
+  Rule hash values.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __open_hash_h__
+#define __open_hash_h__
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+// Adds value to the hash h.
+inline unsigned int hash_combine(unsigned int h, unsigned int value) {
+  return h ^ (value + 0x9e3779b9u + (h << 6) + (h >> 2));
+}
+
+// Scrambles the bits of h (the finalizer of MurmurHash3), such that every
+// bit of the input affects the low bits used to index the tables.
+inline unsigned int hash_finalize(unsigned int h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+class id_hash_table {
+public:
+  typedef unsigned int id_type;
+  static const id_type EMPTY = static_cast<id_type>(-1);
+
+  id_hash_table(): count(0), mask(0) {}
+
+  // Returns the id of the entry with hash value h for which matches(id)
+  // is true, or EMPTY if there is no such entry.
+  template <class predicate>
+  id_type find(unsigned int h, const predicate& matches) const {
+    if(count == 0)
+      return EMPTY;
+    for(size_t i = h & mask ; ; i = (i+1) & mask) {
+      const entry& e = entries[i];
+      if(e.id == EMPTY)
+	return EMPTY;
+      if(e.hash == h && matches(e.id))
+	return e.id;
+    }
+  }
+
+  // Adds the id; it should not be in the table already.
+  void insert(unsigned int h, id_type id) {
+    // Keep the load factor under 3/4.
+    if(4*(count+1) > 3*entries.size())
+      resize(entries.empty() ? 16 : 2*entries.size());
+    place(h, id);
+    count++;
+  }
+
+  void erase(unsigned int h, id_type id) {
+    size_t i = h & mask;
+    while(entries[i].id != id)
+      i = (i+1) & mask;
+
+    // Move back the entries that would not be found anymore after the
+    // slot i is emptied.
+    for(size_t j = (i+1) & mask ; entries[j].id != EMPTY ; j = (j+1) & mask) {
+      size_t home = entries[j].hash & mask;
+      if(((j - home) & mask) >= ((j - i) & mask)) {
+	entries[i] = entries[j];
+	i = j;
+      }
+    }
+    entries[i].id = EMPTY;
+    count--;
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  size_t capacity() const {
+    return entries.size();
+  }
+
+  void clear() {
+    if(count == 0)
+      return;
+    for(entry_vector::iterator e=entries.begin() ; e!=entries.end() ; ++e)
+      e->id = EMPTY;
+    count = 0;
+  }
+
+  void destroy() {
+    entry_vector tmp;
+    entries.swap(tmp);
+    count = 0;
+    mask = 0;
+  }
+
+  void swap(id_hash_table& table) {
+    entries.swap(table.entries);
+    std::swap(count, table.count);
+    std::swap(mask, table.mask);
+  }
+
+  // Prints the load of the table and the distribution of the number of
+  // probes needed to find the entries that are in it.
+  void print_statistics(std::ostream& ostr, const char* name) const {
+    static const int MAX_PROBES = 16;
+    std::vector<size_t> histogram(MAX_PROBES+1, 0);
+    size_t total = 0, longest = 0, cluster = 0, longest_cluster = 0;
+    for(size_t i=0 ; i<entries.size() ; i++) {
+      if(entries[i].id == EMPTY) {
+	cluster = 0;
+	continue;
+      }
+      size_t probes = ((i - (entries[i].hash & mask)) & mask) + 1;
+      total += probes;
+      if(probes > longest)
+	longest = probes;
+      histogram[probes < MAX_PROBES ? probes : MAX_PROBES]++;
+      if(++cluster > longest_cluster)
+	longest_cluster = cluster;
+    }
+
+    ostr << name << ": " << count << " entries in " << entries.size() << " slots (load "
+	 << std::setprecision(3) << (entries.empty() ? 0.0 : static_cast<double>(count)/entries.size())
+	 << "), average probes " << (count == 0 ? 0.0 : static_cast<double>(total)/count)
+	 << ", longest probe " << longest << ", longest cluster " << longest_cluster << std::endl;
+    ostr << "  probes:";
+    for(int p=1 ; p<=MAX_PROBES ; p++)
+      if(histogram[p] > 0)
+	ostr << " " << p << (p == MAX_PROBES ? "+" : "") << ":" << histogram[p];
+    ostr << std::endl;
+  }
+
+private:
+  struct entry {
+    unsigned int hash;
+    id_type id;
+  };
+  typedef std::vector<entry> entry_vector;
+
+  void place(unsigned int h, id_type id) {
+    size_t i = h & mask;
+    while(entries[i].id != EMPTY)
+      i = (i+1) & mask;
+    entries[i].hash = h;
+    entries[i].id = id;
+  }
+
+  void resize(size_t new_size) {
+    entry_vector old(new_size);
+    old.swap(entries);
+    mask = new_size-1;
+    for(entry_vector::iterator e=entries.begin() ; e!=entries.end() ; ++e)
+      e->id = EMPTY;
+    for(entry_vector::iterator e=old.begin() ; e!=old.end() ; ++e)
+      if(e->id != EMPTY)
+	place(e->hash, e->id);
+  }
+
+  entry_vector entries;
+  size_t count;
+  size_t mask;
+};
+
+#endif
@@ -0,0 +1,309 @@
+// -*- C++ -*-
+/*
+  position_set - a mutable set of corpus positions (unsigned integers),
+  used by the word_index for the positions of each classification value.
+
+  The positions are split in chunks of 2^16 consecutive values, as in the
+  roaring bitmaps: a chunk keeps the low 16 bits of its positions either
+  as a sorted array (when it has at most ARRAY_LIMIT of them) or as a
+  bitmap. Copying a set is cheap - the chunks are shared and reference
+  counted, and a chunk is copied only when one of the sets sharing it is
+  modified - so a copy can be used as a snapshot to iterate on while the
+  original set changes.
+
+  The sets (and their copies) should be modified by only one thread at a
+  time; any number of threads can iterate on a set that does not change.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __position_set_h__
+#define __position_set_h__
+
+#include <vector>
+#include <algorithm>
+
+class position_set {
+public:
+  // A chunk with more positions than this is stored as a bitmap; a bitmap
+  // chunk with less than half of it goes back to an array.
+  enum { ARRAY_LIMIT = 4096, BITMAP_WORDS = 65536 / 32 };
+
+  position_set(): count(0) {}
+
+  position_set(const position_set& s): chunks(s.chunks), count(s.count) {
+    for(std::vector<chunk_ref>::iterator c=chunks.begin() ; c!=chunks.end() ; ++c)
+      c->data->refs++;
+  }
+
+  ~position_set() {
+    clear();
+  }
+
+  position_set& operator = (const position_set& s) {
+    if(this != &s) {
+      position_set temp(s);
+      swap(temp);
+    }
+    return *this;
+  }
+
+  void swap(position_set& s) {
+    chunks.swap(s.chunks);
+    std::swap(count, s.count);
+  }
+
+  unsigned int size() const {
+    return count;
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  void clear() {
+    for(std::vector<chunk_ref>::iterator c=chunks.begin() ; c!=chunks.end() ; ++c)
+      release(c->data);
+    chunks.clear();
+    count = 0;
+  }
+
+  // Returns true if p was not in the set.
+  bool insert(unsigned int p) {
+    unsigned int high = p >> 16;
+    unsigned short low = static_cast<unsigned short>(p & 0xffff);
+    std::vector<chunk_ref>::iterator c = find_chunk(high);
+    if(c == chunks.end() || c->high != high)
+      c = chunks.insert(c, chunk_ref(high, new chunk));
+    else
+      unshare(*c);
+
+    chunk& ch = *c->data;
+    if(ch.bits.empty()) {
+      std::vector<unsigned short>::iterator v = std::lower_bound(ch.values.begin(), ch.values.end(), low);
+      if(v != ch.values.end() && *v == low)
+	return false;
+      ch.values.insert(v, low);
+      if(ch.values.size() > ARRAY_LIMIT)
+	ch.to_bitmap();
+    } else {
+      unsigned int& w = ch.bits[low >> 5];
+      unsigned int mask = 1u << (low & 31);
+      if(w & mask)
+	return false;
+      w |= mask;
+      ch.size++;
+    }
+    count++;
+    return true;
+  }
+
+  // Returns true if p was in the set.
+  bool erase(unsigned int p) {
+    unsigned int high = p >> 16;
+    unsigned short low = static_cast<unsigned short>(p & 0xffff);
+    std::vector<chunk_ref>::iterator c = find_chunk(high);
+    if(c == chunks.end() || c->high != high || ! c->data->contains(low))
+      return false;
+    unshare(*c);
+
+    chunk& ch = *c->data;
+    if(ch.bits.empty())
+      ch.values.erase(std::lower_bound(ch.values.begin(), ch.values.end(), low));
+    else {
+      ch.bits[low >> 5] &= ~(1u << (low & 31));
+      if(--ch.size < ARRAY_LIMIT / 2)
+	ch.to_array();
+    }
+    count--;
+    if(ch.empty()) {
+      release(c->data);
+      chunks.erase(c);
+    }
+    return true;
+  }
+
+  bool contains(unsigned int p) const {
+    unsigned int high = p >> 16;
+    std::vector<chunk_ref>::const_iterator c = find_chunk(high);
+    return c != chunks.end() && c->high == high && c->data->contains(static_cast<unsigned short>(p & 0xffff));
+  }
+
+  // Iterates on the positions in increasing order.
+  class const_iterator {
+  public:
+    const_iterator(): set(0), ci(0), pos(0), value(0) {}
+
+    unsigned int operator*() const {
+      return value;
+    }
+
+    const_iterator& operator++() {
+      pos++;
+      settle();
+      return *this;
+    }
+
+    bool operator == (const const_iterator& ot) const {
+      return set == ot.set && ci == ot.ci && pos == ot.pos;
+    }
+
+    bool operator != (const const_iterator& ot) const {
+      return ! operator == (ot);
+    }
+
+  private:
+    friend class position_set;
+
+    const_iterator(const position_set* s, unsigned int c, unsigned int p): set(s), ci(c), pos(p), value(0) {
+      settle();
+    }
+
+    // Moves to the first position at or after (ci, pos), if any.
+    void settle() {
+      for( ; ci < set->chunks.size() ; ci++, pos=0) {
+	const chunk& ch = *set->chunks[ci].data;
+	unsigned int high = set->chunks[ci].high << 16;
+	if(ch.bits.empty()) {
+	  if(pos < ch.values.size()) {
+	    value = high | ch.values[pos];
+	    return;
+	  }
+	} else {
+	  for(unsigned int w = pos >> 5 ; w < BITMAP_WORDS ; w++) {
+	    unsigned int bits = ch.bits[w];
+	    if(w == pos >> 5)
+	      bits &= ~0u << (pos & 31);
+	    if(bits) {
+	      pos = (w << 5) + __builtin_ctz(bits);
+	      value = high | pos;
+	      return;
+	    }
+	  }
+	}
+      }
+      pos = 0;
+    }
+
+    const position_set* set;
+    unsigned int ci, pos, value;
+  };
+
+  const_iterator begin() const {
+    return const_iterator(this, 0, 0);
+  }
+
+  const_iterator end() const {
+    return const_iterator(this, chunks.size(), 0);
+  }
+
+  const_iterator find(unsigned int p) const {
+    unsigned int high = p >> 16;
+    unsigned short low = static_cast<unsigned short>(p & 0xffff);
+    std::vector<chunk_ref>::const_iterator c = find_chunk(high);
+    if(c == chunks.end() || c->high != high || ! c->data->contains(low))
+      return end();
+    const chunk& ch = *c->data;
+    unsigned int k = ch.bits.empty() ? std::lower_bound(ch.values.begin(), ch.values.end(), low) - ch.values.begin() : low;
+    return const_iterator(this, c - chunks.begin(), k);
+  }
+
+private:
+  struct chunk {
+    unsigned int refs;
+    unsigned int size;                  // the number of positions, in a bitmap
+    std::vector<unsigned short> values; // the sorted positions, if bits is empty
+    std::vector<unsigned int> bits;
+
+    chunk(): refs(1), size(0) {}
+
+    bool empty() const {
+      return bits.empty() ? values.empty() : size == 0;
+    }
+
+    bool contains(unsigned short low) const {
+      if(bits.empty())
+	return std::binary_search(values.begin(), values.end(), low);
+      return (bits[low >> 5] >> (low & 31)) & 1;
+    }
+
+    void to_bitmap() {
+      bits.assign(BITMAP_WORDS, 0);
+      for(std::vector<unsigned short>::iterator v=values.begin() ; v!=values.end() ; ++v)
+	bits[*v >> 5] |= 1u << (*v & 31);
+      size = values.size();
+      std::vector<unsigned short> temp;
+      values.swap(temp);
+    }
+
+    void to_array() {
+      values.reserve(size);
+      for(unsigned int w=0 ; w<BITMAP_WORDS ; w++)
+	for(unsigned int b=bits[w] ; b ; b &= b-1)
+	  values.push_back(static_cast<unsigned short>((w << 5) + __builtin_ctz(b)));
+      std::vector<unsigned int> temp;
+      bits.swap(temp);
+      size = 0;
+    }
+  };
+
+  struct chunk_ref {
+    unsigned int high;
+    chunk* data;
+
+    chunk_ref(unsigned int h, chunk* d): high(h), data(d) {}
+
+    bool operator < (unsigned int h) const {
+      return high < h;
+    }
+  };
+
+  std::vector<chunk_ref>::iterator find_chunk(unsigned int high) {
+    return std::lower_bound(chunks.begin(), chunks.end(), high);
+  }
+
+  std::vector<chunk_ref>::const_iterator find_chunk(unsigned int high) const {
+    return std::lower_bound(chunks.begin(), chunks.end(), high);
+  }
+
+  // Makes sure that the chunk is not shared with another set, before it is modified.
+  static void unshare(chunk_ref& c) {
+    if(c.data->refs > 1) {
+      chunk* copy = new chunk(*c.data);
+      copy->refs = 1;
+      c.data->refs--;
+      c.data = copy;
+    }
+  }
+
+  static void release(chunk* c) {
+    if(--c->refs == 0)
+      delete c;
+  }
+
+  std::vector<chunk_ref> chunks;
+  unsigned int count;
+};
+
+#endif
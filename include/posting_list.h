@@ -0,0 +1,381 @@
+// -*- C++ -*-
+/*
+  posting_list - a compressed list of corpus positions (sentence, word),
+  in increasing order, as stored by the word_index for each token.
+
+  The positions are delta-encoded as variable length integers (7 bits per
+  byte). A position in the same sentence as the previous one is stored as
+  twice the difference of the word positions; otherwise, twice the
+  difference of the sentences plus 1 is followed by the word position. Every
+  SKIP_INTERVAL-th position is encoded relative to (0,0), and its byte
+  offset and sentence are kept in a skip table, so the iterators can jump
+  ahead to a given sentence (skip_to) without decoding everything in
+  between.
+
+  A posting_list is used while the positions are added; posting_table then
+  packs all the lists of an index in a single array, and both are read
+  through a posting_view. posting_intersection walks two lists at once.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __posting_list_h__
+#define __posting_list_h__
+
+#include <vector>
+#include <cassert>
+#include "debug.h"
+
+struct posting_skip {
+  unsigned int offset;
+  unsigned int line;
+
+  posting_skip(unsigned int o=0, unsigned int l=0): offset(o), line(l) {}
+};
+
+// A read-only list of positions, in the format described above.
+class posting_view {
+public:
+  typedef unsigned int line_type;
+  typedef unsigned short word_type;
+
+  enum { SKIP_INTERVAL = 64 };
+
+  posting_view(): bytes(0), size(0), skips(0), num_skips(0) {}
+  posting_view(const unsigned char* b, unsigned int s, const posting_skip* sk, unsigned int n):
+    bytes(b), size(s), skips(sk), num_skips(n) {}
+
+  class const_iterator {
+  public:
+    const_iterator(): bytes(0), size(0), skips(0), num_skips(0), offset(0), next(0), index(0), line(0), word(0) {}
+
+    line_type line_id() const {
+      return line;
+    }
+
+    word_type word_id() const {
+      return word;
+    }
+
+    const_iterator& operator++() {
+      offset = next;
+      ++index;
+      decode();
+      return *this;
+    }
+
+    // Advances to the first position in a sentence not smaller than l.
+    void skip_to(line_type l) {
+      if(offset >= size || line >= l)
+	return;
+      // the last skip point before l, if it is ahead of us (skips[k] is the
+      // position (k+1)*SKIP_INTERVAL)
+      unsigned int first = index / SKIP_INTERVAL, last = num_skips;
+      while(first < last) {
+	unsigned int middle = (first + last) / 2;
+	if(skips[middle].line < l)
+	  first = middle + 1;
+	else
+	  last = middle;
+      }
+      if(first > index / SKIP_INTERVAL) {
+	index = first * SKIP_INTERVAL;
+	offset = skips[first-1].offset;
+	decode();
+      }
+      while(offset < size && line < l)
+	operator++();
+    }
+
+    bool operator == (const const_iterator& ot) const {
+      return offset == ot.offset && bytes == ot.bytes;
+    }
+
+    bool operator != (const const_iterator& ot) const {
+      return ! operator == (ot);
+    }
+
+  private:
+    friend class posting_view;
+
+    const_iterator(const posting_view& l, unsigned int o): 
+      bytes(l.bytes), size(l.size), skips(l.skips), num_skips(l.num_skips), offset(o), next(o), index(0), line(0), word(0) {
+      decode();
+    }
+
+    // Decodes the position starting at offset, if there is one.
+    void decode() {
+      if(offset >= size)
+	return;
+      if(index % SKIP_INTERVAL == 0) {
+	line = 0;
+	word = 0;
+      }
+      next = offset;
+      unsigned int d = get(bytes, next);
+      if(d & 1) {
+	line += d >> 1;
+	word = get(bytes, next);
+      } else
+	word += d >> 1;
+    }
+
+    const unsigned char* bytes;
+    unsigned int size;
+    const posting_skip* skips;
+    unsigned int num_skips;
+    unsigned int offset, next, index;
+    line_type line;
+    word_type word;
+  };
+
+  const_iterator begin() const {
+    return const_iterator(*this, 0);
+  }
+
+  const_iterator end() const {
+    return const_iterator(*this, size);
+  }
+
+  // The size of the encoded list, in bytes.
+  unsigned int byte_size() const {
+    return size;
+  }
+
+  static void put(std::vector<unsigned char>& b, unsigned int v) {
+    while(v >= 0x80) {
+      b.push_back(static_cast<unsigned char>(v | 0x80));
+      v >>= 7;
+    }
+    b.push_back(static_cast<unsigned char>(v));
+  }
+
+  static unsigned int get(const unsigned char* b, unsigned int& o) {
+    unsigned int v = b[o++];
+    if(v < 0x80)
+      return v;
+    v &= 0x7f;
+    int shift = 7;
+    unsigned char c;
+    do {
+      c = b[o++];
+      v |= static_cast<unsigned int>(c & 0x7f) << shift;
+      shift += 7;
+    } while(c & 0x80);
+    return v;
+  }
+
+private:
+  const unsigned char* bytes;
+  unsigned int size;
+  const posting_skip* skips;
+  unsigned int num_skips;
+};
+
+// Iterates on the positions (line, word) such that (line, word+d1) is in the
+// first list and (line, word+d2) in the second one, in increasing order: the
+// lists are merged, skipping ahead (with skip_to) to the sentence of the other
+// list when one of them is behind.
+class posting_intersection {
+public:
+  typedef posting_view::line_type line_type;
+
+  posting_intersection(const posting_view& l1, int diff1, const posting_view& l2, int diff2):
+    it1(l1.begin()), end1(l1.end()), it2(l2.begin()), end2(l2.end()), d1(diff1), d2(diff2) {
+    settle();
+  }
+
+  bool done() const {
+    return it1 == end1 || it2 == end2;
+  }
+
+  line_type line_id() const {
+    return it1.line_id();
+  }
+
+  int word_id() const {
+    return static_cast<int>(it1.word_id()) - d1;
+  }
+
+  void next() {
+    ++it1;
+    ++it2;
+    settle();
+  }
+
+private:
+  // Advances the iterators to the next common position.
+  void settle() {
+    while(it1 != end1 && it2 != end2) {
+      if(it1.line_id() < it2.line_id())
+	it1.skip_to(it2.line_id());
+      else if(it2.line_id() < it1.line_id())
+	it2.skip_to(it1.line_id());
+      else {
+	int w1 = static_cast<int>(it1.word_id()) - d1, w2 = static_cast<int>(it2.word_id()) - d2;
+	if(w1 < w2)
+	  ++it1;
+	else if(w2 < w1)
+	  ++it2;
+	else
+	  return;
+      }
+    }
+  }
+
+  posting_view::const_iterator it1, end1, it2, end2;
+  int d1, d2;
+};
+
+// A list of positions to which new (larger) positions can be added.
+class posting_list {
+public:
+  typedef posting_view::line_type line_type;
+  typedef posting_view::word_type word_type;
+  typedef posting_view::const_iterator const_iterator;
+
+  posting_list(): count(0), last_line(0), last_word(0) {}
+
+  // Appends a position; the positions have to be added in increasing order.
+  void push_back(line_type line, word_type word) {
+    ON_DEBUG(assert(count == 0 || line > last_line || (line == last_line && word >= last_word)));
+    line_type prev_line = last_line;
+    word_type prev_word = last_word;
+    if(count % posting_view::SKIP_INTERVAL == 0) {
+      if(count > 0)
+	skips.push_back(posting_skip(bytes.size(), line));
+      prev_line = 0;
+      prev_word = 0;
+    }
+    if(line == prev_line)
+      posting_view::put(bytes, (word - prev_word) << 1);
+    else {
+      posting_view::put(bytes, ((line - prev_line) << 1) | 1);
+      posting_view::put(bytes, word);
+    }
+    last_line = line;
+    last_word = word;
+    count++;
+  }
+
+  unsigned int size() const {
+    return count;
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  void clear() {
+    std::vector<unsigned char> b;
+    std::vector<posting_skip> s;
+    bytes.swap(b);
+    skips.swap(s);
+    count = 0;
+    last_line = 0;
+    last_word = 0;
+  }
+
+  posting_view view() const {
+    return posting_view(bytes.empty() ? 0 : &bytes[0], bytes.size(), skips.empty() ? 0 : &skips[0], skips.size());
+  }
+
+  const_iterator begin() const {
+    return view().begin();
+  }
+
+  const_iterator end() const {
+    return view().end();
+  }
+
+private:
+  friend class posting_table;
+
+  std::vector<unsigned char> bytes;
+  std::vector<posting_skip> skips;
+  unsigned int count;
+  line_type last_line;
+  word_type last_word;
+};
+
+// The posting lists of all the tokens of an index, stored contiguously.
+class posting_table {
+public:
+  posting_table() {}
+
+  // Packs the lists (which are cleared).
+  void pack(std::vector<posting_list>& lists) {
+    clear();
+    unsigned int total_bytes = 0, total_skips = 0;
+    for(unsigned int i=0 ; i<lists.size() ; i++) {
+      total_bytes += lists[i].bytes.size();
+      total_skips += lists[i].skips.size();
+    }
+    bytes.reserve(total_bytes);
+    skips.reserve(total_skips);
+    list_start.reserve(lists.size()+1);
+    skip_start.reserve(lists.size()+1);
+    for(unsigned int i=0 ; i<lists.size() ; i++) {
+      list_start.push_back(bytes.size());
+      skip_start.push_back(skips.size());
+      bytes.insert(bytes.end(), lists[i].bytes.begin(), lists[i].bytes.end());
+      skips.insert(skips.end(), lists[i].skips.begin(), lists[i].skips.end());
+      lists[i].clear();
+    }
+    list_start.push_back(bytes.size());
+    skip_start.push_back(skips.size());
+  }
+
+  unsigned int size() const {
+    return list_start.empty() ? 0 : list_start.size()-1;
+  }
+
+  posting_view operator[] (unsigned int i) const {
+    return posting_view(bytes.empty() ? 0 : &bytes[0] + list_start[i], list_start[i+1] - list_start[i], 
+			skips.empty() ? 0 : &skips[0] + skip_start[i], skip_start[i+1] - skip_start[i]);
+  }
+
+  void clear() {
+    std::vector<unsigned char> b;
+    std::vector<posting_skip> s;
+    std::vector<unsigned int> l1, l2;
+    bytes.swap(b);
+    skips.swap(s);
+    list_start.swap(l1);
+    skip_start.swap(l2);
+  }
+
+  // The number of bytes used by the table.
+  unsigned int memory() const {
+    return bytes.capacity() + skips.capacity() * sizeof(posting_skip) + 
+      (list_start.capacity() + skip_start.capacity()) * sizeof(unsigned int);
+  }
+
+private:
+  std::vector<unsigned char> bytes;
+  std::vector<posting_skip> skips;
+  std::vector<unsigned int> list_start, skip_start;
+};
+
+#endif
@@ -0,0 +1,292 @@
+// -*- C++ -*-
+/*
+  rule_batch - tests a rule on a block of candidate positions at once.
+
+  The candidate positions (typically gathered from the posting list of a
+  word_index) are accumulated with add(); evaluate() then checks all the
+  equality tests of the rule's predicate (the compiled ops of its template
+  that have no AtomicPredicate attached, see PredicateTemplate::compile),
+  and the target test when the target changes a single feature, one test
+  at a time over the whole block, reading the corpus array directly. On
+  x86 the tests are also compiled for AVX2, fetching the values with
+  gather instructions 8 positions at a time; that version is used when
+  the processor supports it (it can be left out by defining NO_AVX2), and
+  can be checked against the scalar loops (see set_checked). The other atomic
+  predicates and the constraints are then tested only on the positions
+  that passed, in the usual way.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __rule_batch_h__
+#define __rule_batch_h__
+
+#include <vector>
+#include <utility>
+#include "typedef.h"
+#include "Rule.h"
+#include "gcc_version.h"
+
+#if ! defined(NO_AVX2) && (defined(__x86_64__) || defined(__i386__)) && HAVE_GCC_VERSION(4,9)
+#define RULE_BATCH_AVX2 1
+#include <immintrin.h>
+#else
+#define RULE_BATCH_AVX2 0
+#endif
+
+class rule_batch {
+public:
+  typedef std::pair<int, int> position;
+  typedef std::vector<position> position_vector;
+
+  // The number of positions tested together.
+  enum { BLOCK_SIZE = 256 };
+
+  explicit rule_batch(const wordType3D& c): corpus(c), predicate(0), target(0), data(0), sample_step(0), feature_step(0) {
+    candidates.reserve(BLOCK_SIZE);
+  }
+
+  // Selects the rule to be tested; the candidates should have been
+  // evaluated (or there should be none).
+  void set_rule(const rule_ref& r) {
+    predicate = &r.predicate;
+    target = &r.target;
+    data = corpus.array();
+    sample_step = corpus.sample_step();
+    feature_step = corpus.feature_step();
+    const PredicateTemplate::op_vector& ops = PredicateTemplate::Templates[r.predicate.template_id].ops;
+    tests.clear();
+    other_tests.clear();
+    // The tests are run in the order of the predicate (the least frequent
+    // feature first), so the later ones see fewer positions.
+    int sz = r.predicate.tokens.size();
+    for(Predicate::order_rep_type* o=r.predicate.order ; o!=r.predicate.order+sz ; ++o)
+      if(ops[*o].test == 0)
+	tests.push_back(compiled_test(ops[*o].sample_difference, ops[*o].feature, r.predicate.tokens[*o], true));
+      else
+	other_tests.push_back(*o);
+
+    const TargetTemplate::pos_vector& positions = TargetTemplate::Templates[r.target.tid].positions;
+    test_target = positions.size() != 1;
+    if(! test_target)
+      tests.push_back(compiled_test(0, TargetTemplate::STATE_START + positions[0], r.target.vals[0], false));
+  }
+
+  void add(int line, int word) {
+    candidates.push_back(position(line, word));
+    indices.push_back((corpus.sample_offset(line) + word) * sample_step);
+  }
+
+  // Adds the positions first..last-1 of the sentence.
+  void add_range(int line, int first, int last) {
+    size_t index = (corpus.sample_offset(line) + first) * sample_step;
+    for(int j=first ; j<last ; j++, index+=sample_step) {
+      candidates.push_back(position(line, j));
+      indices.push_back(index);
+    }
+  }
+
+  bool full() const {
+    return static_cast<int>(candidates.size()) >= BLOCK_SIZE;
+  }
+
+  bool empty() const {
+    return candidates.empty();
+  }
+
+  // Tests the rule on the candidate positions and returns the ones on
+  // which it applies (as Rule::test would), in the order in which they were
+  // added. The candidates are cleared.
+  const position_vector& evaluate() {
+    matches.clear();
+    int n = candidates.size();
+    if(n == 0)
+      return matches;
+
+#if RULE_BATCH_AVX2
+    // The gathers use 32 bit indices.
+    if(sizeof(wordType) == 4 && corpus.array_size() < 0x7fffffffu && avx2_supported()) {
+      run_tests_avx2(n);
+      if(checked())
+	check_avx2(n);
+    } else
+#endif
+      run_tests(n);
+
+    for(std::vector<int>::const_iterator k=alive.begin() ; k!=alive.end() ; ++k) {
+      int i = candidates[*k].first, j = candidates[*k].second;
+      if(test_target && ! target->affects(corpus[i][j]))
+	continue;
+      if(! test_other(i, j) || ! Rule::Constraints.test(corpus[i][j], *target))
+	continue;
+      matches.push_back(candidates[*k]);
+    }
+
+    candidates.clear();
+    indices.clear();
+    return matches;
+  }
+
+  // Whether evaluate runs the AVX2 version of the tests.
+  static bool uses_avx2() {
+#if RULE_BATCH_AVX2
+    return sizeof(wordType) == 4 && avx2_supported();
+#else
+    return false;
+#endif
+  }
+
+  // With checked set, evaluate runs the scalar tests after the AVX2 ones,
+  // and exits with an error if they select different positions. It has to
+  // be set before the batches are used.
+  static void set_checked(bool c) {
+    checked() = c;
+  }
+
+private:
+  static bool& checked() {
+    static bool c = false;
+    return c;
+  }
+
+  // feature of the sample at sample_difference has to be equal to value
+  // (or different from it, if equal is false).
+  struct compiled_test {
+    int sample_difference;
+    int feature;
+    wordType value;
+    bool equal;
+
+    compiled_test(int d, int f, wordType v, bool e): sample_difference(d), feature(f), value(v), equal(e) {}
+  };
+
+  bool test_other(int i, int j) const {
+    if(other_tests.empty())
+      return true;
+    const PredicateTemplate::op_vector& ops = PredicateTemplate::Templates[predicate->template_id].ops;
+    wordType2D line = corpus[i];
+    for(std::vector<int>::const_iterator k=other_tests.begin() ; k!=other_tests.end() ; ++k)
+      if(! ops[*k].test->test(line, j, predicate->tokens[*k]))
+	return false;
+    return true;
+  }
+
+  // Sets alive to the candidates 0..n-1 that pass the compiled tests,
+  // running one test at a time on the candidates that passed the previous
+  // ones.
+  void run_tests(int n) {
+    alive.clear();
+    run_tests(0, n);
+  }
+
+  // Adds to alive the candidates start..n-1 that pass the compiled tests.
+  void run_tests(int start, int n) {
+    int first = alive.size();
+    for(int k=start ; k<n ; k++)
+      alive.push_back(k);
+    for(std::vector<compiled_test>::const_iterator t=tests.begin() ; t!=tests.end() && static_cast<int>(alive.size()) > first ; ++t) {
+      size_t shift = t->sample_difference * sample_step + t->feature * feature_step;
+      int m = first;
+      for(std::vector<int>::const_iterator k=alive.begin()+first ; k!=alive.end() ; ++k)
+	if((data[indices[*k] + shift] == t->value) == t->equal)
+	  alive[m++] = *k;
+      alive.resize(m);
+    }
+  }
+
+#if RULE_BATCH_AVX2
+  static bool avx2_supported() {
+    static bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+  }
+
+  // Does what run_tests does, on 8 candidates at a time (the last n%8 are
+  // tested as scalars). block_masks has a bit for each of the 8 candidates
+  // of a block that passed the tests so far.
+  __attribute__((target("avx2"))) void run_tests_avx2(int n) {
+    int blocks = n / 8;
+    indices32.resize(8*blocks);
+    for(int k=0 ; k<8*blocks ; k++)
+      indices32[k] = static_cast<int>(indices[k]);
+
+    block_masks.assign(blocks, 0xff);
+    const int* base = reinterpret_cast<const int*>(data);
+    for(std::vector<compiled_test>::const_iterator t=tests.begin() ; t!=tests.end() ; ++t) {
+      __m256i shift = _mm256_set1_epi32(static_cast<int>(t->sample_difference * sample_step + t->feature * feature_step));
+      __m256i value = _mm256_set1_epi32(static_cast<int>(t->value));
+      bool any = false;
+      for(int b=0 ; b<blocks ; b++) {
+	if(block_masks[b] == 0)
+	  continue;
+	__m256i idx = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&indices32[8*b])), shift);
+	__m256i vals = _mm256_i32gather_epi32(base, idx, 4);
+	int eq = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(vals, value)));
+	block_masks[b] &= t->equal ? eq : ~eq & 0xff;
+	any = any || block_masks[b] != 0;
+      }
+      if(! any)
+	break;
+    }
+
+    alive.clear();
+    for(int b=0 ; b<blocks ; b++)
+      for(int mask=block_masks[b] ; mask ; mask &= mask-1)
+	alive.push_back(8*b + __builtin_ctz(mask));
+    run_tests(8*blocks, n);
+  }
+
+  // Runs the scalar tests on the candidates and compares the result with
+  // the one of run_tests_avx2.
+  void check_avx2(int n) {
+    avx2_alive.swap(alive);
+    run_tests(n);
+    if(alive != avx2_alive) {
+      cerr << "The AVX2 tests of the rule " << predicate->printMe() << " => " << target->printMe()
+	   << " selected " << avx2_alive.size() << " of " << n << " positions, and the scalar ones "
+	   << alive.size() << endl;
+      exit(1);
+    }
+  }
+
+  std::vector<int> indices32;
+  std::vector<int> block_masks;
+  std::vector<int> avx2_alive;
+#endif
+
+  const wordType3D& corpus;
+  const Predicate* predicate;
+  const Target* target;
+  std::vector<compiled_test> tests;
+  std::vector<int> other_tests;
+  bool test_target;
+
+  const wordType* data;
+  size_t sample_step, feature_step;
+
+  position_vector candidates, matches;
+  std::vector<size_t> indices;
+  std::vector<int> alive;
+};
+
+#endif
@@ -0,0 +1,183 @@
+// -*- C++ -*-
+/*
+  rule_heap - an indexed max-heap of rules, ordered by Rule::operator<
+  (i.e. by score, with the ties broken as in Rule::better).
+
+  The heap stores the ids of the rules of a rule_hash, which keeps the
+  position of each rule in the heap (rule_ref::heap_index), so a rule
+  whose counts have changed can be moved to its new place in O(log n),
+  and the best rule is always at the top.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __rule_heap_h__
+#define __rule_heap_h__
+
+#include <vector>
+#include <algorithm>
+#include "Rule.h"
+
+class rule_heap {
+public:
+  typedef std::vector<rule_id> rep_type;
+
+  explicit rule_heap(const rule_hash& r): rules(r) {}
+
+  // Builds the heap out of all the rules in [first, last), in linear time.
+  template <class iterator>
+  void build(iterator first, iterator last) {
+    clear();
+    for( ; first != last ; ++first) {
+      rules.heap_index(first.id()) = heap.size();
+      heap.push_back(first.id());
+    }
+    for(int i=static_cast<int>(heap.size())/2-1 ; i>=0 ; --i)
+      sift_down(i);
+  }
+
+  void push(const rule_ref& rule) {
+    rule.heap_index = heap.size();
+    heap.push_back(rule.id);
+    sift_up(rule.heap_index);
+  }
+
+  // Restores the heap property after the counts of the rule have changed.
+  // Rules that are not in the heap are ignored.
+  void update(const rule_ref& rule) {
+    int i = rule.heap_index;
+    if(i < 0)
+      return;
+    if(i > 0 && less(heap[parent(i)], rule.id))
+      sift_up(i);
+    else
+      sift_down(i);
+  }
+
+  void erase(const rule_ref& rule) {
+    int i = rule.heap_index;
+    if(i < 0)
+      return;
+    rule.heap_index = -1;
+    rule_id last = heap.back();
+    heap.pop_back();
+    if(last == rule.id)
+      return;
+    place(i, last);
+    update(rules[last]);
+  }
+
+  rule_ref top() const {
+    return rules[heap[0]];
+  }
+
+  // Stores in result the ids of the first n rules of the heap, best first,
+  // without modifying the heap.
+  void best(int n, rep_type& result) const {
+    result.clear();
+    std::vector<int> frontier;
+    index_less less(*this);
+    if(! heap.empty())
+      frontier.push_back(0);
+    while(static_cast<int>(result.size()) < n && ! frontier.empty()) {
+      std::pop_heap(frontier.begin(), frontier.end(), less);
+      int i = frontier.back();
+      frontier.pop_back();
+      result.push_back(heap[i]);
+      for(int child = 2*i+1 ; child <= 2*i+2 && child < static_cast<int>(heap.size()) ; ++child) {
+	frontier.push_back(child);
+	std::push_heap(frontier.begin(), frontier.end(), less);
+      }
+    }
+  }
+
+  bool empty() const {
+    return heap.empty();
+  }
+
+  int size() const {
+    return heap.size();
+  }
+
+  void clear() {
+    for(rep_type::iterator it=heap.begin() ; it!=heap.end() ; ++it)
+      rules.heap_index(*it) = -1;
+    heap.clear();
+  }
+
+private:
+  struct index_less {
+    const rule_heap& parent;
+    index_less(const rule_heap& p): parent(p) {}
+    bool operator() (int i, int j) const {
+      return parent.less(parent.heap[i], parent.heap[j]);
+    }
+  };
+
+  // The order of Rule::operator<; the scores are compared first, without
+  // going through the rule_refs.
+  bool less(rule_id r1, rule_id r2) const {
+    scoreType s1 = rules.score(r1), s2 = rules.score(r2);
+    if(s1 != s2)
+      return s1 < s2;
+    return rules[r1] < rules[r2];
+  }
+
+  static int parent(int i) {
+    return (i-1)/2;
+  }
+
+  void place(int i, rule_id rule) {
+    heap[i] = rule;
+    rules.heap_index(rule) = i;
+  }
+
+  void sift_up(int i) {
+    rule_id rule = heap[i];
+    while(i > 0 && less(heap[parent(i)], rule)) {
+      place(i, heap[parent(i)]);
+      i = parent(i);
+    }
+    place(i, rule);
+  }
+
+  void sift_down(int i) {
+    rule_id rule = heap[i];
+    int n = heap.size();
+    for(int child = 2*i+1 ; child < n ; child = 2*i+1) {
+      if(child+1 < n && less(heap[child], heap[child+1]))
+	++child;
+      if(! less(rule, heap[child]))
+	break;
+      place(i, heap[child]);
+      i = child;
+    }
+    place(i, rule);
+  }
+
+  const rule_hash& rules;
+  rep_type heap;
+};
+
+#endif
@@ -0,0 +1,417 @@
+// -*- C++ -*-
+/*
+  rule_transducer - applies a list of rules to the sentences of the
+  corpus directly, without the word_index.
+
+  A rule whose predicate is made only of feature equality tests
+  (SingleFeaturePredicate) and feature sequence tests
+  (FeatureSequencePredicate), and whose target changes a single feature,
+  is a local rewriting of the sentence: the new state of a sample depends
+  only on the samples in a window around it, as they were before the rule
+  was applied. Such a rule is compiled into a local transducer (a list of
+  (sample difference, feature, value) tests), in the sense of Roche &
+  Schabes, "Deterministic part-of-speech tagging with finite-state
+  transducers" (1995).
+
+  Consecutive compiled rules that change the same feature are composed
+  into a single left to right pass over the sentence, TILE samples at a
+  time: the rules are the stages of a pipeline, each run over a tile of
+  samples lagging behind the tile of the previous stage by as far as it
+  looks to the right at the feature, and reading the states written by
+  the previous stage from a ring buffer. That gives the same result as
+  applying the rules to the whole corpus one at a time. The rules that
+  cannot apply to the sentence (one of the values they test does not
+  appear in it) are left out of the pass; a rule that can apply only
+  after a rule of the pass starts the next pass. The sentences that fit
+  in a tile get one pass per rule.
+
+  The composition is not determinized into a single transducer, as Roche
+  & Schabes do. The state changed by the composed rules at a sample
+  depends on a window of samples around it, which grows with each rule:
+  for the 305 rules learned (threshold 2) on
+  test-cases/pos-tagging1/my_pos_dir/11.lexical, it is 194 samples to the
+  left and 180 to the right, over 153 tested words (plus one symbol for
+  the other words) and 44 tags. Over the 120203 samples of 11.lexical,
+  the windows of the first 16 rules are already distinct at 99% of the
+  samples (the others are in repeated sentences), so a transducer
+  remembering the context seen by the rules would need about as many
+  states as the corpus has samples.
+
+  The rules that cannot be compiled are left to the interpreter
+  (runOneRule); compiled(r) tells them apart, and run_end(r) returns the
+  end of the run of compiled rules starting at r.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __rule_transducer_h__
+#define __rule_transducer_h__
+
+#include <vector>
+#include <algorithm>
+#include "typedef.h"
+#include "Rule.h"
+#include "FeatureSequencePredicate.h"
+
+class rule_transducer {
+public:
+  // A state changed by a rule: the feature of sample word was old_value.
+  struct change {
+    int word;
+    featureIndexType feature;
+    wordType old_value, value;
+
+    change(int w, featureIndexType f, wordType o, wordType v): word(w), feature(f), old_value(o), value(v) {}
+  };
+  typedef std::vector<change> change_vector;
+
+  // The number of samples a pass runs each rule on at a time.
+  enum { TILE = 256 };
+
+  rule_transducer(): num_interpreted(0) {}
+
+  // Compiles the rules that can be compiled.
+  void compile(const std::vector<Rule>& rules) {
+    static wordType fake_class = Dictionary::GetDictionary()["FAKE_CLASS"];
+    const int STATE_START = TargetTemplate::STATE_START;
+
+    transducers.clear();
+    transducers.resize(rules.size());
+    is_compiled.assign(rules.size(), false);
+    group_ends.assign(rules.size(), 0);
+    tracked_features.clear();
+    num_interpreted = 0;
+
+    for(int r=0 ; r<rules.size() ; r++) {
+      const Rule& rule = rules[r];
+      const TargetTemplate::pos_vector& positions = TargetTemplate::Templates[rule.target.tid].positions;
+      const PredicateTemplate& pred_template = PredicateTemplate::Templates[rule.predicate.template_id];
+      local_transducer& t = transducers[r];
+
+      bool ok = positions.size() == 1;
+      for(int k=0 ; ok && k<rule.predicate.tokens.size() ; k++) {
+	const PredicateTemplate::compiled_op& op = pred_template.ops[k];
+	if(op.test == 0)
+	  t.tests.push_back(window_test(op.sample_difference, op.sample_difference, op.feature, rule.predicate.tokens[k]));
+	else if(const FeatureSequencePredicate* seq = dynamic_cast<const FeatureSequencePredicate*>(op.test)) {
+	  AtomicPredicate::position_vector offsets;
+	  AtomicPredicate::storage_vector features;
+	  seq->get_sample_differences(offsets);
+	  seq->get_feature_ids(features);
+	  t.tests.push_back(window_test(*std::min_element(offsets.begin(), offsets.end()),
+					*std::max_element(offsets.begin(), offsets.end()),
+					features[0], rule.predicate.tokens[k]));
+	} else
+	  ok = false;
+      }
+      if(! ok) {
+	t.tests.clear();
+	num_interpreted++;
+	continue;
+      }
+
+      is_compiled[r] = true;
+      t.rule = &rule;
+      t.feature = STATE_START + positions[0];
+      t.value = rule.target.vals[0];
+      // A FAKE_CLASS target does not change anything.
+      t.no_op = t.value == fake_class;
+      for(std::vector<window_test>::const_iterator w=t.tests.begin() ; w!=t.tests.end() ; ++w) {
+	track(w->feature);
+	if(w->feature == t.feature) {
+	  t.behind = std::max(t.behind, -w->first);
+	  t.ahead = std::max(t.ahead, static_cast<int>(w->last));
+	}
+      }
+      track(t.feature);
+    }
+
+    // The passes: the runs of compiled rules changing the same feature. If
+    // the constraints look at the feature, the rules of a pass could see
+    // the states written by the later stages, so each gets its own pass.
+    for(int r=rules.size()-1 ; r>=0 ; r--)
+      if(is_compiled[r]) {
+	featureIndexType feature = transducers[r].feature;
+	bool composed = r+1 < rules.size() && is_compiled[r+1] && transducers[r+1].feature == feature &&
+	  ! Rule::Constraints.reads(feature);
+	group_ends[r] = composed ? group_ends[r+1] : r+1;
+      }
+  }
+
+  bool compiled(int r) const {
+    return is_compiled[r];
+  }
+
+  // True if all the rules are compiled (the index is then not needed).
+  bool complete() const {
+    return num_interpreted == 0;
+  }
+
+  int run_end(int r) const {
+    while(r < is_compiled.size() && is_compiled[r])
+      r++;
+    return r;
+  }
+
+  // Applies the compiled rules first..last-1 to the sentence; the changed
+  // states are appended to changes. The changes of a sample come in the
+  // order of the rules that made them (those of different samples may be
+  // interleaved).
+  void apply(const wordType2D& sentence, int first, int last, change_vector& changes) {
+    count_values(sentence, 1);
+
+    for(int r=first ; r<last ; ) {
+      // A pass ends before a rule that can apply only if one of the rules
+      // of the pass does: that rule is looked at again with the counts of
+      // the sentence after the pass. The passes over a sentence that fits
+      // in a tile have one rule each: a single tile would make no
+      // difference, and the counts are then updated after each rule.
+      int end = sentence.size() <= TILE ? r+1 : std::min(group_ends[r], last);
+      stages.clear();
+      for(; r<end ; r++) {
+	const local_transducer& t = transducers[r];
+	if(t.no_op)
+	  continue;
+	applicability a = may_apply(t);
+	if(a == NEVER)
+	  continue;
+	if(a == AFTER_PASS)
+	  break;
+	stages.push_back(r);
+	if(t.value >= written.size())
+	  written.resize(t.value+1, false);
+	written[t.value] = true;
+      }
+      if(stages.empty())
+	continue;
+      for(std::vector<int>::const_iterator s=stages.begin() ; s!=stages.end() ; ++s)
+	written[transducers[*s].value] = false;
+
+      int first_change = changes.size();
+      if(stages.size() == 1)
+	apply_rule(sentence, transducers[stages[0]], changes);
+      else
+	apply_pass(sentence, changes);
+      make_changes(sentence, changes, first_change);
+    }
+
+    count_values(sentence, -1);
+  }
+
+private:
+  // The feature has to be equal to value on one of the samples at the
+  // sample differences first..last.
+  struct window_test {
+    relativePosType first, last;
+    featureIndexType feature;
+    wordType value;
+
+    window_test(relativePosType f, relativePosType l, featureIndexType fid, wordType v): first(f), last(l), feature(fid), value(v) {}
+  };
+
+  // Reads the states of the sentence.
+  struct sentence_reader {
+    const wordType2D& sentence;
+
+    sentence_reader(const wordType2D& s): sentence(s) {}
+
+    wordType operator() (int j, featureIndexType f) const {
+      return sentence[j][f];
+    }
+  };
+
+  // Reads the states as written by a stage of a pass: the feature changed
+  // by the pass comes from the ring buffer of the stage (whose width is a
+  // power of 2), indexed from sample lo.
+  struct stage_reader {
+    const wordType2D& sentence;
+    featureIndexType feature;
+    const wordType* ring;
+    int mask, lo;
+
+    stage_reader(const wordType2D& s, featureIndexType f, const wordType* r, int m, int l):
+      sentence(s), feature(f), ring(r), mask(m), lo(l) {}
+
+    wordType operator() (int j, featureIndexType f) const {
+      return f == feature ? ring[(j-lo) & mask] : sentence[j][f];
+    }
+  };
+
+  struct local_transducer {
+    std::vector<window_test> tests;
+    const Rule* rule;
+    featureIndexType feature;
+    wordType value;
+    bool no_op;
+    // How far the rule looks to the left and to the right at the feature
+    // it changes.
+    int behind, ahead;
+
+    local_transducer(): rule(0), feature(0), value(0), no_op(false), behind(0), ahead(0) {}
+
+    template <class reader>
+    bool test(const reader& read, int j) const {
+      for(std::vector<window_test>::const_iterator w=tests.begin() ; w!=tests.end() ; ++w) {
+	relativePosType d = w->first;
+	while(d <= w->last && read(j+d, w->feature) != w->value)
+	  ++d;
+	if(d > w->last)
+	  return false;
+      }
+      return true;
+    }
+  };
+
+  // Returns the state of sample j after the rule, as read; the change, if
+  // any, is appended to changes.
+  template <class reader>
+  wordType decide(const local_transducer& t, const reader& read, const wordType2D& sentence, int j, change_vector& changes) {
+    wordType state = read(j, t.feature);
+    if(state == t.value || ! t.test(read, j) || ! t.rule->constraint_test(sentence[j]))
+      return state;
+    changes.push_back(change(j, t.feature, state, t.value));
+    return t.value;
+  }
+
+  // Makes the changes from first_change on in the sentence and in the
+  // counts of its values.
+  void make_changes(const wordType2D& sentence, const change_vector& changes, int first_change) {
+    for(change_vector::const_iterator c=changes.begin()+first_change ; c!=changes.end() ; ++c) {
+      if(c->value >= counts.size())
+	counts.resize(c->value+1, 0);
+      counts[c->old_value]--;
+      counts[c->value]++;
+      sentence[c->word][c->feature] = c->value;
+    }
+  }
+
+  // Applies a single rule: the samples on which it applies are found
+  // first, then changed.
+  void apply_rule(const wordType2D& sentence, const local_transducer& t, change_vector& changes) {
+    int begin = -PredicateTemplate::MaxBackwardLookup, end = sentence.size() - PredicateTemplate::MaxForwardLookup;
+    sentence_reader read(sentence);
+    for(int j=begin ; j<end ; j++)
+      decide(t, read, sentence, j, changes);
+  }
+
+  // Applies the rules of stages in one pass over the sentence, TILE
+  // samples at a time: for each tile, stage 0 decides on the samples of
+  // the tile, then stage 1 on the samples of the tile lags[1] samples to
+  // the left, and so on, stage i keeping the states it has written (or
+  // left) in ring[i*width..(i+1)*width-1], for the samples lo..hi-1 the
+  // rules look at. When stage i decides on sample j, stage i-1 has decided
+  // on the furthest sample stage i looks at, and the states it wrote are
+  // kept back to the first one. The stages copy the states of the padding
+  // samples, which they do not change.
+  void apply_pass(const wordType2D& sentence, change_vector& changes) {
+    int begin = -PredicateTemplate::MaxBackwardLookup, end = sentence.size() - PredicateTemplate::MaxForwardLookup;
+    int k = stages.size(), ahead = 0, behind = 0, window = 0;
+    lags.resize(k);
+    for(int i=0 ; i<k ; i++) {
+      const local_transducer& t = transducers[stages[i]];
+      lags[i] = i == 0 ? 0 : lags[i-1] + t.ahead;
+      ahead = std::max(ahead, t.ahead);
+      behind = std::max(behind, t.behind);
+      window = std::max(window, t.ahead + t.behind + 1);
+    }
+    int width = 1;
+    while(width < TILE + window)
+      width *= 2;
+    int mask = width-1, lo = begin-behind, hi = end+ahead;
+    featureIndexType feature = transducers[stages[0]].feature;
+    if(ring.size() < k*width)
+      ring.resize(k*width);
+
+    for(int tile=lo ; tile<hi+lags[k-1] ; tile+=TILE)
+      for(int i=0 ; i<k ; i++) {
+	int first = std::max(tile-lags[i], lo), last = std::min(tile+TILE-lags[i], hi);
+	if(first >= last)
+	  continue;
+	wordType* states = &ring[i*width];
+	for(int j=first ; j<std::min(last, begin) ; j++)
+	  states[(j-lo) & mask] = sentence[j][feature];
+	const local_transducer& t = transducers[stages[i]];
+	if(i == 0) {
+	  sentence_reader read(sentence);
+	  for(int j=std::max(first, begin) ; j<std::min(last, end) ; j++)
+	    states[(j-lo) & mask] = decide(t, read, sentence, j, changes);
+	} else {
+	  stage_reader read(sentence, feature, &ring[(i-1)*width], mask, lo);
+	  for(int j=std::max(first, begin) ; j<std::min(last, end) ; j++)
+	    states[(j-lo) & mask] = decide(t, read, sentence, j, changes);
+	}
+	for(int j=std::max(first, end) ; j<last ; j++)
+	  states[(j-lo) & mask] = sentence[j][feature];
+      }
+  }
+
+  void track(featureIndexType feature) {
+    if(std::find(tracked_features.begin(), tracked_features.end(), feature) == tracked_features.end())
+      tracked_features.push_back(feature);
+  }
+
+  // Adds delta to the counts of the values of the tracked features in the
+  // sentence (the padding included).
+  void count_values(const wordType2D& sentence, int delta) {
+    for(int j=0 ; j<sentence.size() ; j++) {
+      wordType1D sample = sentence[j];
+      for(std::vector<featureIndexType>::const_iterator f=tracked_features.begin() ; f!=tracked_features.end() ; ++f) {
+	wordType value = sample[*f];
+	if(value >= counts.size())
+	  counts.resize(value+1, 0);
+	counts[value] += delta;
+      }
+    }
+  }
+
+  enum applicability { NEVER, NOW, AFTER_PASS };
+
+  // NEVER if one of the tested values neither appears in the sentence nor
+  // is written by one of the rules already in the pass, AFTER_PASS if one
+  // of them is only written by those rules.
+  applicability may_apply(const local_transducer& t) const {
+    applicability a = NOW;
+    for(std::vector<window_test>::const_iterator w=t.tests.begin() ; w!=t.tests.end() ; ++w)
+      if(w->value >= counts.size() || counts[w->value] == 0) {
+	if(w->value >= written.size() || ! written[w->value])
+	  return NEVER;
+	a = AFTER_PASS;
+      }
+    return a;
+  }
+
+  std::vector<local_transducer> transducers;
+  std::vector<bool> is_compiled;
+  // group_ends[r] is the end of the pass that starts with rule r.
+  std::vector<int> group_ends;
+  std::vector<featureIndexType> tracked_features;
+  std::vector<int> counts;
+  std::vector<int> stages, lags;
+  // The values written by the rules of the pass being put together.
+  std::vector<bool> written;
+  std::vector<wordType> ring;
+  int num_interpreted;
+};
+
+#endif
@@ -0,0 +1,430 @@
+// -*- C++ -*-
+/*
+  string_index - interns strings, giving them consecutive indices
+  0, 1, 2, ... in the order in which they are inserted.
+
+  The characters of all the strings are stored one after the other in a
+  single array (the arena); string i spans offsets[i]..offsets[i+1]-1.
+  The strings are looked up through an open addressing table (linear
+  probing) holding the index and the hash of each string, so most of the
+  mismatches are found without touching the arena.
+
+  Once the set of strings is (mostly) known, freeze() replaces the table
+  with a minimal perfect hash in the "hash and displace" style: the
+  strings are spread in buckets of about 4, and each bucket gets a small
+  displacement value (the pilot) that sends its strings to distinct free
+  slots of an array of exactly size() indices. A lookup then hashes the
+  string once and compares it with the only candidate. Strings inserted
+  after the freeze go in a (new, small) open addressing table.
+
+  The frozen strings (the base) can be saved with write() and used later
+  directly from the memory of the file (typically mmap-ed), through map();
+  nothing is copied or parsed then. The layout is: the number of strings
+  n, the size of the arena, the number of buckets, the seed (2 words),
+  then the arrays offsets (n+1), pilots and slot_ids (n) of 32 bit
+  integers, then the arena.
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __string_index_h__
+#define __string_index_h__
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <ostream>
+
+class string_index {
+public:
+  typedef unsigned long long hash_type;
+
+  enum { not_found = -1 };
+
+  string_index(): base_text(""), base_offsets(0), pilots(0), slot_ids(0), base_size(0), num_buckets(0), 
+		  seed(0), seed_hash(0), offsets(1, 0), used(0) {}
+
+  int size() const {
+    return base_size + offsets.size() - 1;
+  }
+
+  // The characters of string i (not 0 terminated).
+  const char* data(int i) const {
+    if(static_cast<unsigned int>(i) < base_size)
+      return base_text + base_offsets[i];
+    return text.empty() ? "" : &text[0] + offsets[i - base_size];
+  }
+
+  unsigned int length(int i) const {
+    if(static_cast<unsigned int>(i) < base_size)
+      return base_offsets[i+1] - base_offsets[i];
+    return offsets[i - base_size + 1] - offsets[i - base_size];
+  }
+
+  std::string str(int i) const {
+    return std::string(data(i), length(i));
+  }
+
+  bool equal(int i, const char* s, unsigned int len) const {
+    return length(i) == len && std::memcmp(data(i), s, len) == 0;
+  }
+
+  // Lexicographic comparison of strings i and j (as std::string::compare).
+  bool less(int i, int j) const {
+    unsigned int li = length(i), lj = length(j);
+    int c = std::memcmp(data(i), data(j), std::min(li, lj));
+    return c < 0 || (c == 0 && li < lj);
+  }
+
+  // Returns the index of the string, or not_found.
+  int find(const char* s, unsigned int len) const {
+    hash_type h = hash(s, len);
+    if(base_size > 0) {
+      hash_type k = seeded(h);
+      int i = slot_ids[slot_of(k, pilots[bucket_of(k)])];
+      if(equal(i, s, len))
+	return i;
+    }
+    return table_find(s, len, h);
+  }
+
+  int find(const std::string& s) const {
+    return find(s.data(), s.size());
+  }
+
+  // Returns the index of the string, adding it at the end if it is new.
+  int insert(const char* s, unsigned int len) {
+    hash_type h = hash(s, len);
+    if(base_size > 0) {
+      hash_type k = seeded(h);
+      int i = slot_ids[slot_of(k, pilots[bucket_of(k)])];
+      if(equal(i, s, len))
+	return i;
+    }
+    int i = table_find(s, len, h);
+    if(i != not_found)
+      return i;
+
+    i = size();
+    text.insert(text.end(), s, s+len);
+    offsets.push_back(text.size());
+    if(2 * (used + 1) > table.size())
+      rehash(table.empty() ? 16 : 2 * table.size());
+    table_add(i, h);
+    return i;
+  }
+
+  int insert(const std::string& s) {
+    return insert(s.data(), s.size());
+  }
+
+  // True if there is a base (with a perfect hash), from freeze() or map().
+  bool frozen() const {
+    return base_size > 0;
+  }
+
+  // Moves all the strings to the base and builds their perfect hash; see above.
+  void freeze() {
+    unsigned int n = size();
+    if(offsets.size() == 1)
+      return;
+
+    std::vector<char> new_text(base_text, base_text + base_offsets_end());
+    new_text.insert(new_text.end(), text.begin(), text.end());
+    std::vector<unsigned int> new_offsets;
+    new_offsets.reserve(n+1);
+    if(base_size > 0)
+      new_offsets.assign(base_offsets, base_offsets + base_size);
+    unsigned int shift = base_offsets_end();
+    for(std::vector<unsigned int>::const_iterator o=offsets.begin() ; o!=offsets.end() ; ++o)
+      new_offsets.push_back(shift + *o);
+    own_text.swap(new_text);
+    own_offsets.swap(new_offsets);
+    base_text = own_text.empty() ? "" : &own_text[0];
+    base_offsets = &own_offsets[0];
+    base_size = n;
+
+    std::vector<char> t1;
+    text.swap(t1);
+    std::vector<unsigned int> t2(1, 0);
+    offsets.swap(t2);
+    std::vector<slot> t3;
+    table.swap(t3);
+    used = 0;
+
+    num_buckets = n / 4 + 1;
+    std::vector<hash_type> hashes(n);
+    for(unsigned int i=0 ; i<n ; i++)
+      hashes[i] = hash(data(i), length(i));
+    for(seed=0 ; ! build_perfect_hash(hashes, n) ; seed++)
+      ;
+    pilots = &own_pilots[0];
+    slot_ids = &own_slot_ids[0];
+  }
+
+  // Writes the base, in the format read by map(); the strings added after
+  // the last freeze() are not saved.
+  void write(std::ostream& out) const {
+    unsigned int header[5] = { base_size, base_offsets_end(), num_buckets, 
+			       static_cast<unsigned int>(seed), static_cast<unsigned int>(seed >> 32) };
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    if(base_size == 0)
+      return;
+    out.write(reinterpret_cast<const char*>(base_offsets), (base_size+1) * sizeof(unsigned int));
+    out.write(reinterpret_cast<const char*>(pilots), num_buckets * sizeof(unsigned int));
+    out.write(reinterpret_cast<const char*>(slot_ids), base_size * sizeof(unsigned int));
+    out.write(base_text, base_offsets_end());
+  }
+
+  // Writes all the strings, as write() would after a freeze(), without
+  // changing the index: if strings were added since the last freeze(), the
+  // perfect hash is built on a copy.
+  void write_frozen(std::ostream& out) const {
+    if(offsets.size() == 1) {
+      write(out);
+      return;
+    }
+    string_index copy;
+    for(int i=0 ; i<size() ; i++)
+      copy.insert(data(i), length(i));
+    copy.freeze();
+    copy.write(out);
+  }
+
+  // Uses the strings written by write() at the (4 byte aligned) address p,
+  // which has to stay valid as long as the index is used; the index should
+  // be empty. Returns the number of bytes used, or 0 if the data does not
+  // fit in size bytes.
+  unsigned long map(const char* p, unsigned long size) {
+    const unsigned int* header = reinterpret_cast<const unsigned int*>(p);
+    if(size < 5 * sizeof(unsigned int))
+      return 0;
+    unsigned long n = header[0], text_size = header[1], buckets = header[2];
+    unsigned long total = 5 * sizeof(unsigned int) + (n == 0 ? 0 : (2*n + 1 + buckets) * sizeof(unsigned int) + text_size);
+    if(total > size || (n > 0 && (buckets == 0 || header[5 + n] != text_size)))
+      return 0;
+    if(n == 0)
+      return total;
+    base_size = n;
+    num_buckets = buckets;
+    seed = header[3] | (static_cast<hash_type>(header[4]) << 32);
+    seed_hash = seed == 0 ? 0 : mix(seed);
+    base_offsets = header + 5;
+    pilots = base_offsets + n + 1;
+    slot_ids = pilots + num_buckets;
+    base_text = reinterpret_cast<const char*>(slot_ids + n);
+    return total;
+  }
+
+  void clear() {
+    std::vector<char> t1, t2;
+    text.swap(t1);
+    own_text.swap(t2);
+    std::vector<unsigned int> t3(1, 0), t4, t5, t6;
+    offsets.swap(t3);
+    own_offsets.swap(t4);
+    own_pilots.swap(t5);
+    own_slot_ids.swap(t6);
+    std::vector<slot> t7;
+    table.swap(t7);
+    used = 0;
+    base_text = "";
+    base_offsets = pilots = slot_ids = 0;
+    base_size = 0;
+    num_buckets = 0;
+    seed = 0;
+    seed_hash = 0;
+  }
+
+  // The number of bytes allocated by the index (the mapped memory is not counted).
+  unsigned long memory() const {
+    return own_text.capacity() + text.capacity() + 
+      (own_offsets.capacity() + own_pilots.capacity() + own_slot_ids.capacity() + offsets.capacity()) * sizeof(unsigned int) +
+      table.capacity() * sizeof(slot);
+  }
+
+  // FNV-1a, followed by the 64 bit finalizer of MurmurHash3 (FNV alone
+  // leaves the high bits poorly mixed for short strings).
+  static hash_type hash(const char* s, unsigned int len) {
+    hash_type h = 14695981039346656037ull;
+    for(const char* p=s ; p!=s+len ; ++p) {
+      h ^= static_cast<unsigned char>(*p);
+      h *= 1099511628211ull;
+    }
+    return mix(h);
+  }
+
+  static hash_type mix(hash_type h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+
+private:
+  // The pointers of the base can point into the index itself.
+  string_index(const string_index&);
+  string_index& operator = (const string_index&);
+
+  struct slot {
+    unsigned int id;     // the index of the string plus 1; 0 for an empty slot
+    unsigned int hash;   // the low 32 bits of its hash
+
+    slot(): id(0), hash(0) {}
+  };
+
+  unsigned int base_offsets_end() const {
+    return base_size == 0 ? 0 : base_offsets[base_size];
+  }
+
+  int table_find(const char* s, unsigned int len, hash_type h) const {
+    if(table.empty())
+      return not_found;
+    unsigned int mask = table.size() - 1, h32 = static_cast<unsigned int>(h);
+    for(unsigned int k = h32 & mask ; table[k].id != 0 ; k = (k+1) & mask)
+      if(table[k].hash == h32 && equal(table[k].id-1, s, len))
+	return table[k].id-1;
+    return not_found;
+  }
+
+  void table_add(int i, hash_type h) {
+    unsigned int mask = table.size() - 1, h32 = static_cast<unsigned int>(h);
+    unsigned int k = h32 & mask;
+    while(table[k].id != 0)
+      k = (k+1) & mask;
+    table[k].id = i+1;
+    table[k].hash = h32;
+    used++;
+  }
+
+  void rehash(unsigned int new_size) {
+    std::vector<slot> old(new_size);
+    table.swap(old);
+    used = 0;
+    for(std::vector<slot>::const_iterator s=old.begin() ; s!=old.end() ; ++s)
+      if(s->id != 0) {
+	unsigned int mask = table.size() - 1, k = s->hash & mask;
+	while(table[k].id != 0)
+	  k = (k+1) & mask;
+	table[k] = *s;
+	used++;
+      }
+  }
+
+  // The hash used by the perfect hash; with a seed other than 0 the hash is
+  // mixed again, so the strings are spread differently.
+  hash_type seeded(hash_type h) const {
+    return seed == 0 ? h : mix(h ^ seed_hash);
+  }
+
+  // The bucket is chosen by the high bits of the hash, the slot by the low
+  // ones (xor-ed with the mixed pilot); both are reduced with a
+  // multiplication instead of a division.
+  unsigned int bucket_of(hash_type h) const {
+    return static_cast<unsigned int>(((h >> 32) * num_buckets) >> 32);
+  }
+
+  unsigned int slot_of(hash_type h, unsigned int pilot) const {
+    hash_type low = static_cast<unsigned int>(h ^ mix(pilot + 1));
+    return static_cast<unsigned int>((low * base_size) >> 32);
+  }
+
+  // Places the buckets, largest first, trying the pilots 0, 1, 2, ... until
+  // all the strings of the bucket land in distinct free slots. Fails (and
+  // has to be restarted with another seed) if some bucket cannot be placed,
+  // which happens only if two of its strings agree on the low 32 bits of
+  // the hash.
+  bool build_perfect_hash(const std::vector<hash_type>& hashes, unsigned int n) {
+    seed_hash = seed == 0 ? 0 : mix(seed);
+    std::vector<std::vector<unsigned int> > buckets(num_buckets);
+    for(unsigned int i=0 ; i<n ; i++)
+      buckets[bucket_of(seeded(hashes[i]))].push_back(i);
+
+    std::vector<unsigned int> order(num_buckets);
+    for(unsigned int b=0 ; b<num_buckets ; b++)
+      order[b] = b;
+    std::stable_sort(order.begin(), order.end(), bucket_size_greater(buckets));
+
+    own_pilots.assign(num_buckets, 0);
+    own_slot_ids.assign(n, 0);
+    std::vector<bool> taken(n, false);
+    std::vector<unsigned int> slots;
+    // The last buckets to be placed have a single string and need, on
+    // average, n / (number of free slots) tries.
+    const unsigned int max_pilot = 64 * n + 1024;
+    for(std::vector<unsigned int>::const_iterator b=order.begin() ; b!=order.end() && ! buckets[*b].empty() ; ++b) {
+      const std::vector<unsigned int>& keys = buckets[*b];
+      unsigned int pilot = 0;
+      for( ; pilot<max_pilot ; pilot++) {
+	slots.clear();
+	std::vector<unsigned int>::const_iterator k=keys.begin();
+	for( ; k!=keys.end() ; ++k) {
+	  unsigned int s = slot_of(seeded(hashes[*k]), pilot);
+	  if(taken[s] || std::find(slots.begin(), slots.end(), s) != slots.end())
+	    break;
+	  slots.push_back(s);
+	}
+	if(k == keys.end())
+	  break;
+      }
+      if(pilot == max_pilot)
+	return false;
+      own_pilots[*b] = pilot;
+      for(unsigned int k=0 ; k<keys.size() ; k++) {
+	taken[slots[k]] = true;
+	own_slot_ids[slots[k]] = keys[k];
+      }
+    }
+    return true;
+  }
+
+  struct bucket_size_greater {
+    const std::vector<std::vector<unsigned int> >& buckets;
+    bucket_size_greater(const std::vector<std::vector<unsigned int> >& b): buckets(b) {}
+
+    bool operator() (unsigned int b1, unsigned int b2) const {
+      return buckets[b1].size() > buckets[b2].size();
+    }
+  };
+
+  // The base: the strings 0..base_size-1 and their perfect hash, stored
+  // either in the own_ vectors or in mapped memory.
+  const char* base_text;
+  const unsigned int *base_offsets, *pilots, *slot_ids;
+  unsigned int base_size, num_buckets;
+  hash_type seed, seed_hash;
+  std::vector<char> own_text;
+  std::vector<unsigned int> own_offsets, own_pilots, own_slot_ids;
+
+  // The strings added after the base, found through an open addressing table.
+  std::vector<char> text;
+  std::vector<unsigned int> offsets;
+  std::vector<slot> table;
+  unsigned int used;
+};
+
+#endif
@@ -31,7 +31,9 @@
 #define __svector_h__
 
 #include <vector>
+#include <algorithm>
 #include "sized_memory_pool.h"
+#include "threads.h"
 #include "debug.h"
 #include "common.h"
 
@@ -132,7 +134,7 @@ public:
   }
 
 protected:
-  static sized_memory_pool<type> memory_pool;
+  static THREAD_LOCAL sized_memory_pool<type> memory_pool;
   static const int _MAX_SIZE = 100;
 
   void allocate_data() {
@@ -163,12 +165,12 @@ protected:
 template <class type, class size_type>
 inline bool 
 operator < (const svector<type, size_type>& v1, const svector<type, size_type>& v2) {
-  return lexicographical_compare(v1.begin(), v1.end(),
-				 v2.begin(), v2.end());
+  return std::lexicographical_compare(v1.begin(), v1.end(),
+				      v2.begin(), v2.end());
 }
 
 template <class type, class size_type>
-sized_memory_pool<type> svector<type, size_type>::memory_pool(_MAX_SIZE);
+THREAD_LOCAL sized_memory_pool<type> svector<type, size_type>::memory_pool(_MAX_SIZE);
 
 template<class type, class size_type>
 std::ostream& operator <<(std::ostream& ostr, const svector<type, size_type>& sv) {
@@ -0,0 +1,171 @@
+// -*- C++ -*-
+/*
+  Counters and timers for the per-iteration trace of fnTBL-train (-trace),
+  and the latency histogram of the fnTBL server (-server).
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __telemetry_h__
+#define __telemetry_h__
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// The statistics of one iteration of the learner. The times are in
+// milliseconds; the count update and rule generation times are summed over
+// all the threads.
+struct iteration_stats {
+  int sentences, positions, rules_added, rules_removed;
+  double best_rule_time, apply_time, count_update_time, generation_time;
+
+  iteration_stats() {
+    clear();
+  }
+
+  void clear() {
+    sentences = positions = rules_added = rules_removed = 0;
+    best_rule_time = apply_time = count_update_time = generation_time = 0;
+  }
+
+  // Adds the counters of the sentences processed by one thread.
+  void add(const iteration_stats& stats) {
+    sentences += stats.sentences;
+    positions += stats.positions;
+    rules_added += stats.rules_added;
+    rules_removed += stats.rules_removed;
+    count_update_time += stats.count_update_time;
+    generation_time += stats.generation_time;
+  }
+
+  static void print_header(std::ostream& ostr) {
+    ostr << "iteration,score,rules,sentences,positions,rules_added,rules_removed,"
+	 << "best_rule_ms,apply_ms,count_update_ms,rule_generation_ms,rss_kb,peak_rss_kb" << std::endl;
+  }
+};
+
+// A monotonic clock, in milliseconds.
+inline double telemetry_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1000.0*ts.tv_sec + ts.tv_nsec/1e6;
+}
+
+// Adds the time elapsed since the last lap to total.
+inline void telemetry_lap(double& last, double& total) {
+  double now = telemetry_clock();
+  total += now - last;
+  last = now;
+}
+
+// Reads the value of a field (in kB) from /proc/self/status; returns 0 if
+// it is not available.
+inline long proc_status_kb(const char* field) {
+  std::ifstream in("/proc/self/status");
+  std::string name;
+  long value;
+  while(in >> name) {
+    if(name == field && in >> value)
+      return value;
+    in.ignore(1024, '\n');
+  }
+  return 0;
+}
+
+inline long current_rss_kb() {
+  return proc_status_kb("VmRSS:");
+}
+
+inline long peak_rss_kb() {
+  long peak = proc_status_kb("VmHWM:");
+  if(peak == 0) {
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+      peak = usage.ru_maxrss;
+  }
+  return peak;
+}
+
+// The distribution of the request latencies, in buckets of powers of 2
+// microseconds (bucket k holds the latencies in [2^k, 2^(k+1)) us; the last
+// one, at about half an hour, also holds the longer ones).
+class latency_histogram {
+public:
+  latency_histogram(): buckets(31, 0), count(0), total(0), max(0) {}
+
+  // Adds a latency, in milliseconds (as measured by telemetry_clock).
+  void add(double ms) {
+    double us = ms * 1000;
+    int k = 0;
+    while(k+1 < buckets.size() && us >= (2u << k))
+      k++;
+    buckets[k]++;
+    count++;
+    total += ms;
+    if(ms > max)
+      max = ms;
+  }
+
+  // An estimate of the latency (in milliseconds) under which the fraction p
+  // of the requests are: the histogram only tells in which bucket it falls,
+  // so the latencies are taken to be spread evenly over the bucket (and not
+  // above the largest one seen).
+  double percentile(double p) const {
+    if(count == 0)
+      return 0;
+    double rank = p * count;
+    unsigned long seen = 0;
+    for(int k=0 ; k<buckets.size() ; k++) {
+      if(buckets[k] > 0 && seen + buckets[k] >= rank) {
+	double low = k ? (1u << k) / 1000.0 : 0, high = (2u << k) / 1000.0;
+	if(high > max)
+	  high = max;
+	double estimate = low + (high - low) * (rank - seen) / buckets[k];
+	return estimate > low ? estimate : low;
+      }
+      seen += buckets[k];
+    }
+    return max;
+  }
+
+  void print(std::ostream& ostr) const {
+    ostr << "requests " << count << " mean_ms " << (count ? total/count : 0) << " max_ms " << max
+	 << " p50_ms " << percentile(0.5) << " p90_ms " << percentile(0.9) << " p99_ms " << percentile(0.99) << std::endl;
+    for(int k=0 ; k<buckets.size() ; k++)
+      if(buckets[k] > 0)
+	ostr << (k ? 1u << k : 0) << "-" << (2u << k) << "us " << buckets[k] << std::endl;
+  }
+
+private:
+  std::vector<unsigned long> buckets;
+  unsigned long count;
+  double total, max;
+};
+
+#endif
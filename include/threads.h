@@ -0,0 +1,107 @@
+// -*- C++ -*-
+/*
+  Small helpers for running the learner on several threads.
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __threads_h__
+#define __threads_h__
+
+#include <pthread.h>
+#include <vector>
+
+// The scratch buffers that the rule generation code keeps in static
+// variables (to avoid reallocating them at every call) have to be private
+// to each thread once the corpus is processed in parallel.
+#if __cplusplus >= 201103L
+#define THREAD_LOCAL thread_local
+#define HAVE_THREAD_LOCAL 1
+#else
+#define THREAD_LOCAL
+#define HAVE_THREAD_LOCAL 0
+#endif
+
+// Hands out consecutive chunks of the range [0, size) to the threads
+// that ask for work.
+class work_queue {
+public:
+  work_queue(int sz, int chunk = 64): next(0), size(sz), chunk_size(chunk) {
+    pthread_mutex_init(&lock, 0);
+  }
+
+  ~work_queue() {
+    pthread_mutex_destroy(&lock);
+  }
+
+  bool get(int& begin, int& end) {
+    pthread_mutex_lock(&lock);
+    begin = next;
+    end = begin + chunk_size < size ? begin + chunk_size : size;
+    next = end;
+    pthread_mutex_unlock(&lock);
+    return begin < end;
+  }
+
+private:
+  pthread_mutex_t lock;
+  int next, size, chunk_size;
+};
+
+template <class job_type>
+struct thread_job {
+  job_type* job;
+  int id;
+
+  static void* run(void* arg) {
+    thread_job* tj = static_cast<thread_job*>(arg);
+    (*tj->job)(tj->id);
+    return 0;
+  }
+};
+
+// Calls job(id) for id = 0..num_threads-1, each on its own thread, and
+// waits for all of them to finish. The job with id 0 is run on the
+// calling thread.
+template <class job_type>
+void run_in_threads(job_type& job, int num_threads) {
+  if(num_threads <= 1) {
+    job(0);
+    return;
+  }
+
+  std::vector<thread_job<job_type> > jobs(num_threads);
+  std::vector<pthread_t> threads(num_threads);
+  for(int t=0 ; t<num_threads ; t++) {
+    jobs[t].job = &job;
+    jobs[t].id = t;
+  }
+
+  for(int t=1 ; t<num_threads ; t++)
+    pthread_create(&threads[t], 0, thread_job<job_type>::run, &jobs[t]);
+  job(0);
+  for(int t=1 ; t<num_threads ; t++)
+    pthread_join(threads[t], 0);
+}
+
+#endif
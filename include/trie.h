@@ -73,6 +73,7 @@
 #include "my_bit_vector.h"
 #include "linear_map.h"
 #include "debug.h"
+#include "threads.h"
 //#include <dmalloc.h>
 
 // Checks whether the iterator i is between begin and end
@@ -664,8 +665,8 @@ struct __trie_node_base_iterator {
   };
 
   typedef iterator_stack iterator_stack_type;
-  static std::vector<iterator_stack> iterator_stack_pool;
-  static std::vector<unsigned> available_iterators;
+  static THREAD_LOCAL std::vector<iterator_stack> iterator_stack_pool;
+  static THREAD_LOCAL std::vector<unsigned> available_iterators;
   static const unsigned int pool_size = 1000l;
   static void Initialize() {
     iterator_stack_pool.resize(pool_size);
@@ -1884,9 +1885,9 @@ void trie<Key, Value, __trie_node_type>::write_in_binary_format(std::ostream& os
 }
 
 template <class Key, class Value, class MapType>
-std::vector<typename __trie_node_base_iterator<Key, Value, MapType>::iterator_stack> __trie_node_base_iterator<Key, Value, MapType>::iterator_stack_pool;
+THREAD_LOCAL std::vector<typename __trie_node_base_iterator<Key, Value, MapType>::iterator_stack> __trie_node_base_iterator<Key, Value, MapType>::iterator_stack_pool;
 
 template <class Key, class Value, class MapType>
-std::vector<unsigned int> __trie_node_base_iterator<Key, Value, MapType>::available_iterators;
+THREAD_LOCAL std::vector<unsigned int> __trie_node_base_iterator<Key, Value, MapType>::available_iterators;
 
 #endif
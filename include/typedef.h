@@ -45,13 +45,16 @@ typedef WORD_TYPE wordType;
 // The type for feature indices
 typedef POSITION_TYPE featureIndexType;
 
-typedef wordType* wordType1D;
 typedef char relativePosType;
 
+#include "corpus.h"
+
+typedef sample_ref wordType1D;
+
 typedef std::vector<wordType> wordTypeVector;
-typedef std::vector<wordType1D > wordType2D;
+typedef sentence_view wordType2D;
 typedef std::vector<wordTypeVector> wordType2DVector;
-typedef std::vector<wordType2D > wordType3D;
+typedef corpus_arena wordType3D;
 typedef std::vector<wordType2DVector> wordType3DVector;
 
 
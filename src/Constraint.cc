@@ -31,10 +31,11 @@
 #include "line_splitter.h"
 #include "Dictionary.h"
 #include "Rule.h"
+#include "io.h"
 
 extern int TRUTH;
 
-Constraint::Constraint(const string& line1) {
+Constraint::Constraint(const string& line1, bool insert_words) {
   line_splitter ls;
   ls.split(line1);
   features.resize(ls.size()-2);
@@ -60,8 +61,8 @@ Constraint::Constraint(const string& line1) {
 	
 	bool unknown = false;
 	for(int i=0 ; i<sz ; i++) {
-	  wordType wid = dict[ls[i]];
-	  if(dict.wasUnknown()) {
+	  wordType wid = insert_words ? Dictionary::GetDictionary().insert(ls[i]) : dict[ls[i]];
+	  if(! insert_words && dict.wasUnknown()) {
 		unknown = 1;
 		break;
 	  }
@@ -95,7 +96,7 @@ bool Constraint::test(const wordType1D& feature_vector, const Target& target) co
 	 templ.positions.end()) // The constraint is not on any feature from the current target
 	return true;
 
-  static vector<wordType> v;
+  static THREAD_LOCAL vector<wordType> v;
   initialize_vector(v, feature_vector);
 
   rep_type::const_iterator it = constraint.find(v);
@@ -104,7 +105,7 @@ bool Constraint::test(const wordType1D& feature_vector, const Target& target) co
 }
 
 bool Constraint::test(const wordType1D& feature_vector, int class_id) const {
-  static vector<wordType> v;
+  static THREAD_LOCAL vector<wordType> v;
   initialize_vector(v, feature_vector);
 
   rep_type::const_iterator it = constraint.find(v);
@@ -112,7 +113,7 @@ bool Constraint::test(const wordType1D& feature_vector, int class_id) const {
   return it==constraint.end() || it->second[class_id];
 }
 
-void ConstraintSet::read(const string& file_name) {
+void ConstraintSet::read(const string& file_name, bool insert_words) {
   istream* istr;
   smart_open(istr, file_name.c_str());
   string line;
@@ -123,8 +124,71 @@ void ConstraintSet::read(const string& file_name) {
 	if(ls.size() == 0 || line[0]=='#')
 	  continue;
 
-	constraints.push_back(Constraint(line));
+	constraints.push_back(Constraint(line, insert_words));
   }
 
   delete istr;
 }
+
+// The constraint is saved as the features, the target feature and the
+// number of entries, followed by the entries (the feature values and the
+// allowed classes, one byte per class).
+void Constraint::write_binary(ostream& ostr) const {
+  ::write_binary(ostr, static_cast<int>(features.size()));
+  for(wordTypeVector::const_iterator f=features.begin() ; f!=features.end() ; ++f)
+    ::write_binary(ostr, *f);
+  ::write_binary(ostr, target_feature);
+  ::write_binary(ostr, static_cast<int>(constraint.size()));
+  for(rep_type::const_iterator c=constraint.begin() ; c!=constraint.end() ; ++c) {
+    for(wordTypeVector::const_iterator w=c->first.begin() ; w!=c->first.end() ; ++w)
+      ::write_binary(ostr, *w);
+    ::write_binary(ostr, static_cast<int>(c->second.size()));
+    for(int i=0 ; i<c->second.size() ; i++)
+      ::write_binary(ostr, static_cast<char>(c->second[i]));
+  }
+}
+
+bool Constraint::read_binary(istream& istr) {
+  int num_features, num_entries, num_classes;
+  ::read_binary(istr, num_features);
+  features.resize(num_features);
+  for(int i=0 ; i<num_features ; i++)
+    ::read_binary(istr, features[i]);
+  ::read_binary(istr, target_feature);
+  if(! ::read_binary(istr, num_entries))
+    return false;
+
+  constraint.clear();
+  wordTypeVector key(num_features);
+  for(int e=0 ; e<num_entries ; e++) {
+    for(int i=0 ; i<num_features ; i++)
+      ::read_binary(istr, key[i]);
+    if(! ::read_binary(istr, num_classes))
+      return false;
+    bit_vector& seen = constraint[key];
+    seen.resize(num_classes);
+    for(int i=0 ; i<num_classes ; i++) {
+      char c;
+      ::read_binary(istr, c);
+      seen[i] = c != 0;
+    }
+  }
+  return ! istr.fail();
+}
+
+void ConstraintSet::write_binary(ostream& ostr) const {
+  ::write_binary(ostr, static_cast<int>(constraints.size()));
+  for(constraint_vector::const_iterator c=constraints.begin() ; c!=constraints.end() ; ++c)
+    c->write_binary(ostr);
+}
+
+bool ConstraintSet::read_binary(istream& istr) {
+  int size;
+  if(! ::read_binary(istr, size))
+    return false;
+  constraints.resize(size);
+  for(int i=0 ; i<size ; i++)
+    if(! constraints[i].read_binary(istr))
+      return false;
+  return true;
+}
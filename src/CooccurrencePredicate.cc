@@ -118,7 +118,7 @@ void CooccurrencePredicate::Initialize(const string& file) {
       featureIndexType feature_id = p->first;
       relativePosType pos = p->second;
       for(int i=0 ; i<corpus.size(); ++i) {
-	wordType2D& vect = corpus[i];
+	wordType2D vect = corpus[i];
 	int min_ind = max(-PredicateTemplate::MaxBackwardLookup, -PredicateTemplate::MaxBackwardLookup - pos);
 	int max_ind = min(vect.size()-PredicateTemplate::MaxForwardLookup, vect.size()-PredicateTemplate::MaxForwardLookup - pos);
 		
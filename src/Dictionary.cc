@@ -28,6 +28,8 @@
 #include "Dictionary.h"
 #include "common.h"
 #include "line_splitter.h"
+#include <fstream>
+#include <cstring>
 #if __GNUC__ > 3
 #include <ext/numeric>
 using namespace __gnu_cxx;
@@ -38,6 +40,7 @@ using namespace __gnu_cxx;
 using namespace std;
 
 int Dictionary::num_classes = 0;
+THREAD_LOCAL bool Dictionary::was_unknown = false;
 
 const string& Dictionary::getString(wordType index) const {
   if (index >= word_index.size() || index==unknown_index) {
@@ -45,7 +48,7 @@ const string& Dictionary::getString(wordType index) const {
     return spelling_of_unknown;
   }
   was_unknown = false;
-  return word_index[index];
+  return spellings[index];
 }
 
 int Dictionary::getCounts(wordType index) {
@@ -55,8 +58,8 @@ int Dictionary::getCounts(wordType index) {
 }
 
 wordType Dictionary::getIndex(const string& word) const {
-  int ind = word_index[word];
-  if (ind == word_index.fake_index) {
+  int ind = word_index.find(word);
+  if (ind == word_index_type::not_found) {
     was_unknown = true;
     return unknown_index;
   } else {
@@ -66,11 +69,11 @@ wordType Dictionary::getIndex(const string& word) const {
 }
 
 wordType Dictionary::getIndex(const string& word) {
-  wordType i=word_index[word];
+  int i = word_index.find(word);
 
-  if(i == word_index.fake_index) {
+  if(i == word_index_type::not_found) {
     was_unknown = true;
-    return word_index.insert(word);
+    return insert(word);
   } 
   else {
     was_unknown = false;
@@ -89,17 +92,110 @@ wordType Dictionary::increaseCount(int index, unsigned int count) {
   return index;
 }
 
-void Dictionary::writeToFile(const string& file) const {
-  ostream* ostr;
-  smart_open(ostr, file);
-  *ostr << "#real_word_indices: " << _real_word_start_index << " " << _real_word_end_index << endl;
-  *ostr << "#number_of_classes: " << num_classes << endl;
-  for(const_iterator i = begin() ; i!= end() ; ++i)
-    *ostr << *i << endl;
-  delete ostr;
+// The header of the binary vocabulary files: the magic string, followed by
+// the version, a byte order mark, the number of classes and the range of the
+// real words (as ints); the string_index follows.
+static const char vocabulary_magic[] = "fnTBL-vocabulary";
+static const int vocabulary_magic_size = sizeof(vocabulary_magic) - 1;
+static const int vocabulary_version = 1;
+static const int vocabulary_byte_order = 0x01020304;
+
+void Dictionary::writeToFile(const string& file, bool text_format) const {
+  if(text_format) {
+    ostream* ostr;
+    smart_open(ostr, file);
+    *ostr << "#real_word_indices: " << _real_word_start_index << " " << _real_word_end_index << endl;
+    *ostr << "#number_of_classes: " << num_classes << endl;
+    for(int i=0 ; i<word_index.size() ; i++) {
+      ostr->write(word_index.data(i), word_index.length(i));
+      *ostr << endl;
+    }
+    delete ostr;
+    return;
+  }
+
+  ofstream out(file.c_str(), ios::out | ios::binary);
+  writeBinary(out);
+  out.close();
+  if(! out) {
+    cerr << "Could not write the vocabulary file " << file << " !" << endl;
+    exit(112);
+  }
+}
+
+void Dictionary::writeBinary(ostream& out) const {
+  int header[5] = { vocabulary_version, vocabulary_byte_order, num_classes, 
+		    static_cast<int>(_real_word_start_index), static_cast<int>(_real_word_end_index) };
+  out.write(vocabulary_magic, vocabulary_magic_size);
+  out.write(reinterpret_cast<const char*>(header), sizeof(header));
+  word_index.write_frozen(out);
+}
+
+bool Dictionary::isBinaryVocabulary(const char* data, unsigned long size) {
+  return size >= vocabulary_magic_size + 5 * sizeof(int) && memcmp(data, vocabulary_magic, vocabulary_magic_size) == 0;
+}
+
+// Uses the binary vocabulary in file, if it is one; the words are used
+// directly from the mapped file.
+bool Dictionary::mapFile(const string& file) {
+  if(! voc_file.open(file))
+    return false;
+  if(! isBinaryVocabulary(voc_file.data(), voc_file.size())) {
+    voc_file.close();
+    return false;
+  }
+  // The file is needed only if the words are used in place
+  if(! mapVocabulary(voc_file.data(), voc_file.size(), file))
+    voc_file.close();
+  return true;
+}
+
+bool Dictionary::mapVocabulary(const char* data, unsigned long size, const string& name) {
+  const unsigned long header_size = vocabulary_magic_size + 5 * sizeof(int);
+  if(! isBinaryVocabulary(data, size)) {
+    cerr << "The vocabulary " << name << " is not a binary vocabulary." << endl;
+    exit(1);
+  }
+
+  const int* header = reinterpret_cast<const int*>(data + vocabulary_magic_size);
+  if(header[0] != vocabulary_version || header[1] != vocabulary_byte_order) {
+    cerr << "The vocabulary " << name << " was written by a different version of fnTBL, or on a different architecture." << endl;
+    exit(1);
+  }
+  num_classes = header[2];
+  _real_word_start_index = header[3];
+  _real_word_end_index = header[4];
+
+  const char* words = data + header_size;
+  unsigned long words_size = size - header_size;
+  bool in_place = this->size() == 0;
+  bool mapped = false;
+  if(in_place)
+    mapped = word_index.map(words, words_size) != 0;
+  else {
+    // The words already in the dictionary keep their indices, so the
+    // vocabulary has to be copied after them.
+    string_index temp;
+    if((mapped = temp.map(words, words_size) != 0))
+      for(int i=0 ; i<temp.size() ; i++)
+	insert(temp.str(i));
+  }
+  if(! mapped) {
+    cerr << "The vocabulary " << name << " is corrupted." << endl;
+    exit(1);
+  }
+  if(in_place) {
+    word_counts.assign(this->size(), 0);
+    for(int i=0 ; i<this->size() ; i++)
+      spellings.push_back(word_index.str(i));
+  }
+  return in_place;
 }
 
 void Dictionary::readFromFile(const string& file) {
+  if(mapFile(file))
+    return;
+
   istream* istr;
   smart_open(istr, file);
   string line;
@@ -0,0 +1,236 @@
+/*
+  Implements the compiled models (ModelBundle).
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "ModelBundle.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include "Dictionary.h"
+#include "io.h"
+
+static const char model_magic[] = "fnTBL-model";
+static const int model_magic_size = 16;
+static const int model_version = 1;
+static const int model_byte_order = 0x01020304;
+static const int model_header_size = model_magic_size + 4 * sizeof(int);
+
+// Reads from a block of memory (a section of the mapped file) without
+// copying it.
+class memory_buffer: public std::streambuf {
+public:
+  memory_buffer(const char* data, unsigned int size) {
+    char* start = const_cast<char*>(data);
+    setg(start, start, start + size);
+  }
+};
+
+static void write_string(ostream& ostr, const string& str) {
+  write_binary(ostr, static_cast<int>(str.size()));
+  ostr.write(str.data(), str.size());
+}
+
+static bool read_string(istream& istr, string& str) {
+  int size;
+  if(! read_binary(istr, size) || size < 0)
+    return false;
+  str.resize(size);
+  return size == 0 || ! istr.read(&str[0], size).fail();
+}
+
+bool ModelBundle::open(const string& file) {
+  if(! model_file.open(file))
+    return false;
+  const char* data = model_file.data();
+  if(model_file.size() < model_header_size || memcmp(data, model_magic, sizeof(model_magic)) != 0) {
+    model_file.close();
+    return false;
+  }
+
+  name = file;
+  const int* header = reinterpret_cast<const int*>(data + model_magic_size);
+  if(header[0] != model_version || header[1] != model_byte_order || header[2] != sizeof(wordType)) {
+    cerr << "The model " << file << " was compiled by a different version of fnTBL, or on a different architecture." << endl;
+    exit(1);
+  }
+  num_sections = header[3];
+  sections = reinterpret_cast<const section*>(data + model_header_size);
+  if(num_sections < 0 || model_header_size + num_sections * sizeof(section) > model_file.size()) {
+    cerr << "The model " << file << " is corrupted." << endl;
+    exit(1);
+  }
+  for(int i=0 ; i<num_sections ; i++)
+    if(static_cast<unsigned long>(sections[i].offset) + sections[i].size > model_file.size()) {
+      cerr << "The model " << file << " is corrupted." << endl;
+      exit(1);
+    }
+  return true;
+}
+
+const ModelBundle::section* ModelBundle::find_section(int id) const {
+  for(int i=0 ; i<num_sections ; i++)
+    if(sections[i].id == id)
+      return sections + i;
+  return 0;
+}
+
+const ModelBundle::section& ModelBundle::get_section(int id) const {
+  const section* s = find_section(id);
+  if(s == 0) {
+    cerr << "The model " << name << " is corrupted (section " << id << " is missing)." << endl;
+    exit(1);
+  }
+  return *s;
+}
+
+void ModelBundle::loadTemplates() const {
+  const section& s = get_section(TEMPLATES);
+  memory_buffer buffer(model_file.data() + s.offset, s.size);
+  istream istr(&buffer);
+
+  string feature_line;
+  int num_lines = 0;
+  bool ok = read_string(istr, feature_line) && read_binary(istr, num_lines);
+  string1D lines(ok ? num_lines : 0);
+  for(int i=0 ; ok && i<num_lines ; i++)
+    ok = read_string(istr, lines[i]);
+  if(! ok) {
+    cerr << "The model " << name << " is corrupted (in the templates)." << endl;
+    exit(1);
+  }
+  RuleTemplate::Initialize(feature_line, lines, name);
+}
+
+void ModelBundle::loadVocabulary() const {
+  const section& s = get_section(VOCABULARY);
+  Dictionary& dict = Dictionary::GetDictionary();
+  if(dict.size() != 0) {
+    cerr << "The vocabulary of the model " << name << " has to be loaded first." << endl;
+    exit(1);
+  }
+  dict.mapVocabulary(model_file.data() + s.offset, s.size, name);
+}
+
+void ModelBundle::loadConstraints(ConstraintSet& constraints) const {
+  const section& s = get_section(CONSTRAINTS);
+  memory_buffer buffer(model_file.data() + s.offset, s.size);
+  istream istr(&buffer);
+  if(! constraints.read_binary(istr)) {
+    cerr << "The model " << name << " is corrupted (in the constraints)." << endl;
+    exit(1);
+  }
+}
+
+void ModelBundle::loadRules(vector<Rule>& rules) const {
+  const section& s = get_section(RULES);
+  memory_buffer buffer(model_file.data() + s.offset, s.size);
+  istream istr(&buffer);
+
+  int num_rules = 0;
+  bool ok = read_binary(istr, num_rules);
+  rules.reserve(rules.size() + num_rules);
+  Rule rule;
+  for(int i=0 ; ok && i<num_rules ; i++)
+    if((ok = rule.read_binary(istr)))
+      rules.push_back(rule);
+  if(! ok) {
+    cerr << "The model " << name << " is corrupted (in the rules)." << endl;
+    exit(1);
+  }
+}
+
+string ModelBundle::tree() const {
+  const section& s = get_section(TREE);
+  return string(model_file.data() + s.offset, s.size);
+}
+
+void ModelBundle::write(const string& file, const vector<Rule>& rules, const string& tree_text) {
+  vector<string> contents;
+  vector<int> ids;
+
+  ostringstream templates;
+  write_string(templates, RuleTemplate::FeatureLine);
+  write_binary(templates, static_cast<int>(RuleTemplate::TemplateLines.size()));
+  for(string1D::const_iterator l=RuleTemplate::TemplateLines.begin() ; l!=RuleTemplate::TemplateLines.end() ; ++l)
+    write_string(templates, *l);
+  ids.push_back(TEMPLATES);
+  contents.push_back(templates.str());
+
+  ostringstream vocabulary;
+  Dictionary::GetDictionary().writeBinary(vocabulary);
+  ids.push_back(VOCABULARY);
+  contents.push_back(vocabulary.str());
+
+  ostringstream constraints;
+  Rule::Constraints.write_binary(constraints);
+  ids.push_back(CONSTRAINTS);
+  contents.push_back(constraints.str());
+
+  ostringstream rule_list;
+  write_binary(rule_list, static_cast<int>(rules.size()));
+  for(vector<Rule>::const_iterator r=rules.begin() ; r!=rules.end() ; ++r)
+    r->write_binary(rule_list);
+  ids.push_back(RULES);
+  contents.push_back(rule_list.str());
+
+  if(tree_text != "") {
+    ids.push_back(TREE);
+    contents.push_back(tree_text);
+  }
+
+  // The sections start at multiples of 8, so the vocabulary can be used
+  // in place.
+  vector<section> table(contents.size());
+  unsigned long offset = model_header_size + table.size() * sizeof(section);
+  for(int i=0 ; i<table.size() ; i++) {
+    offset = (offset + 7) & ~7ul;
+    table[i].id = ids[i];
+    table[i].offset = offset;
+    table[i].size = contents[i].size();
+    offset += contents[i].size();
+  }
+
+  ofstream out(file.c_str(), ios::out | ios::binary);
+  char magic[model_magic_size];
+  memset(magic, 0, model_magic_size);
+  memcpy(magic, model_magic, sizeof(model_magic));
+  int header[4] = { model_version, model_byte_order, sizeof(wordType), static_cast<int>(table.size()) };
+  out.write(magic, model_magic_size);
+  out.write(reinterpret_cast<const char*>(header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(&table[0]), table.size() * sizeof(section));
+  unsigned long position = model_header_size + table.size() * sizeof(section);
+  for(int i=0 ; i<table.size() ; i++) {
+    static const char padding[8] = { 0 };
+    out.write(padding, table[i].offset - position);
+    out.write(contents[i].data(), contents[i].size());
+    position = table[i].offset + table[i].size;
+  }
+  out.close();
+  if(! out) {
+    cerr << "Could not write the model file " << file << " !" << endl;
+    exit(112);
+  }
+}
@@ -46,7 +46,7 @@ extern featureIndexType STATE;
 Dictionary PredicateTemplate::name_map;
 string1D PredicateTemplate::TemplateNames;
 vector<PredicateTemplate> PredicateTemplate::Templates;
-sized_memory_pool<Predicate::order_rep_type> Predicate::memory_pool(100);
+THREAD_LOCAL sized_memory_pool<Predicate::order_rep_type> Predicate::memory_pool(100);
 HASH_NAMESPACE::hash_map<string, string> PredicateTemplate::variables;
 
 relativePosType PredicateTemplate::MaxBackwardLookup = 0;
@@ -62,7 +62,26 @@ public:
 
 PredicateTemplateDeallocator deallocator;
 
+// Compiles all the templates; has to be called after the templates are read.
 void PredicateTemplate::Initialize() {
+  for(PredicateTemplate_vector::iterator t=Templates.begin() ; t!=Templates.end() ; ++t)
+    t->compile();
+}
+
+void PredicateTemplate::compile() {
+  ops.resize(tests.size());
+  equality_only = true;
+  for(int i=0 ; i<tests.size() ; i++) {
+    compiled_op& op = ops[i];
+    op.sample_difference = 0;
+    op.feature = 0;
+    if(tests[i]->get_equality_test(op.sample_difference, op.feature))
+      op.test = 0;
+    else {
+      op.test = tests[i];
+      equality_only = false;
+    }
+  }
 }
 
 //   The format of a template is as follows:
@@ -276,7 +295,7 @@ PredicateTemplate::PredicateTemplate(const string1D& ls) {
 
 // create all possible instantiations of the current template
 void PredicateTemplate::instantiate(const wordType2D& corpus, int sample_ind, wordType2DVector& instances) const {
-  static wordType2DVector feature_vector;
+  static THREAD_LOCAL wordType2DVector feature_vector;
 
   feature_vector.resize(tests.size());
   for(int i=0 ; i<tests.size() ; i++) {
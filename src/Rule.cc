@@ -29,13 +29,15 @@
 #include <numeric>
 #include "Params.h"
 #include "line_splitter.h"
+#include "io.h"
 
-rule_list_type rule_hash::fake_list(0);
 ConstraintSet Rule::Constraints;
 
 HASH_NAMESPACE::hash_map<string, string> RuleTemplate::variables;
 HASH_NAMESPACE::hash_map<string, string> RuleTemplate::rvariables;
 string1D RuleTemplate::TemplateNames;
+string RuleTemplate::FeatureLine;
+string1D RuleTemplate::TemplateLines;
 RuleTemplate::RuleTemplate_vector RuleTemplate::Templates;
 Dictionary RuleTemplate::name_map;
 int2D RuleTemplate::pt_list;
@@ -46,14 +48,14 @@ using namespace std;
 using std::operator!=;
 
 // initializes a rule from the corpus.
-Rule::Rule(int p_tid, int t_tid, const wordType1D& p_tok, const wordType1D& t_tok): predicate(p_tid, p_tok), target(t_tid, t_tok) {
+Rule::Rule(int p_tid, int t_tid, const wordType1D& p_tok, const wordType1D& t_tok): predicate(p_tid, p_tok), target(t_tid, t_tok), heap_index(-1) {
   bad = good = (scoreType)0.0; 
 
   hashIndex = hashVal();
   ON_DEBUG(rule_name = printMe());
 }
 
-Rule::Rule(int p_tid, int t_tid, const wordTypeVector& p_tok, const wordTypeVector& t_tok): predicate(p_tid, p_tok), target(t_tid, t_tok)
+Rule::Rule(int p_tid, int t_tid, const wordTypeVector& p_tok, const wordTypeVector& t_tok): predicate(p_tid, p_tok), target(t_tid, t_tok), heap_index(-1)
 {
   bad = good = (scoreType)0.0; 
 
@@ -62,7 +64,7 @@ Rule::Rule(int p_tid, int t_tid, const wordTypeVector& p_tok, const wordTypeVect
 }
 // initializes a rule.
 // This constructor is used when we're reading in a rule in from a file.
-Rule::Rule(string1D &rule_components): target(0)
+Rule::Rule(string1D &rule_components): target(0), heap_index(-1)
 {
   static string arrow="=>";
   string1D::iterator pos = find(rule_components.begin(), rule_components.end(), arrow);
@@ -88,7 +90,7 @@ Rule::Rule(string1D &rule_components): target(0)
 // the correct one, the predicate matches and the transformation does not 
 // break any constraints.
 bool Rule::test(const wordType2D &corpus, int word) const {
-  return target.affects(corpus[word]) && predicate.test(corpus, word) && Constraints(corpus[word], target);
+  return rule_ref(*this).test(corpus, word);
 }
 
 double Rule::test(const wordType2D& corpus, int word, const float2D& context_prob) const {
@@ -97,18 +99,71 @@ double Rule::test(const wordType2D& corpus, int word, const float2D& context_pro
 
 // Gets the corresponding token from the corpus.
 string Rule::printMe() const {
-  return predicate.printMe() + " => " + target.printMe();
+  return rule_ref(*this).printMe();
 }
 
 // Calculates the index into a hash of rules.
 int Rule::hashVal(void) const {
   // Have the hash value depend on the targetState as well.
-  return target.hashVal(predicate.hashIndex);
+  return hash_finalize(target.hashVal(hash_combine(predicate.hashIndex, target.tid)));
 }
 
-void Rule::Initialize() {
+void Rule::write_binary(ostream& ostr) const {
+  rule_ref(*this).write_binary(ostr);
+}
+
+void rule_ref::write_binary(ostream& ostr) const {
+  ::write_binary(ostr, predicate.template_id);
+  ::write_binary(ostr, static_cast<short int>(predicate.tokens.size()));
+  for(Predicate::token_vector_type::const_iterator tok = predicate.tokens.begin() ; tok != predicate.tokens.end() ; ++tok)
+    ::write_binary(ostr, *tok);
+  ::write_binary(ostr, target.tid);
+  ::write_binary(ostr, static_cast<short int>(target.vals.size()));
+  for(wordTypeVector::const_iterator val = target.vals.begin() ; val != target.vals.end() ; ++val)
+    ::write_binary(ostr, *val);
+  ::write_binary(ostr, good);
+  ::write_binary(ostr, bad);
+}
+
+bool Rule::read_binary(istream& istr, const wordTypeVector* translation) {
+  short int pred_tid, target_tid, size;
+  wordTypeVector tokens, vals;
+
+  ::read_binary(istr, pred_tid);
+  ::read_binary(istr, size);
+  tokens.resize(size);
+  for(int i=0 ; i<size ; i++)
+    ::read_binary(istr, tokens[i]);
+  ::read_binary(istr, target_tid);
+  ::read_binary(istr, size);
+  vals.resize(size);
+  for(int i=0 ; i<size ; i++)
+    ::read_binary(istr, vals[i]);
+  if(! istr)
+    return false;
+
+  if(translation) {
+    for(wordTypeVector::iterator w=tokens.begin() ; w!=tokens.end() ; ++w) {
+      if(*w >= translation->size())
+	return false;
+      *w = (*translation)[*w];
+    }
+    for(wordTypeVector::iterator w=vals.begin() ; w!=vals.end() ; ++w) {
+      if(*w >= translation->size())
+	return false;
+      *w = (*translation)[*w];
+    }
+  }
+
+  *this = Rule(Predicate(pred_tid, tokens), Target(target_tid, vals));
+  ::read_binary(istr, good);
+  return ::read_binary(istr, bad);
+}
+
+void Rule::Initialize(bool read_constraints) {
+  TargetTemplate::InitializeTruthSets();
   string constraints_file = Params::GetParams()["CONSTRAINTS_FILE"];
-  if(constraints_file != "")
+  if(read_constraints && constraints_file != "")
     Constraints.read(constraints_file);
 }
 
@@ -126,8 +181,29 @@ void RuleTemplate::Initialize() {
   getline(*f, line);
   delete f;
 
+  file = p.valueForParameter("RULE_TEMPLATES");
+  smart_open(f, file);
+  string1D lines;
+  string template_line;
+  while (getline(*f, template_line))
+    lines.push_back(template_line);
+  delete f;
+
+  Initialize(line, lines, file);
+}
+
+// Builds the templates from the feature line (the first line of the
+// FILE_TEMPLATE file) and the lines of the RULE_TEMPLATES file; source
+// names the latter, in the error messages.
+void RuleTemplate::Initialize(const string& feature_line, const string1D& template_lines, const string& source) {
+  if (PredicateTemplate::name_map.size() != 0 && TargetTemplate::name_map.size() !=0 )
+    return;
+
+  FeatureLine = feature_line;
+  TemplateLines = template_lines;
+
   line_splitter ls;
-  ls.split(line);
+  ls.split(feature_line);
 
   string invalid_chars = "=_:-";
   string::size_type pos;
@@ -188,10 +264,9 @@ void RuleTemplate::Initialize() {
     RuleTemplate::name_map.insert(*i);
   }
 
-  file = p.valueForParameter("RULE_TEMPLATES");
-  smart_open(f, file);
-  
-  while (getline(*f, line)) {
+  const string& file = source;
+  for(string1D::const_iterator l=template_lines.begin() ; l!=template_lines.end() ; ++l) {
+    const string& line = *l;
     if(line[0] == '#')
       continue;
 
@@ -279,7 +354,7 @@ void RuleTemplate::Initialize() {
   for(int i=0 ; i<PredicateTemplate::Templates.size() ; i++) {
     PredicateTemplate::Templates[i].set_dependencies();
   }
-  delete f;
+  PredicateTemplate::Initialize();
 }
 
 // Generate all rules whose predicate is true on the given "sentence" (corpus), and correct
@@ -290,8 +365,8 @@ void RuleTemplate::instantiate(const wordType2D& corpus, int sample_ind,
 			       int pred_tid, rule_set& instances, 
 			       bool generateBasedOnPredicate, 
 			       bool forced_generation) {
-  static wordType2DVector pred_insts;
-  static wordType2DVector target_insts;
+  static THREAD_LOCAL wordType2DVector pred_insts;
+  static THREAD_LOCAL wordType2DVector target_insts;
 
   ON_DEBUG(assert(pt_list.size()>pred_tid && pt_list[pred_tid].size()>0));
 
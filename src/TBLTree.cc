@@ -45,13 +45,17 @@ TBLTree::TBLTree(const string& file) {
 
 void TBLTree::readInTextFormat(const string& file) {
   istream* ts;
-  int1D v1, v2;
-  Node::addSimpleTemplates(v1, v2);
   smart_open(ts, file);
-  *ts >> *this;
+  readInTextFormat(*ts);
   delete ts;
 }
 
+void TBLTree::readInTextFormat(istream& istr) {
+  int1D v1, v2;
+  Node::addSimpleTemplates(v1, v2);
+  istr >> *this;
+}
+
 void TBLTree::initialize(const vector<Rule>& tbl_rules) {
   rules = tbl_rules;
   
@@ -189,13 +193,18 @@ istream& operator >> (istream& istr, TBLTree& tree) {
 void TBLTree::readClasses(const string& file) {
   istream* istr;
   smart_open(istr, file);
-  
+  readClasses(*istr);
+  if (file != "-")
+	delete istr;
+}
+
+void TBLTree::readClasses(istream& istr) {
   string line;
   line_splitter ls;
-  getline(*istr, line);
+  getline(istr, line);
 
   Dictionary& dict = Dictionary::GetDictionary();
-  getline(*istr, line);
+  getline(istr, line);
   ls.split(line);
 
   for(int i=1 ; i<ls.size() ; i++)
@@ -203,9 +212,6 @@ void TBLTree::readClasses(const string& file) {
 
   dict.FixClasses();
 
-  if (file != "-")
-	delete istr;
-
   PredicateTemplate::PredicateTemplate_vector& templates = PredicateTemplate::Templates;
 //   static unsigned short fake_rule_index = Dictionary::GetDictionary()["FAKE_CLASS"];
   static bool initialized = false;
@@ -34,6 +34,9 @@ short int TargetTemplate::TRUTH_SIZE  = 0;
 string1D TargetTemplate::TemplateNames;
 TargetTemplate::TargetTemplate_vector TargetTemplate::Templates;
 Dictionary TargetTemplate::name_map;
+bool TargetTemplate::multiple_truths = false;
+int1D TargetTemplate::truth_set_start;
+wordTypeVector TargetTemplate::truth_set_values;
 using namespace std;
 
 TargetTemplate::TargetTemplate(const vector<string>& truth_features): positions(truth_features.size()) {
@@ -41,6 +44,52 @@ TargetTemplate::TargetTemplate(const vector<string>& truth_features): positions(
     positions[i] = name_map[truth_features[i]];
 }
 
+// Splits, once, all the words of the dictionary that contain TRUTH_SEPARATOR
+// into the sorted indices of their values (inserting the values in the
+// dictionary, if needed), so value_is_correct does not have to compare strings.
+// Should be called after the data was studied, before any thread is started.
+void TargetTemplate::InitializeTruthSets() {
+  string truth_sep = Params::GetParams()["TRUTH_SEPARATOR"];
+  multiple_truths = truth_sep != "";
+  truth_set_start.clear();
+  truth_set_values.clear();
+  if(! multiple_truths)
+    return;
+
+  Dictionary& dict = Dictionary::GetDictionary();
+  line_splitter ts(truth_sep);
+  int size = dict.size();
+  truth_set_start.reserve(size+1);
+  for(int w=0 ; w<size ; w++) {
+    truth_set_start.push_back(truth_set_values.size());
+    // the string is copied, as inserting the values can move it
+    string word = dict[static_cast<wordType>(w)];
+    if(word.find_first_of(truth_sep) == string::npos)
+      continue;
+    ts.split(word);
+    if(ts.size() < 2)
+      continue;
+    for(int i=0 ; i<ts.size() ; i++)
+      truth_set_values.push_back(dict[ts[i]]);
+    sort(truth_set_values.begin() + truth_set_start.back(), truth_set_values.end());
+  }
+  truth_set_start.push_back(truth_set_values.size());
+}
+
+bool TargetTemplate::value_is_in_truth_string(wordType val, wordType truth) {
+  static string truth_sep = Params::GetParams()["TRUTH_SEPARATOR"];
+  static THREAD_LOCAL line_splitter ts(truth_sep);
+  static const Dictionary& dict = Dictionary::GetDictionary();
+  ts.split(dict[truth]);
+  if(ts.size()==1)
+    return val == truth;
+  const string& val_str = dict[val];
+  for(int i=0 ; i<ts.size() ; i++)
+    if(val_str == ts[i])
+      return true;
+  return false;
+}
+
 // Instantiate all the possible values for the targets. Usually, there is only one true value per example,
 // but we implemented an extended version - it might be possible to have multiple true values, separated
 // by 1 character, stored in the parameter TRUTH_SEPARATOR.
@@ -57,10 +106,10 @@ void TargetTemplate::instantiate(const wordType1D& corpus, wordType2DVector& ins
       instances[0].push_back(corpus[TRUTH_START + *i]);
   } 
   else {
-    static wordType2DVector targets;
+    static THREAD_LOCAL wordType2DVector targets;
     targets.resize(positions.size());
     // Big assumption here: the TRUTH_SEPARATOR variable has only 1 character !!
-    static line_splitter ts(truth_sep);
+    static THREAD_LOCAL line_splitter ts(truth_sep);
     int pos = 0, prod = 1;
     static const Dictionary& dict = Dictionary::GetDictionary();
     for(pos_vector::iterator i=positions.begin() ; i!=positions.end() ; ++i, ++pos) {
@@ -72,12 +121,12 @@ void TargetTemplate::instantiate(const wordType1D& corpus, wordType2DVector& ins
       prod *= ts.size();
     }
 
-    static wordTypeVector vals;
+    static THREAD_LOCAL wordTypeVector vals;
     vals.resize(positions.size());
     pos = 0;
     instances.resize(prod);
     instances.clear();
-    static vector<wordTypeVector::iterator> iters;
+    static THREAD_LOCAL vector<wordTypeVector::iterator> iters;
     iters.resize(positions.size());
     for(int i=0 ; i<targets.size() ; i++)
       iters[i] = targets[i].begin();
@@ -56,10 +56,9 @@
 
 typedef PredicateTemplate::PredicateTemplate_vector PredicateTemplate_vector;
 typedef hash_set<Rule> rule_hash_set;
-typedef hash_set<Rule*> rulep_hash_set;
+typedef hash_set<rule_id> rule_id_set;
 typedef vector<pair<int, int> > position_vector;
 typedef vector<Rule> rule_vector;
-typedef vector<Rule*> rulep_vector;
 typedef word_index<unsigned int, unsigned short> word_index_class;
 typedef hash_map<Predicate, int> pred_int_map;
 
@@ -132,10 +131,9 @@ struct comp {
 struct wordType1DHash {
   size_t operator() (const wordType1D& p) const {
     static int no_features = PredicateTemplate::name_map.size()+TargetTemplate::name_map.size();
-    size_t ind = *p;
-    wordType* l=p;
-    for(int i=1 ; i<no_features ; i++, ++l)
-      ind = 7*ind + *l;
+    size_t ind = p[0];
+    for(int i=1 ; i<no_features ; i++)
+      ind = 7*ind + p[i-1];
 
     return ind;
   }
@@ -144,7 +142,10 @@ struct wordType1DHash {
 struct wordType1D_equal {
   bool operator() (const wordType1D& p1, const wordType1D& p2) {
     static int no_features = PredicateTemplate::name_map.size()+TargetTemplate::name_map.size();
-    return equal(p1, p1+no_features, p2);
+    for(int i=0 ; i<no_features ; i++)
+      if(p1[i] != p2[i])
+	return false;
+    return true;
   }
 };
 
@@ -163,20 +164,20 @@ void initializeDefaultCosts ( int lines ) {
 
     static int no_features = PredicateTemplate::name_map.size()+TargetTemplate::name_map.size();
     wordType3D corpus1(samples.size());
+    corpus1.set_sample_width(corpus.sample_width());
+    corpus1.reserve(samples.size());
     costs.resize(samples.size());
 
     int k=0;
     for(hash_map<wordType1D, int, wordType1DHash, wordType1D_equal>::iterator i=samples.begin() ; i!=samples.end() ; ++i, ++k) {
-      corpus1[k].resize(1);
-      corpus1[k][0] = new wordType [no_features];
-      copy(i->first, i->first+no_features, corpus1[k][0]);
+      corpus1.resize_sentence(k, 1);
+      for(int f=0 ; f<no_features ; f++)
+	corpus1[k][0][f] = i->first[f];
       costs[k] = i->second;
     }
     corpus.swap(corpus1);
     if(v_flag)
       cerr << "there are " << corpus.size() << " samples in the end" << endl;
-    for(int i=0 ; i<corpus1.size() ; i++)
-      delete [] corpus1[i][0];
   }
   else {
     costs.resize(lines);
@@ -372,7 +373,7 @@ void createRulesForExample(int line, int word, rule_hash_set &ruleSet, bool retu
   }
 }
 
-void createRulesForExample(int line, int word, const int1D& modified_positions, rulep_hash_set& pRules,
+void createRulesForExample(int line, int word, const int1D& modified_positions, rule_id_set& pRules,
 			   feature_vector& modified_states, bool returnAllRules = false, bool add_new_rules = false) {
   // If the special function is turned on, then return all the rules
   // whose predicate is true on the specific example.
@@ -420,7 +421,7 @@ void createRulesForExample(int line, int word, const int1D& modified_positions,
 	rule_hash_const_iterator rlend = allRules.pend(p);
 	for(rule_hash_const_iterator rl = allRules.pbegin(p) ; rl!=rlend ; ++rl, ++no_rls)
 	  if((*rl).constraint_test(corpus[line][word]))
-	    pRules.insert(&const_cast<Rule&>(*rl));
+	    pRules.insert(rl.id());
 
       }
 
@@ -483,7 +484,7 @@ void createRulesForExample(int line, int word, const int1D& modified_positions,
 	  // Since the rule has the score computed correctly for this sentence
 	  // there is no need to add it to the list of rules that need updating
 	} else
-	  pRules.insert(&const_cast<Rule&>(*it));
+	  pRules.insert(it.id());
       }
     }
   }
@@ -543,7 +544,7 @@ void computeScoreForAllRules() {
   allRules.clear();
   
   rule_hash_set ruleSet;
-  rulep_hash_set pRules;
+  rule_id_set pRules;
   
   ticker tk("Sentences processed: ", 64);
   if(v_flag)
@@ -689,7 +690,7 @@ const Rule &getBestRule(void )
   bool start = true;
   for (rule_hash_set::iterator thisRule = allRules.begin();
        thisRule != allRules.end(); ++thisRule, ++iteration) {
-    Rule& rule = const_cast<Rule&>(*thisRule);
+    rule_ref rule = *thisRule;
 
     if(allRules.is_on()) {
       if(*bestRule < rule) {
@@ -742,7 +743,7 @@ const Rule &getBestRule(void )
 	static bit_vector seen;
 	for(word_index_class::iterator it = thisIndex.begin(least_frequent); !(it == endp) ; ++it) {
 	  int i = (*it).line_id(); 
-	  wordType2D& line = corpus[i];
+	  wordType2D line = corpus[i];
 
 	  if(i!=last_i) {
 	    seen.clear();
@@ -773,7 +774,7 @@ const Rule &getBestRule(void )
 	// For each sentence
 	for (int i = 0; i < (int)corpus.size() && currentScore >= bestScore; i++) {
 	  // For each word in the sentence
-	  wordType2D& line = corpus[i];
+	  wordType2D line = corpus[i];
 	  int last_index = line.size() - PredicateTemplate::MaxForwardLookup;
 	  for (int j=-PredicateTemplate::MaxBackwardLookup ; 
 	       j < last_index && rule.good-rule.bad >= bestScore; 
@@ -823,7 +824,7 @@ void applyBestRule (const Rule &bestRule)
     best_rule_target[*itt] = bestRule.target.vals[t];
 
   if(allRules.is_on()) {
-    rulep_hash_set pRules;
+    rule_id_set pRules;
     // For each position that needs to be updated
     // we need to update the goods and bads for all 
     // the rules that might apply in the context.
@@ -863,6 +864,7 @@ void applyBestRule (const Rule &bestRule)
 
     // One more step is needed here. We need to copy the current index before we iterate on it, because
     // it will change in the case of classification indices, resulting in incorrect behavior.
+    // (the copy of a classification index only shares its data, until the index is changed)
 
     word_index_class index(thisIndex.get_type());
     index.copy_data_field(thisIndex, least_frequent);
@@ -946,7 +948,7 @@ void applyBestRule (const Rule &bestRule)
 	  createRulesForExample(i, k, placesToChange, pRules, modified_states, !sample_is_completely_incorrect(corpus[i][k]));
 
 	  for(int k1=0 ; k1<corpus[i].size() ; k1++)
-	    copy(corpus[i][k1], corpus[i][k1]+feature_set_size, old_corpus[k1].begin());
+	    corpus[i][k1].copy(0, feature_set_size, old_corpus[k1].begin());
 
 	  // Now, pRules contain the rules that applied in the old state
 	  int pp=0;
@@ -974,8 +976,8 @@ void applyBestRule (const Rule &bestRule)
 	    For simplicity, the constraint is part of the predicate.
 	  */		  
 
-	  for(rulep_hash_set::iterator rl=pRules.begin() ; rl!=pRules.end() ; ++rl) {
-	    Rule& rule1 = const_cast<Rule&>(**rl);
+	  for(rule_id_set::iterator rl=pRules.begin() ; rl!=pRules.end() ; ++rl) {
+	    rule_ref rule1 = allRules[*rl];
 	    TargetTemplate::pos_vector& poss = TargetTemplate::Templates[rule1.target.tid].positions;
 	    if(! rule1.predicate.test(corpus[i], k) || !rule1.constraint_test(corpus[i][k])) { // r_p(b(s)) == false
 	      int pp = 0;
@@ -1028,7 +1030,7 @@ void applyBestRule (const Rule &bestRule)
 	  createRulesForExample(i, k, placesToChange, pRules, modified_states, !sample_is_completely_incorrect(corpus[i][k]), true);
 
 	  for(int k1=0 ; k1<corpus[i].size() ; k1++)
-	    copy(corpus[i][k1], corpus[i][k1]+feature_set_size, old_corpus[k1].begin());
+	    corpus[i][k1].copy(0, feature_set_size, old_corpus[k1].begin());
 		  
 	  // pRules contains now all the rules that apply in the new state
 	  pp = 0;
@@ -1045,8 +1047,8 @@ void applyBestRule (const Rule &bestRule)
 	  }
 	  // corpus is now in its original condition
 
-	  for(rulep_hash_set::iterator rl=pRules.begin() ; rl!=pRules.end() ; ++rl) {
-	    Rule& rule1 = const_cast<Rule&>(**rl);
+	  for(rule_id_set::iterator rl=pRules.begin() ; rl!=pRules.end() ; ++rl) {
+	    rule_ref rule1 = allRules[*rl];
 	    TargetTemplate::pos_vector& poss = TargetTemplate::Templates[rule1.target.tid].positions;
 	    if(! rule1.predicate.test(corpus[i], k)|| !rule1.constraint_test(corpus[i][k])) { // r_p(b(s)) == false
 	      int pp = 0;
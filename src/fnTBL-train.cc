@@ -35,6 +35,10 @@
 #endif /* __GNUG__ */
 #include <stdlib.h>
 #include <sys/timeb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sstream>
 
 #include "typedef.h"
 #include "TBLTree.h"
@@ -51,6 +55,10 @@
 #include "PrefixSuffixAddPredicate.h"
 #include "ContainsStringPredicate.h"
 #include "Target.h"
+#include "threads.h"
+#include "rule_heap.h"
+#include "telemetry.h"
+#include "rule_batch.h"
 #include <unistd.h>
 #include <hash_wrapper.h>
 
@@ -59,18 +67,20 @@ using namespace HASH_NAMESPACE;
 
 typedef PredicateTemplate::PredicateTemplate_vector PredicateTemplate_vector;
 typedef hash_set<Rule> rule_hash_set;
-typedef hash_set<Rule*> rulep_hash_set;
+typedef hash_set<rule_id> rule_id_set;
 typedef vector<pair<int, int> > position_vector;
 typedef vector<Rule> rule_vector;
-typedef vector<Rule*> rulep_vector;
 typedef word_index<unsigned int, unsigned short> word_index_class;
+typedef hash_map<rule_id, scoreType> rule_count_map;
 
 wordType3D corpus;
 wordType3DVector ruleTrace;
 featureIndexType2D ruleTemplates;
 vector<scoreType> costs;
 rule_hash allRules;
-rule_hash_set newRules;
+// In fast mode, keeps the rules in allRules ordered by score.
+rule_heap bestRules(allRules);
+rule_hash newRules;
 rule_vector chosen_rules;
 
 word_index_class corpusIndex;
@@ -92,7 +102,15 @@ int erase_rule_factor = -1;
 int corpus_size;
 int best_rule_index = 0;
 
+// The number of threads used to compute the initial rule counts.
+int num_threads = 1;
+
 position_vector best_rule_applic_places;
+
+// The per-iteration trace (-trace); the statistics of the current iteration
+// are collected only if it is on.
+bool trace_iterations = false;
+iteration_stats iteration;
 typedef vector<featureIndexType> feature_vector;
 wordType UNK;
 
@@ -130,10 +148,9 @@ struct comp {
 struct wordType1DHash {
   size_t operator() (const wordType1D& p) const {
     static int no_features = PredicateTemplate::name_map.size()+TargetTemplate::name_map.size();
-    size_t ind = *p;
-    wordType* l=p;
-    for(int i=1 ; i<no_features ; i++, ++l)
-      ind = 7*ind + *l;
+    size_t ind = p[0];
+    for(int i=1 ; i<no_features ; i++)
+      ind = 7*ind + p[i-1];
 
     return ind;
   }
@@ -142,7 +159,10 @@ struct wordType1DHash {
 struct wordType1D_equal {
   bool operator() (const wordType1D& p1, const wordType1D& p2) {
     static int no_features = PredicateTemplate::name_map.size()+TargetTemplate::name_map.size();
-    return equal(p1, p1+no_features, p2);
+    for(int i=0 ; i<no_features ; i++)
+      if(p1[i] != p2[i])
+	return false;
+    return true;
   }
 };
 
@@ -161,16 +181,19 @@ void initializeDefaultCosts ( int lines ) {
 
     static int no_features = PredicateTemplate::name_map.size()+TargetTemplate::name_map.size();
     wordType3D corpus1(samples.size());
+    corpus1.set_sample_width(corpus.sample_width());
+    corpus1.reserve(samples.size());
     costs.resize(samples.size());
 
     int k=0;
     for(hash_map<wordType1D, int, wordType1DHash, wordType1D_equal>::iterator i=samples.begin() ; i!=samples.end() ; ++i, ++k) {
-      corpus1[k].resize(1);
-      corpus1[k][0] = new wordType [no_features];
-      copy(i->first, i->first+no_features, corpus1[k][0]);
+      corpus1.resize_sentence(k, 1);
+      for(int f=0 ; f<no_features ; f++)
+	corpus1[k][0][f] = i->first[f];
       costs[k] = i->second;
     }
     corpus.swap(corpus1);
+    corpus.set_layout(corpus1.layout());
     if(v_flag)
       cerr << "there are " << corpus.size() << " samples in the end" << endl;
 
@@ -181,9 +204,6 @@ void initializeDefaultCosts ( int lines ) {
       ofstream ff(collapsed_file.c_str());
       printCorpusState(ff);
     }
-      
-    for(int i=0 ; i<corpus1.size() ; i++)
-      delete [] corpus1[i][0];
   }
   else {
     costs.resize(lines);
@@ -195,18 +215,19 @@ void initializeDefaultCosts ( int lines ) {
 
 // Called to insert a "good" rule into the rule hash. Also updates the good/bad counts for the 
 // rule with the actual values
-void insertRulesIntoHash(int line, int word, rule_hash_set &ruleSet, bool check_first = false)
+template <class rule_table>
+void insertRulesIntoHash(int line, int word, rule_hash_set &ruleSet, rule_table& table, bool check_first = false)
 {
   for (rule_hash_set::iterator rule = ruleSet.begin(); 
        rule != ruleSet.end(); ++rule) {
 
-    rule_hash::iterator thisRule;
-    if(check_first) { // We compute goods here only for the rules that are in allRules already
-      thisRule = allRules.find(*rule);
-      if(thisRule == allRules.end())
+    typename rule_table::iterator thisRule;
+    if(check_first) { // We compute goods here only for the rules that are in the table already
+      thisRule = table.find(*rule);
+      if(thisRule == table.end())
 	continue;
     } else
-      thisRule = allRules.insert(*rule).first;
+      thisRule = table.insert(*rule).first;
 
     thisRule->update_counts(corpus[line][word], costs[line]);
 
@@ -215,16 +236,67 @@ void insertRulesIntoHash(int line, int word, rule_hash_set &ruleSet, bool check_
   }
 }
 
-// this function computes the good and bad for this particular rule
-void computeScoreForRule(Rule& rule) {
-  if(force_compute)
+void insertRulesIntoHash(int line, int word, rule_hash_set &ruleSet, bool check_first = false)
+{
+  insertRulesIntoHash(line, word, ruleSet, allRules, check_first);
+}
+
+// Updates the counts of the rule with the positions of the batch on which it
+// applies.
+static void scoreRuleBatch(const rule_ref& rule, rule_batch& batch, position_vector* places) {
+  const rule_batch::position_vector& matches = batch.evaluate();
+  for(rule_batch::position_vector::const_iterator p=matches.begin() ; p!=matches.end() ; ++p) {
+    rule.update_counts(corpus[p->first][p->second], costs[p->first]);
+    if(places)
+      places->push_back(*p);
+  }
+}
+
+// Same as scoreRuleBatch, for the rules whose good counts are known: adds
+// the bad counts of the positions of the batch to the rule, and the positions
+// to places. Stops (and returns false) as soon as the score of the rule
+// falls under bound.
+static bool boundRuleBatch(const rule_ref& rule, rule_batch& batch, scoreType bound, position_vector& places) {
+  const rule_batch::position_vector& matches = batch.evaluate();
+  for(rule_batch::position_vector::const_iterator p=matches.begin() ; p!=matches.end() ; ++p) {
+    if(rule.good-rule.bad < bound)
+      return false;
+    places.push_back(*p);
+    rule.update_bad_counts(corpus[p->first][p->second], costs[p->first]);
+  }
+  return rule.good-rule.bad >= bound;
+}
+
+// this function computes the good and bad for this particular rule; if places
+// is given, the samples on which the rule applies are added to it.
+void computeScoreForRule(const rule_ref& rule, position_vector* places = 0) {
+  static THREAD_LOCAL rule_batch batch(corpus);
+  batch.set_rule(rule);
+  int first, second;
+  relativePosType d1, d2;
+
+  if(force_compute) {
     for (int i = 0; i < (int)corpus.size(); i++) {  
       int numWords = (int)corpus[i].size() - PredicateTemplate::MaxForwardLookup;
-      for (int j = -PredicateTemplate::MaxBackwardLookup; j < numWords; j++) {
-	if(rule.test(corpus[i], j))
-	  rule.update_counts(corpus[i][j], costs[i]);
+      batch.add_range(i, -PredicateTemplate::MaxBackwardLookup, numWords);
+      if(batch.full())
+	scoreRuleBatch(rule, batch, places);
+    }
+    scoreRuleBatch(rule, batch, places);
+  }
+  else if(rule.get_intersection_features(first, d1, second, d2)) {
+    // Only the positions where the two least frequent features both appear are tested.
+    for(posting_intersection p(corpusIndex.postings(rule.predicate.tokens[first]), d1,
+			       corpusIndex.postings(rule.predicate.tokens[second]), d2) ; ! p.done() ; p.next()) {
+      int i = p.line_id(), j = p.word_id();
+      if (j>=-PredicateTemplate::MaxBackwardLookup && j<corpus[i].size()-PredicateTemplate::MaxForwardLookup) {
+	batch.add(i, j);
+	if(batch.full())
+	  scoreRuleBatch(rule, batch, places);
       }
     }
+    scoreRuleBatch(rule, batch, places);
+  }
   else {
     int i=rule.get_least_frequent_feature_position();
     bool unindexable_rule = false;
@@ -236,7 +308,7 @@ void computeScoreForRule(Rule& rule) {
 
     wordType least_frequent = rule.predicate.tokens[i];
 
-    static AtomicPredicate::storage_vector features;
+    static THREAD_LOCAL AtomicPredicate::storage_vector features;
     features.clear();
     PredicateTemplate::Templates[rule.predicate.template_id][i].get_feature_ids(features);
 
@@ -251,7 +323,7 @@ void computeScoreForRule(Rule& rule) {
        corpusIndex
        );
 
-    static AtomicPredicate::position_vector offsets;
+    static THREAD_LOCAL AtomicPredicate::position_vector offsets;
     offsets.clear();
 
     if(unindexable_rule)
@@ -280,11 +352,13 @@ void computeScoreForRule(Rule& rule) {
 	  if(seen[j])
 	    continue;
 	  seen[j] = true;
-	  if(rule.test(corpus[i], j))
-	    rule.update_counts(corpus[i][j], costs[i]);
+	  batch.add(i, j);
+	  if(batch.full())
+	    scoreRuleBatch(rule, batch, places);
 	}
       }
     }
+    scoreRuleBatch(rule, batch, places);
   }
 }
 
@@ -299,13 +373,17 @@ void createRulesForExample(int line, int word, rule_hash_set &ruleSet, bool retu
   }
 }
 
-void createRulesForExample(int line, int word, const int1D& modified_positions, rulep_hash_set& pRules,
-			   feature_vector& modified_states, bool returnAllRules = false, bool add_new_rules = false) {
+// The rules that are not yet in allRules are added to new_rules; their counts are
+// computed right away, unless score_new_rules is false (the parallel update scores
+// them after all the sentences have been changed).
+void createRulesForExample(int line, int word, const int1D& modified_positions, rule_id_set& pRules,
+			   feature_vector& modified_states, bool returnAllRules = false, bool add_new_rules = false,
+			   rule_hash& new_rules = newRules, bool score_new_rules = true) {
   // If the special function is turned on, then return all the rules
   // whose predicate is true on the specific example.
   ON_DEBUG(assert(allRules.is_on()));
 
-  static int1D relevant;
+  static THREAD_LOCAL int1D relevant;
   relevant.clear();
 
   for(int1D::const_iterator i=modified_positions.begin() ; i!=modified_positions.end() ; ++i)
@@ -322,8 +400,8 @@ void createRulesForExample(int line, int word, const int1D& modified_positions,
   int t=0;
 
   bool position_is_modified = (find(relevant.begin(), relevant.end(), word) != relevant.end());
-  static rule_hash_set rlss;
-  static wordType2DVector tk;
+  static THREAD_LOCAL rule_hash_set rlss;
+  static THREAD_LOCAL wordType2DVector tk;
 
   if(returnAllRules) {
     for (PredicateTemplate_vector::const_iterator thisTemplate=PredicateTemplate::Templates.begin();
@@ -347,7 +425,7 @@ void createRulesForExample(int line, int word, const int1D& modified_positions,
 	rule_hash_const_iterator rlend = allRules.pend(p);
 	for(rule_hash_const_iterator rl = allRules.pbegin(p) ; rl!=rlend ; ++rl, ++no_rls)
 	  if((*rl).constraint_test(corpus[line][word]))
-	    pRules.insert(&const_cast<Rule&>(*rl));
+	    pRules.insert(rl.id());
 
       }
 
@@ -356,7 +434,7 @@ void createRulesForExample(int line, int word, const int1D& modified_positions,
 	RuleTemplate::instantiate(corpus[line], word, t, rlss);
 
 	for(rule_hash_set::iterator rl=rlss.begin() ; rl!=rlss.end() ; ++rl) {
-	  Rule& rule = const_cast<Rule&>(*rl);
+	  const Rule& rule = *rl;
 
 	  if(! rule.constraint_test(corpus[line][word]))
 	    continue;
@@ -367,13 +445,13 @@ void createRulesForExample(int line, int word, const int1D& modified_positions,
 	    if(! add_new_rules || sample_is_completely_correct(corpus[line][word]))
 	      continue;
 			
-	    pair<rule_hash_set::iterator, bool> p = newRules.insert(rule);
-	    if(! p.second)
+	    pair<rule_hash::iterator, bool> p = new_rules.insert(rule);
+	    if(! p.second || ! score_new_rules)
 	      continue;
-	    it = p.first;
-	    computeScoreForRule(const_cast<Rule&>(*it));
+	    rule_ref new_rule = *p.first;
+	    computeScoreForRule(new_rule);
 	    if(V_flag >= 2)
-	      cerr << "Added new rule: " << it->printMe() << " good: " << it->good << " bad: " << it->bad << endl;
+	      cerr << "Added new rule: " << new_rule.printMe() << " good: " << new_rule.good << " bad: " << new_rule.bad << endl;
 	  }
 	}
       }
@@ -395,22 +473,22 @@ void createRulesForExample(int line, int word, const int1D& modified_positions,
       RuleTemplate::instantiate(corpus[line], word, t, rlss);
 
       for(rule_hash_set::iterator rl=rlss.begin() ; rl!=rlss.end() ; ++rl) {
-	Rule& rule = const_cast<Rule&>(*rl);
+	const Rule& rule = *rl;
 	if(! rule.constraint_test(corpus[line][word]))
 	  continue;
 	rule_hash::iterator it = allRules.find(rule);
 	if(it == allRules.end()) {
-	  pair<rule_hash_set::iterator, bool> p = newRules.insert(rule);
-	  if(! p.second)
+	  pair<rule_hash::iterator, bool> p = new_rules.insert(rule);
+	  if(! p.second || ! score_new_rules)
 	    continue;
-	  it = p.first;
-	  computeScoreForRule(const_cast<Rule&>(*it));
+	  rule_ref new_rule = *p.first;
+	  computeScoreForRule(new_rule);
 	  if(V_flag >= 2)
-	    cerr << "Added new rule: " << it->printMe() << " good: " << it->good << " bad: " << it->bad << endl;
+	    cerr << "Added new rule: " << new_rule.printMe() << " good: " << new_rule.good << " bad: " << new_rule.bad << endl;
 	  // Since the rule has the score computed correctly for this sentence
 	  // there is no need to add it to the list of rules that need updating
 	} else
-	  pRules.insert(&const_cast<Rule&>(*it));
+	  pRules.insert(it.id());
       }
     }
   }
@@ -457,20 +535,135 @@ void eliminateRules() {
   }
   if(v_flag)
     cerr << "Will eliminate " << rules_to_eliminate.size() << " rules, out of " << allRules.size() << "." << endl;
-  for(rule_hash_set::iterator i=rules_to_eliminate.begin() ; i!=rules_to_eliminate.end() ; ++i)
-    allRules.erase(allRules.find(*i));
+  for(rule_hash_set::iterator i=rules_to_eliminate.begin() ; i!=rules_to_eliminate.end() ; ++i) {
+    rule_hash::iterator rule = allRules.find(*i);
+    bestRules.erase(*rule);
+    allRules.erase(rule);
+  }
 
   if(v_flag)
     cerr << "There are " << allRules.size() << " remaining rules." << endl;
 }
 
+// Computes, for the sentences handed out by the queue, the good counts of
+// the rules generated on the incorrect samples. Each thread stores the rules
+// in its own table; the tables are merged in allRules afterwards.
+struct good_count_job {
+  work_queue& queue;
+  vector<rule_hash_set>& tables;
+
+  good_count_job(work_queue& q, vector<rule_hash_set>& t): queue(q), tables(t) {}
+
+  void operator() (int id) {
+    rule_hash_set ruleSet;
+    int begin, end;
+    while(queue.get(begin, end))
+      for (int i = begin; i < end; i++) {
+	int numWords = (int)corpus[i].size()-PredicateTemplate::MaxForwardLookup;
+	for (int j = -PredicateTemplate::MaxBackwardLookup; j < numWords; j++) {
+	  if(sample_is_completely_correct(corpus[i][j])) continue;
+
+	  ruleSet.clear();
+	  createRulesForExample(i, j, ruleSet);
+	  insertRulesIntoHash(i, j, ruleSet, tables[id]);
+	}
+      }
+  }
+};
+
+// Computes the bad counts of the rules in allRules for the sentences handed
+// out by the queue. allRules is only read here - the counts are accumulated
+// in a per-thread map and added to the rules afterwards.
+struct bad_count_job {
+  work_queue& queue;
+  vector<rule_count_map>& bads;
+  feature_vector& ftrs;
+
+  bad_count_job(work_queue& q, vector<rule_count_map>& b, feature_vector& f): queue(q), bads(b), ftrs(f) {}
+
+  void operator() (int id) {
+    rule_id_set pRules;
+    int1D pos(1);
+    rule_count_map& counts = bads[id];
+    int begin, end;
+    while(queue.get(begin, end))
+      for (int i = begin; i < end; i++) {
+	int numWords = (int)corpus[i].size()-PredicateTemplate::MaxForwardLookup;
+	for (int j = -PredicateTemplate::MaxBackwardLookup; j < numWords; j++) {
+	  if(sample_is_completely_incorrect(corpus[i][j])) continue;
+
+	  pRules.clear();
+	  pos[0] = j;
+	  createRulesForExample(i, j, pos, pRules, ftrs, true);
+
+	  for(rule_id_set::iterator rl = pRules.begin() ; rl!=pRules.end() ; rl++)
+	    allRules[*rl].target.update_bad_counts(corpus[i][j], costs[i], counts[*rl]);
+	}
+      }
+  }
+};
+
+// The multi-threaded version of computeScoreForAllRules. The counts are sums
+// over samples, so the result does not depend on the way the sentences are
+// split between the threads.
+void computeScoreForAllRulesInParallel() {
+  if(v_flag)
+    cerr << "Computing good counts (" << num_threads << " threads)" << endl;
+
+  {
+    vector<rule_hash_set> tables(num_threads);
+    work_queue queue(corpus.size());
+    good_count_job job(queue, tables);
+    run_in_threads(job, num_threads);
+
+    for(int t=0 ; t<num_threads ; t++) {
+      for(rule_hash_set::iterator rl=tables[t].begin() ; rl!=tables[t].end() ; ++rl) {
+	pair<rule_hash::iterator, bool> p = allRules.insert(*rl);
+	if(! p.second) {
+	  p.first->good += rl->good;
+	  p.first->bad += rl->bad;
+	}
+      }
+      rule_hash_set tmp;
+      tables[t].swap(tmp);
+    }
+  }
+
+  if(v_flag)
+    cerr << "Computing the bad counts" << endl;
+  feature_vector ftrs(TargetTemplate::TRUTH_SIZE);
+  for(int k=0 ; k<ftrs.size() ; ++k)
+    ftrs[k] = TargetTemplate::TRUTH_START+k;
+
+  vector<rule_count_map> bads(num_threads);
+  work_queue queue(corpus.size());
+  bad_count_job job(queue, bads, ftrs);
+  run_in_threads(job, num_threads);
+
+  for(int t=0 ; t<num_threads ; t++)
+    for(rule_count_map::iterator it=bads[t].begin() ; it!=bads[t].end() ; ++it)
+      allRules[it->first].bad += it->second;
+
+  if(v_flag)
+    cerr << "DONE" << endl;
+}
+
 // This is called once, when the switch in the computation has
 // been decided (by default, at the beginning).
 void computeScoreForAllRules() {
+  bestRules.clear();
   allRules.clear();
   
+  // The rule elimination done with -I depends on the order in which the
+  // sentences are processed, so it is only available single-threaded.
+  if(num_threads > 1 && I_flag == 0) {
+    computeScoreForAllRulesInParallel();
+    bestRules.build(allRules.begin(), allRules.end());
+    return;
+  }
+
   rule_hash_set ruleSet;
-  rulep_hash_set pRules;
+  rule_id_set pRules;
   
   ticker tk("Sentences processed: ", 1024);
   if(v_flag)
@@ -555,12 +748,13 @@ void computeScoreForAllRules() {
       if(V_flag >= 3)
 	cerr << "Position " << i << ", " << j << " has " << pRules.size() << " rules attached" << endl;
 
-      for(rulep_hash_set::iterator rl = pRules.begin() ; rl!=pRules.end() ; rl++)
-	(*rl)->update_bad_counts(corpus[i][j], costs[i]);
+      for(rule_id_set::iterator rl = pRules.begin() ; rl!=pRules.end() ; rl++)
+	allRules[*rl].update_bad_counts(corpus[i][j], costs[i]);
     }
     tk.tick();
   }
   tk.clear();
+  bestRules.build(allRules.begin(), allRules.end());
   if(v_flag)
     cerr << "DONE" << endl;
 }
@@ -625,7 +819,7 @@ void AddSemiGoodRules(ostream* rules) {
 }
 
 // This function gets the bad and good counts of the rules
-const Rule &getBestRule(void )
+rule_ref getBestRule(void )
 {
   best_rule_applic_places.clear();
   static position_vector temp_pos;
@@ -636,14 +830,20 @@ const Rule &getBestRule(void )
 
   if(v_flag)
     cerr << "There are " << allRules.size() << " rules at iteration " << iter << "." << endl;
-  rule_hash_set::iterator bestRule = allRules.begin();
+
+  // In fast mode the counts are kept up to date, and so is the heap.
+  if(allRules.is_on() && ! bestRules.empty())
+    return bestRules.top();
+
+  rule_hash::iterator bestRule = allRules.begin();
   scoreType bestScore = (scoreType)-1000.0;
+  static rule_batch batch(corpus);
 
   int iteration=0;
   bool start = true;
-  for (rule_hash_set::iterator thisRule = allRules.begin();
+  for (rule_hash::iterator thisRule = allRules.begin();
        thisRule != allRules.end(); ++thisRule, ++iteration) {
-    Rule& rule = const_cast<Rule&>(*thisRule);
+    rule_ref rule = *thisRule;
 
     if(allRules.is_on()) {
       if(*bestRule < rule) {
@@ -657,7 +857,22 @@ const Rule &getBestRule(void )
       if(!start && !rule.better(*bestRule, currentScore))
 	continue;
 
-      if(i_flag) {
+      int first, second;
+      relativePosType d1, d2;
+      if(i_flag && rule.get_intersection_features(first, d1, second, d2)) {
+	batch.set_rule(rule);
+	for(posting_intersection p(corpusIndex.postings(rule.predicate.tokens[first]), d1,
+				   corpusIndex.postings(rule.predicate.tokens[second]), d2) ; ! p.done() ; p.next()) {
+	  int i = p.line_id(), j = p.word_id();
+	  if(-PredicateTemplate::MaxBackwardLookup <= j && j < corpus[i].size()-PredicateTemplate::MaxForwardLookup) {
+	    batch.add(i, j);
+	    if(batch.full() && ! boundRuleBatch(rule, batch, bestScore, temp_pos))
+	      break;
+	  }
+	}
+	boundRuleBatch(rule, batch, bestScore, temp_pos);
+      }
+      else if(i_flag) {
 	int i=rule.get_least_frequent_feature_position();
 	bool unindexable_rule = false;
 		
@@ -694,9 +909,10 @@ const Rule &getBestRule(void )
 	word_index_class::iterator endp = thisIndex.end(least_frequent);
 	int last_i = -1;
 	static bit_vector seen;
+	batch.set_rule(rule);
 	for(word_index_class::iterator it = thisIndex.begin(least_frequent); !(it == endp) ; ++it) {
 	  int i = (*it).line_id(); 
-	  wordType2D& line = corpus[i];
+	  wordType2D line = corpus[i];
 
 	  if(i!=last_i) {
 	    seen.clear();
@@ -710,35 +926,26 @@ const Rule &getBestRule(void )
 	    wordType j = (*it).word_id() - offset;
 	    if(-PredicateTemplate::MaxBackwardLookup<=j &&
 	       j < line.size()-PredicateTemplate::MaxForwardLookup &&
-	       rule.test(line, j)) {
-	      if(seen[j])
-		continue;
-
+	       ! seen[j]) {
 	      seen[j] = true;
-	      temp_pos.push_back(pair<int, int>(i, j));
-	      rule.update_bad_counts(line[j], costs[i]);
+	      batch.add(i, j);
 	    }
 	  }
-	  if(rule.good-rule.bad < bestScore)
+	  if(batch.full() && ! boundRuleBatch(rule, batch, bestScore, temp_pos))
 	    break;
 	}
+	boundRuleBatch(rule, batch, bestScore, temp_pos);
       }
       else {
+	batch.set_rule(rule);
 	// For each sentence
-	for (int i = 0; i < (int)corpus.size() && currentScore >= bestScore; i++) {
+	for (int i = 0; i < (int)corpus.size() && rule.good-rule.bad >= bestScore; i++) {
 	  // For each word in the sentence
-	  wordType2D& line = corpus[i];
-	  int last_index = line.size() - PredicateTemplate::MaxForwardLookup;
-	  for (int j=-PredicateTemplate::MaxBackwardLookup ; 
-	       j < last_index && rule.good-rule.bad >= bestScore; 
-	       j++) {
-
-	    // only the already-correct instances will bring down the scores.
-	    if(rule.test(line, j)) {
-	      temp_pos.push_back(pair<int, int>(i, j));
-	      rule.update_bad_counts(line[j], costs[i]);
-	    }
-	  }
+	  int last_index = corpus[i].size() - PredicateTemplate::MaxForwardLookup;
+	  batch.add_range(i, -PredicateTemplate::MaxBackwardLookup, last_index);
+
+	  // only the already-correct instances will bring down the scores.
+	  boundRuleBatch(rule, batch, bestScore, temp_pos);
 	}
       }
       currentScore = rule.good - rule.bad;
@@ -755,15 +962,546 @@ const Rule &getBestRule(void )
   return *bestRule;
 }
 
-// Now that we've got the best rule, we have to go ahead and update the corpus.
-void applyBestRule (const Rule &bestRule)
+// Sampled search (-sample n): instead of scoring all the rules at each
+// iteration, only the rules that correct n randomly chosen incorrect samples
+// are scored (exactly, through the index - see computeScoreForRule),
+// together with the best rules kept from the previous iterations (at most
+// working_set_size of them). With -sampleCheck k, the exact best rule is
+// also computed every k iterations, to see how much is lost by sampling.
+int sample_size = 0;
+int working_set_size = 0;
+int sample_check = 0;
+rule_vector working_set;
+
+struct sample_check_stats {
+  int checks, exact;
+  double ratio;
+  sample_check_stats(): checks(0), exact(0), ratio(0) {}
+} sample_stats;
+
+struct rule_greater {
+  bool operator() (const Rule& r1, const Rule& r2) const {
+    return r2 < r1;
+  }
+};
+
+// Chooses (at most) n of the incorrect samples at random.
+void sampleIncorrectPositions(int n, position_vector& positions) {
+  positions.clear();
+  int incorrect = 0;
+  for (int i = 0; i < (int)corpus.size(); i++) {  
+    int numWords = (int)corpus[i].size()-PredicateTemplate::MaxForwardLookup;
+    for (int j = -PredicateTemplate::MaxBackwardLookup; j < numWords; j++) {
+      if(sample_is_completely_correct(corpus[i][j])) continue;
+
+      // Reservoir sampling
+      if(positions.size() < n)
+	positions.push_back(make_pair(i, j));
+      else {
+	int k = rand() % (incorrect+1);
+	if(k < n)
+	  positions[k] = make_pair(i, j);
+      }
+      incorrect++;
+    }
+  }
+}
+
+// Computes, on the current state of the samples, the best rule found by the
+// exhaustive search of the -o mode (without changing best_rule_applic_places),
+// and compares it with the rule chosen by sampling.
+void checkSampledRule(const Rule& rule) {
+  position_vector places;
+  places.swap(best_rule_applic_places);
+  createNewRuleSet();
+  rule_ref exact = getBestRule();
+  scoreType 
+    exact_score = exact.good - exact.bad,
+    score = rule.good - rule.bad;
+  places.swap(best_rule_applic_places);
+
+  sample_stats.checks++;
+  if(exact == rule)
+    sample_stats.exact++;
+  sample_stats.ratio += exact_score > 0 ? static_cast<double>(score)/exact_score : 1;
+  cerr << "Sampled rule score: " << score << ", exact best score: " << exact_score
+       << (exact == rule ? " (same rule)" : "") << endl;
+  allRules.clear();
+}
+
+// Finds the best rule among the sampled ones; returns false if there are no
+// incorrect samples (or no rules to correct them) left.
+bool getSampledBestRule(Rule& best) {
+  static position_vector positions;
+  sampleIncorrectPositions(sample_size, positions);
+  if(positions.empty())
+    return false;
+
+  rule_hash_set candidates(working_set.begin(), working_set.end());
+  rule_hash_set ruleSet;
+  for(position_vector::iterator pos=positions.begin() ; pos!=positions.end() ; ++pos) {
+    ruleSet.clear();
+    createRulesForExample(pos->first, pos->second, ruleSet);
+    candidates.insert(ruleSet.begin(), ruleSet.end());
+  }
+
+  working_set.assign(candidates.begin(), candidates.end());
+  for(rule_vector::iterator rl=working_set.begin() ; rl!=working_set.end() ; ++rl) {
+    rl->good = rl->bad = 0;
+    computeScoreForRule(*rl);
+  }
+  sort(working_set.begin(), working_set.end(), rule_greater());
+  if(working_set.size() > working_set_size)
+    working_set.resize(working_set_size);
+  if(working_set.empty())
+    return false;
+
+  best = working_set[0];
+  best.good = best.bad = 0;
+  best_rule_applic_places.clear();
+  computeScoreForRule(best, &best_rule_applic_places);
+
+  if(v_flag)
+    cerr << "Scored " << candidates.size() << " rules from " << positions.size() << " samples." << endl;
+  if(sample_check > 0 && best_rule_index % sample_check == 0)
+    checkSampledRule(best);
+  return true;
+}
+
+// The count changes made while applying the best rule are either done
+// directly on the rules (serial_count_update), or collected by each thread
+// and merged after all the sentences were processed (parallel_count_update).
+struct serial_count_update {
+  iteration_stats stats;
+
+  void add(const rule_ref& rule, scoreType good, scoreType bad) {
+    rule.good += good;
+    rule.bad += bad;
+    bestRules.update(rule);
+  }
+
+  void swap_state(int i, int j, wordType& value, wordType& other) {
+    classifIndex.erase(value, i, j);
+    ::swap(value, other);
+    classifIndex.insert(value, i, j);
+    ON_DEBUG(assert(classifIndex.find(value, i, j) != classifIndex.end(value)));
+  }
+
+  void set_state(int i, int j, wordType& value, wordType new_value) {
+    classifIndex.erase(value, i, j);
+    value = new_value;
+    classifIndex.insert(value, i, j);
+  }
+
+  rule_hash& new_rules() {
+    return newRules;
+  }
+
+  bool score_new_rules() const {
+    return true;
+  }
+};
+
+struct state_change {
+  int line, word;
+  wordType old_value, new_value;
+};
+
+struct parallel_count_update {
+  typedef hash_map<rule_id, pair<scoreType, scoreType> > delta_map;
+
+  delta_map deltas;
+  rule_hash found_rules;
+  vector<state_change> changes;
+  iteration_stats stats;
+
+  void add(const rule_ref& rule, scoreType good, scoreType bad) {
+    pair<scoreType, scoreType>& delta = deltas[rule.id];
+    delta.first += good;
+    delta.second += bad;
+  }
+
+  // classifIndex is shared between the threads, so it is only updated
+  // in the merge step; nothing reads it while the sentences are processed.
+  void swap_state(int i, int j, wordType& value, wordType& other) {
+    ::swap(value, other);
+  }
+
+  void set_state(int i, int j, wordType& value, wordType new_value) {
+    state_change change = {i, j, value, new_value};
+    changes.push_back(change);
+    value = new_value;
+  }
+
+  rule_hash& new_rules() {
+    return found_rules;
+  }
+
+  bool score_new_rules() const {
+    return false;
+  }
+};
+
+// Applies bestRule on sentence i, at the positions that are obtained from the
+// index entries in words, and updates the counts of all the rules whose
+// applicability is changed by it.
+template <class count_update>
+void applyBestRuleOnSentence(const rule_ref& bestRule, int i, const int1D& words,
+			     const AtomicPredicate::position_vector& offsets,
+			     const wordTypeVector& best_rule_target,
+			     feature_vector& modified_states, count_update& update)
 {
-  static int1D placesToChange;
-  static wordType2DVector prevPositions;
-  bit_vector processed, changingPosition;
+  static THREAD_LOCAL int1D placesToChange;
+  static THREAD_LOCAL wordType2DVector prevPositions;
+  static THREAD_LOCAL wordType2DVector old_corpus;
+  static THREAD_LOCAL bit_vector processed, changingPosition;
+  static THREAD_LOCAL rule_id_set pRules;
   static int 
     STATE_START = TargetTemplate::STATE_START,
     TRUTH_START = TargetTemplate::TRUTH_START;
+  static int feature_set_size = RuleTemplate::name_map.size();
+
+  const TargetTemplate::pos_vector& best_rule_positions = TargetTemplate::Templates[bestRule.target.tid].positions;
+
+  placesToChange.clear();
+  changingPosition.clear();
+  processed.clear();
+  processed.resize(corpus[i].size());
+  changingPosition.resize(corpus[i].size());
+
+  int sz = corpus[i].size()-PredicateTemplate::MaxForwardLookup;
+  for(int1D::const_iterator w = words.begin() ; w != words.end() ; ++w)
+    for(AtomicPredicate::position_vector::const_iterator off = offsets.begin() ; off != offsets.end() ; ++off) {
+      relativePosType offset = *off;
+      int j = *w - offset;
+      if(j>=-PredicateTemplate::MaxBackwardLookup && j<sz && // j is inside the scope of change
+	 !changingPosition[j] &&
+	 bestRule.test(corpus[i], j)) {                      // and the best rule applies on sample corpus[i][j]
+	placesToChange.push_back(j);
+	changingPosition[j] = true;
+	ruleTrace[i][j].push_back(best_rule_index);
+      }
+    }
+
+  if(trace_iterations && ! placesToChange.empty()) {
+    update.stats.sentences++;
+    update.stats.positions += placesToChange.size();
+  }
+
+  prevPositions.resize(placesToChange.size());
+  for(wordType2DVector::iterator itt=prevPositions.begin() ; itt!=prevPositions.end() ; ++itt) {
+    itt->resize(TargetTemplate::TRUTH_SIZE);
+    copy(best_rule_target.begin(), best_rule_target.end(), itt->begin());
+  }
+
+  old_corpus.resize(corpus[i].size());
+  for(int j=0 ; j<corpus[i].size() ; j++)
+    old_corpus[j].resize(feature_set_size);
+
+  // For each positions that needs updating
+  for(int1D::iterator pos = placesToChange.begin() ; pos!=placesToChange.end() ; ++pos) {
+    wordType j = *pos;
+
+    if(V_flag >= 3) {
+      cerr << "Processing sentence " << i << ", word " << static_cast<int>(j) << " :" << endl;
+      cerr << "--------------------------------------------------------" << endl;
+    }
+
+    int min_pos = std::max(-PredicateTemplate::MaxBackwardLookup, 
+			   static_cast<int>(j+PredicateTemplate::MaxBackwardLookup)),
+      max_pos = std::min(static_cast<unsigned int>(corpus[i].size()-1-PredicateTemplate::MaxForwardLookup),
+			 static_cast<unsigned int>(j+PredicateTemplate::MaxForwardLookup));
+
+    for(int k=min_pos ; k<=max_pos ; ++k) {
+      if(processed[k]) // We have already processed the position
+	continue;
+
+      if(V_flag >= 3) {
+	cerr << "Processing inner word " << k << ":" << endl;
+	cerr << "***************************************" << endl;
+      }
+
+      pRules.clear();
+
+      double lap = trace_iterations ? telemetry_clock() : 0;
+      // Call createRulesForExample such that it does not add new rules
+      // The last parameter is true if at least one of the states has a correct value,
+      // in which case at least one rule will need to update its bad counts. 
+      createRulesForExample(i, k, placesToChange, pRules, modified_states, !sample_is_completely_incorrect(corpus[i][k]),
+			    false, update.new_rules(), update.score_new_rules());
+      if(trace_iterations)
+	telemetry_lap(lap, update.stats.generation_time);
+
+      for(int k1=0 ; k1<corpus[i].size() ; k1++)
+	corpus[i][k1].copy(0, feature_set_size, old_corpus[k1].begin());
+
+      // Now, pRules contain the rules that applied in the old state
+      int pp=0;
+      for(int1D::iterator p = placesToChange.begin() ; p!=placesToChange.end() ; ++p, ++pp) {
+	for(TargetTemplate::pos_vector::const_iterator tid = best_rule_positions.begin() ; 
+	    tid != best_rule_positions.end();
+	    ++tid)
+	  update.swap_state(i, *p, corpus[i][*p][STATE_START + *tid], prevPositions[pp][*tid]);
+      }
+
+      /*
+	Change the good and/or bad counts for the rules that got modified..
+	The conditions for updating the good/bad counts are:
+	1. r_p(b(s)) == false (s is the sample, r the variable rule1 from below and b the bestRule)
+	=> good(r) needs to be decreased by costs[i] * |{j | r_j(s)==truth_j(s) && s_j!=truth_j(s)}|
+	=> bad(r)  needs to be decreased by costs[i] * |{j | r_j(s)!=truth_j(s) && s_j==truth_j(s)}|
+	2. r_p(b(s)) == true (the rule s still applies to the sample)
+	=> good(r) needs to be decreased by costs[i] * |{j | r_j(s)==truth_j(s) && s_j!=truth_j(s) && b_j(s)==truth_j(s)}|
+	=> bad(r)  needs to be decreased by costs[i] * |{j | r_j(s)!=truth_j(s) && s_j==truth_j(s) && b_j(s)!=truth_j(s)}|
+	For simplicity, the constraint is part of the predicate.
+      */		  
+
+      for(rule_id_set::iterator rl=pRules.begin() ; rl!=pRules.end() ; ++rl) {
+	rule_ref rule1 = allRules[*rl];
+	TargetTemplate::pos_vector& poss = TargetTemplate::Templates[rule1.target.tid].positions;
+	if(! rule1.predicate.test(corpus[i], k) || !rule1.constraint_test(corpus[i][k])) { // r_p(b(s)) == false
+	  int pp = 0;
+	  for(TargetTemplate::pos_vector::const_iterator jj=poss.begin() ; jj!=poss.end() ; ++jj) {
+	    if(TargetTemplate::value_is_correct(rule1.target.vals[pp], old_corpus[k][TRUTH_START + *jj])) {
+	      if(! TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj])) {
+		update.add(rule1, -costs[i], 0);
+
+		if(V_flag>=3)
+		  cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- goods have been decreased" << endl;
+	      }
+	    } 
+	    else
+	      if(TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj])) {
+		update.add(rule1, 0, -costs[i]);
+					
+		if(V_flag>=3)
+		  cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- bads have been decreased" << endl;
+	      }
+	  }
+	}
+	else { // r_p(b(s)) == true
+	  int pp=0;
+	  for(TargetTemplate::pos_vector::const_iterator jj=poss.begin() ; jj!=poss.end(); ++jj, ++pp) {
+	    if(TargetTemplate::value_is_correct(rule1.target.vals[pp], old_corpus[k][TRUTH_START + *jj])) {
+	      if(! TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj]) && 
+		 TargetTemplate::value_is_correct( corpus[i][k][STATE_START + *jj],  corpus[i][k][TRUTH_START + *jj])) {
+		update.add(rule1, -costs[i], 0);
+					
+		if(V_flag>=3)
+		  cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- goods have been decreased" << endl;
+	      }
+	    }
+	    else
+	      if(TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj]) &&
+		 ! TargetTemplate::value_is_correct(corpus[i][k][STATE_START + *jj], corpus[i][k][TRUTH_START + *jj])) {
+		update.add(rule1, 0, -costs[i]);
+
+		if(V_flag>=3)
+		  cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- bads have been decreased" << endl;
+	      }
+	  }
+	}
+      }
+
+      // Create the rules that apply on the new state of the current sample
+      pRules.clear();
+      if(trace_iterations)
+	telemetry_lap(lap, update.stats.count_update_time);
+
+      // Call createRulesForExample such that it adds new rules
+      createRulesForExample(i, k, placesToChange, pRules, modified_states, !sample_is_completely_incorrect(corpus[i][k]), true,
+			    update.new_rules(), update.score_new_rules());
+      if(trace_iterations)
+	telemetry_lap(lap, update.stats.generation_time);
+
+      for(int k1=0 ; k1<corpus[i].size() ; k1++)
+	corpus[i][k1].copy(0, feature_set_size, old_corpus[k1].begin());
+		  
+      // pRules contains now all the rules that apply in the new state
+      pp = 0;
+      for(int1D::iterator p = placesToChange.begin() ; p!=placesToChange.end() ; ++p, ++pp) {
+	for(TargetTemplate::pos_vector::const_iterator tid = best_rule_positions.begin() ; 
+	    tid != best_rule_positions.end();
+	    ++tid)
+	  update.swap_state(i, *p, corpus[i][*p][STATE_START + *tid], prevPositions[pp][*tid]);
+      }
+      // corpus is now in its original condition
+
+      for(rule_id_set::iterator rl=pRules.begin() ; rl!=pRules.end() ; ++rl) {
+	rule_ref rule1 = allRules[*rl];
+	TargetTemplate::pos_vector& poss = TargetTemplate::Templates[rule1.target.tid].positions;
+	if(! rule1.predicate.test(corpus[i], k)|| !rule1.constraint_test(corpus[i][k])) { // r_p(b(s)) == false
+	  int pp = 0;
+	  for(TargetTemplate::pos_vector::const_iterator jj=poss.begin() ; jj!=poss.end(); ++jj, ++pp) {
+	    if(TargetTemplate::value_is_correct(rule1.target.vals[pp], old_corpus[k][TRUTH_START + *jj])) {
+	      if(! TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj])) {
+		update.add(rule1, costs[i], 0);
+
+		if(V_flag>=3)
+		  cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- goods have been increased" << endl;
+	      }
+	    } 
+	    else
+	      if(TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj])) {
+		update.add(rule1, 0, costs[i]);
+					
+		if(V_flag>=3)
+		  cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- bads have been increased" << endl;
+	      }
+	  }
+	}
+	else { // r_p(b(s)) == true
+	  int pp = 0;
+	  for(TargetTemplate::pos_vector::const_iterator jj=poss.begin() ; jj!=poss.end(); ++jj, ++pp) {
+	    if(TargetTemplate::value_is_correct(rule1.target.vals[pp], old_corpus[k][TRUTH_START + *jj])) {
+	      if(! TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj]) && 
+		 TargetTemplate::value_is_correct( corpus[i][k][STATE_START + *jj],  corpus[i][k][TRUTH_START + *jj])) {
+		update.add(rule1, costs[i], 0);
+					
+		if(V_flag>=3)
+		  cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- goods have been increased" << endl;
+	      }
+	    }
+	    else
+	      if(  TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj]) &&
+		   ! TargetTemplate::value_is_correct( corpus[i][k][STATE_START + *jj],  corpus[i][k][TRUTH_START + *jj])) {
+		update.add(rule1, 0, costs[i]);
+
+		if(V_flag>=3)
+		  cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- bads have been increased" << endl;
+	      }
+	  }
+	}
+      }
+      if(trace_iterations)
+	telemetry_lap(lap, update.stats.count_update_time);
+
+      processed[k] = true;
+    }
+  }
+
+  int pp = 0;
+  for(int1D::iterator p = placesToChange.begin() ; p!=placesToChange.end() ; ++p, ++pp) {
+    for(TargetTemplate::pos_vector::const_iterator tid = best_rule_positions.begin() ; 
+	tid != best_rule_positions.end();
+	++tid)
+      update.set_state(i, *p, corpus[i][*p][STATE_START + *tid], best_rule_target[*tid]);
+  }
+}
+
+// Processes the sentences affected by the best rule, handed out by the queue.
+struct sentence_update_job {
+  work_queue& queue;
+  const rule_ref& bestRule;
+  const int1D& lines;
+  const int2D& words;
+  const AtomicPredicate::position_vector& offsets;
+  const wordTypeVector& best_rule_target;
+  feature_vector& modified_states;
+  vector<parallel_count_update>& updates;
+
+  sentence_update_job(work_queue& q, const rule_ref& r, const int1D& l, const int2D& w,
+		      const AtomicPredicate::position_vector& o, const wordTypeVector& t,
+		      feature_vector& m, vector<parallel_count_update>& u):
+    queue(q), bestRule(r), lines(l), words(w), offsets(o), best_rule_target(t), modified_states(m), updates(u) {}
+
+  void operator() (int id) {
+    int begin, end;
+    while(queue.get(begin, end))
+      for(int n = begin ; n < end ; n++)
+	applyBestRuleOnSentence(bestRule, lines[n], words[n], offsets, best_rule_target, modified_states, updates[id]);
+  }
+};
+
+// Computes the counts of the rules that were generated during the parallel update.
+struct new_rule_score_job {
+  work_queue& queue;
+  rule_vector& rules;
+
+  new_rule_score_job(work_queue& q, rule_vector& r): queue(q), rules(r) {}
+
+  void operator() (int id) {
+    int begin, end;
+    while(queue.get(begin, end))
+      for(int n = begin ; n < end ; n++)
+	computeScoreForRule(rules[n]);
+  }
+};
+
+// The multi-threaded version of the fast update. The sentences are processed
+// concurrently; the changes to classifIndex and to the rule counts are
+// merged afterwards. The rules that did not exist before are scored at the
+// end, on the updated corpus, which yields the same counts as scoring them
+// when found and updating them on the sentences that follow.
+void applyBestRuleInParallel(const rule_ref& bestRule, word_index_class& thisIndex, wordType least_frequent,
+			     const AtomicPredicate::position_vector& offsets,
+			     const wordTypeVector& best_rule_target, feature_vector& modified_states)
+{
+  // The index does not change before the merge step, so it needs no copy here.
+  int1D lines;
+  int2D words;
+  word_index_class::iterator endp = thisIndex.end(least_frequent);
+  for(word_index_class::iterator it = thisIndex.begin(least_frequent); !(it == endp) ; ++it) {
+    int i = (*it).line_id();
+    if(lines.empty() || lines.back() != i) {
+      lines.push_back(i);
+      words.push_back(int1D());
+    }
+    words.back().push_back((*it).word_id());
+  }
+
+  vector<parallel_count_update> updates(num_threads);
+  {
+    work_queue queue(lines.size(), 16);
+    sentence_update_job job(queue, bestRule, lines, words, offsets, best_rule_target, modified_states, updates);
+    run_in_threads(job, num_threads);
+  }
+
+  rule_hash found;
+  for(int t=0 ; t<num_threads ; t++) {
+    parallel_count_update& update = updates[t];
+    for(vector<state_change>::iterator c=update.changes.begin() ; c!=update.changes.end() ; ++c) {
+      classifIndex.erase(c->old_value, c->line, c->word);
+      classifIndex.insert(c->new_value, c->line, c->word);
+    }
+
+    for(parallel_count_update::delta_map::iterator d=update.deltas.begin() ; d!=update.deltas.end() ; ++d) {
+      rule_ref rule = allRules[d->first];
+      rule.good += d->second.first;
+      rule.bad += d->second.second;
+      bestRules.update(rule);
+    }
+
+    for(rule_hash::iterator rl=update.found_rules.begin() ; rl!=update.found_rules.end() ; ++rl)
+      found.insert(*rl);
+    iteration.add(update.stats);
+  }
+  updates.clear();
+
+  rule_vector new_rules(found.begin(), found.end());
+  found.clear();
+  double start = trace_iterations ? telemetry_clock() : 0;
+  {
+    work_queue queue(new_rules.size(), 16);
+    new_rule_score_job job(queue, new_rules);
+    run_in_threads(job, num_threads);
+  }
+  if(trace_iterations)
+    telemetry_lap(start, iteration.generation_time);
+  iteration.rules_added += new_rules.size();
+
+  for(rule_vector::iterator rl=new_rules.begin() ; rl!=new_rules.end() ; ++rl) {
+    if(V_flag >= 2)
+      cerr << "Added new rule: " << rl->printMe() << " good: " << rl->good << " bad: " << rl->bad << endl;
+    bestRules.push(*allRules.insert(*rl).first);
+  }
+}
+
+// Now that we've got the best rule, we have to go ahead and update the corpus.
+void applyBestRule (const rule_ref& bestRule)
+{
+  static int 
+    STATE_START = TargetTemplate::STATE_START;
   
   int bestRuleTtid = bestRule.target.tid;
   static wordTypeVector best_rule_target(TargetTemplate::TRUTH_SIZE);
@@ -777,7 +1515,6 @@ void applyBestRule (const Rule &bestRule)
     best_rule_target[*itt] = bestRule.target.vals[t];
 
   if(allRules.is_on()) {
-    rulep_hash_set pRules;
     // For each position that needs to be updated
     // we need to update the goods and bads for all 
     // the rules that might apply in the context.
@@ -815,13 +1552,6 @@ void applyBestRule (const Rule &bestRule)
     else
       PredicateTemplate::Templates[bestRule.predicate.template_id][i].get_sample_differences(offsets);
 
-    // One more step is needed here. We need to copy the current index before we iterate on it, because
-    // it will change in the case of classification indices, resulting in incorrect behavior.
-
-    word_index_class index(thisIndex.get_type());
-    index.copy_data_field(thisIndex, least_frequent);
-    word_index_class::iterator endp = index.end(least_frequent);
-    static wordType2DVector old_corpus;
     static feature_vector modified_states;
 
     modified_states.resize(bestRule.target.vals.size());
@@ -830,252 +1560,52 @@ void applyBestRule (const Rule &bestRule)
 	itt != best_rule_positions.end() ; ++itt, ++ppp) 
       modified_states[ppp] = *itt + STATE_START;
 
-    for(word_index_class::iterator it = index.begin(least_frequent); !(it == endp) ;) {
-      int i = (*it).line_id();
-
-      newRules.clear();
-      placesToChange.clear();
-      changingPosition.clear();
-      processed.clear();
-      processed.resize(corpus[i].size());
-      changingPosition.resize(corpus[i].size());
-
-      int sz = corpus[i].size()-PredicateTemplate::MaxForwardLookup;
-      while (it!=endp && i == (*it).line_id()) {
-	for(AtomicPredicate::position_vector::iterator off = offsets.begin() ; off != offsets.end() ; ++off) {
-	  relativePosType offset = *off;
-	  int j = (*it).word_id() - offset;
-	  if(j>=-PredicateTemplate::MaxBackwardLookup && j<sz && // j is inside the scope of change
-	     !changingPosition[j] &&
-	     bestRule.test(corpus[i], j)) {                      // and the best rule applies on sample corpus[i][j]
-	    placesToChange.push_back(j);
-	    changingPosition[j] = true;
-	    ruleTrace[i][j].push_back(best_rule_index);
-	  }
-	}
-	++it;
-      }
-
-      prevPositions.resize(placesToChange.size());
-      for(wordType2DVector::iterator itt=prevPositions.begin() ; itt!=prevPositions.end() ; ++itt) {
-	itt->resize(TargetTemplate::TRUTH_SIZE);
-	copy(best_rule_target.begin(), best_rule_target.end(), itt->begin());
-      }
-
-      static int feature_set_size = RuleTemplate::name_map.size();
-
-      old_corpus.resize(corpus[i].size());
-      for(int j=0 ; j<corpus[i].size() ; j++)
-	old_corpus[j].resize(feature_set_size);
-
-      // For each positions that needs updating
-      for(int1D::iterator pos = placesToChange.begin() ; pos!=placesToChange.end() ; ++pos) {
-	wordType j = *pos;
-
-	if(V_flag >= 3) {
-	  cerr << "Processing sentence " << i << ", word " << static_cast<int>(j) << " :" << endl;
-	  cerr << "--------------------------------------------------------" << endl;
-	}
-
-	int min_pos = std::max(-PredicateTemplate::MaxBackwardLookup, 
-			       static_cast<int>(j+PredicateTemplate::MaxBackwardLookup)),
-	  max_pos = std::min(static_cast<unsigned int>(corpus[i].size()-1-PredicateTemplate::MaxForwardLookup),
-			     static_cast<unsigned int>(j+PredicateTemplate::MaxForwardLookup));
-
-	for(int k=min_pos ; k<=max_pos ; ++k) {
-	  if(processed[k]) // We have already processed the position
-	    continue;
-
-	  if(V_flag >= 3) {
-	    cerr << "Processing inner word " << k << ":" << endl;
-	    cerr << "***************************************" << endl;
-	  }
-
-
-	  pRules.clear();
-
-	  // Call createRulesForExample such that it does not add new rules
-	  // The last parameter is true if at least one of the states has a correct value,
-	  // in which case at least one rule will need to update its bad counts. 
-	  createRulesForExample(i, k, placesToChange, pRules, modified_states, !sample_is_completely_incorrect(corpus[i][k]));
-
-	  for(int k1=0 ; k1<corpus[i].size() ; k1++)
-	    copy(corpus[i][k1], corpus[i][k1]+feature_set_size, old_corpus[k1].begin());
-
-	  // Now, pRules contain the rules that applied in the old state
-	  int pp=0;
-	  for(int1D::iterator p = placesToChange.begin() ; p!=placesToChange.end() ; ++p, ++pp) {
-	    for(TargetTemplate::pos_vector::const_iterator tid = best_rule_positions.begin() ; 
-		tid != best_rule_positions.end();
-		++tid) {
-	      wordType& corpus_value = corpus[i][*p][STATE_START + *tid];
-	      classifIndex.erase(corpus_value, i, *p);
-	      ::swap(corpus_value, prevPositions[pp][*tid]);
-	      classifIndex.insert(corpus_value, i, *p);
-	      ON_DEBUG(assert(classifIndex.find(corpus_value, i, *p) != classifIndex.end(corpus_value)));
-	    }
-	  }
-
-	  /*
-	    Change the good and/or bad counts for the rules that got modified..
-	    The conditions for updating the good/bad counts are:
-	    1. r_p(b(s)) == false (s is the sample, r the variable rule1 from below and b the bestRule)
-	    => good(r) needs to be decreased by costs[i] * |{j | r_j(s)==truth_j(s) && s_j!=truth_j(s)}|
-	    => bad(r)  needs to be decreased by costs[i] * |{j | r_j(s)!=truth_j(s) && s_j==truth_j(s)}|
-	    2. r_p(b(s)) == true (the rule s still applies to the sample)
-	    => good(r) needs to be decreased by costs[i] * |{j | r_j(s)==truth_j(s) && s_j!=truth_j(s) && b_j(s)==truth_j(s)}|
-	    => bad(r)  needs to be decreased by costs[i] * |{j | r_j(s)!=truth_j(s) && s_j==truth_j(s) && b_j(s)!=truth_j(s)}|
-	    For simplicity, the constraint is part of the predicate.
-	  */		  
-
-	  for(rulep_hash_set::iterator rl=pRules.begin() ; rl!=pRules.end() ; ++rl) {
-	    Rule& rule1 = const_cast<Rule&>(**rl);
-	    TargetTemplate::pos_vector& poss = TargetTemplate::Templates[rule1.target.tid].positions;
-	    if(! rule1.predicate.test(corpus[i], k) || !rule1.constraint_test(corpus[i][k])) { // r_p(b(s)) == false
-	      int pp = 0;
-	      for(TargetTemplate::pos_vector::const_iterator jj=poss.begin() ; jj!=poss.end() ; ++jj) {
-		if(TargetTemplate::value_is_correct(rule1.target.vals[pp], old_corpus[k][TRUTH_START + *jj])) {
-		  if(! TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj])) {
-		    rule1.good -= costs[i];
-
-		    if(V_flag>=3)
-		      cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- goods have been decreased" << endl;
-		  }
-		} 
-		else
-		  if(TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj])) {
-		    rule1.bad -= costs[i];
-					
-		    if(V_flag>=3)
-		      cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- bads have been decreased" << endl;
-		  }
-	      }
-	    }
-	    else { // r_p(b(s)) == true
-	      int pp=0;
-	      for(TargetTemplate::pos_vector::const_iterator jj=poss.begin() ; jj!=poss.end(); ++jj, ++pp) {
-		if(TargetTemplate::value_is_correct(rule1.target.vals[pp], old_corpus[k][TRUTH_START + *jj])) {
-		  if(! TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj]) && 
-		     TargetTemplate::value_is_correct( corpus[i][k][STATE_START + *jj],  corpus[i][k][TRUTH_START + *jj])) {
-		    rule1.good -= costs[i];
-					
-		    if(V_flag>=3)
-		      cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- goods have been decreased" << endl;
-		  }
-		}
-		else
-		  if(TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj]) &&
-		     ! TargetTemplate::value_is_correct(corpus[i][k][STATE_START + *jj], corpus[i][k][TRUTH_START + *jj])) {
-		    rule1.bad -= costs[i];
-
-		    if(V_flag>=3)
-		      cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- bads have been decreased" << endl;
-		  }
-	      }
-	    }
-	  }
-
-	  // Create the rules that apply on the new state of the current sample
-	  pRules.clear();
-
-	  // Call createRulesForExample such that it adds new rules
-	  createRulesForExample(i, k, placesToChange, pRules, modified_states, !sample_is_completely_incorrect(corpus[i][k]), true);
-
-	  for(int k1=0 ; k1<corpus[i].size() ; k1++)
-	    copy(corpus[i][k1], corpus[i][k1]+feature_set_size, old_corpus[k1].begin());
-		  
-	  // pRules contains now all the rules that apply in the new state
-	  pp = 0;
-	  for(int1D::iterator p = placesToChange.begin() ; p!=placesToChange.end() ; ++p, ++pp) {
-	    for(TargetTemplate::pos_vector::const_iterator tid = best_rule_positions.begin() ; 
-		tid != best_rule_positions.end();
-		++tid) {
-	      wordType& corpus_value = corpus[i][*p][STATE_START + *tid];
-	      classifIndex.erase(corpus_value, i, *p);
-	      ::swap(corpus_value, prevPositions[pp][*tid]);
-	      classifIndex.insert(corpus_value, i, *p);
-	      ON_DEBUG(assert(classifIndex.find(corpus_value, i, *p) != classifIndex.end(corpus_value)));
-	    }
-	  }
-	  // corpus is now in its original condition
-
-	  for(rulep_hash_set::iterator rl=pRules.begin() ; rl!=pRules.end() ; ++rl) {
-	    Rule& rule1 = const_cast<Rule&>(**rl);
-	    TargetTemplate::pos_vector& poss = TargetTemplate::Templates[rule1.target.tid].positions;
-	    if(! rule1.predicate.test(corpus[i], k)|| !rule1.constraint_test(corpus[i][k])) { // r_p(b(s)) == false
-	      int pp = 0;
-	      for(TargetTemplate::pos_vector::const_iterator jj=poss.begin() ; jj!=poss.end(); ++jj, ++pp) {
-		if(TargetTemplate::value_is_correct(rule1.target.vals[pp], old_corpus[k][TRUTH_START + *jj])) {
-		  if(! TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj])) {
-		    rule1.good += costs[i];
-
-		    if(V_flag>=3)
-		      cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- goods have been increased" << endl;
-		  }
-		} 
-		else
-		  if(TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj])) {
-		    rule1.bad += costs[i];
-					
-		    if(V_flag>=3)
-		      cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- bads have been increased" << endl;
-		  }
-	      }
-	    }
-	    else { // r_p(b(s)) == true
-	      int pp = 0;
-	      for(TargetTemplate::pos_vector::const_iterator jj=poss.begin() ; jj!=poss.end(); ++jj, ++pp) {
-		if(TargetTemplate::value_is_correct(rule1.target.vals[pp], old_corpus[k][TRUTH_START + *jj])) {
-		  if(! TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj]) && 
-		     TargetTemplate::value_is_correct( corpus[i][k][STATE_START + *jj],  corpus[i][k][TRUTH_START + *jj])) {
-		    rule1.good += costs[i];
-					
-		    if(V_flag>=3)
-		      cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- goods have been increased" << endl;
-		  }
-		}
-		else
-		  if(  TargetTemplate::value_is_correct(old_corpus[k][STATE_START + *jj], old_corpus[k][TRUTH_START + *jj]) &&
-		       ! TargetTemplate::value_is_correct( corpus[i][k][STATE_START + *jj],  corpus[i][k][TRUTH_START + *jj])) {
-		    rule1.bad += costs[i];
-
-		    if(V_flag>=3)
-		      cerr << rule1.printMe() << " good: " << rule1.good << " bad: " << rule1.bad << " -- bads have been increased" << endl;
-		  }
-	      }
-	    }
-	  }
-
-	  processed[k] = true;
+    if(num_threads > 1)
+      applyBestRuleInParallel(bestRule, thisIndex, least_frequent, offsets, best_rule_target, modified_states);
+    else {
+      // One more step is needed here. We need to copy the current index before we iterate on it, because
+      // it will change in the case of classification indices, resulting in incorrect behavior.
+      // (the copy of a classification index only shares its data, until the index is changed)
+
+      word_index_class index(thisIndex.get_type());
+      index.copy_data_field(thisIndex, least_frequent);
+      word_index_class::iterator endp = index.end(least_frequent);
+      static int1D words;
+      serial_count_update update;
+
+      for(word_index_class::iterator it = index.begin(least_frequent); !(it == endp) ;) {
+	int i = (*it).line_id();
+
+	words.clear();
+	while (it!=endp && i == (*it).line_id()) {
+	  words.push_back((*it).word_id());
+	  ++it;
 	}
-      }
 
-      int pp = 0;
-      for(int1D::iterator p = placesToChange.begin() ; p!=placesToChange.end() ; ++p, ++pp) {
-	for(TargetTemplate::pos_vector::const_iterator tid = best_rule_positions.begin() ; 
-	    tid != best_rule_positions.end();
-	    ++tid) {
-	  wordType& corpus_value = corpus[i][*p][STATE_START + *tid];
-	  classifIndex.erase(corpus_value, i, *p);
-	  corpus_value = best_rule_target[*tid];
-	  classifIndex.insert(corpus_value, i, *p);
-	}
-      }
+	newRules.clear();
+	applyBestRuleOnSentence(bestRule, i, words, offsets, best_rule_target, modified_states, update);
 	  
-      // Add to the hash of rules all the rules that were newly generated at this step
-      for(rule_hash_set::iterator rl = newRules.begin() ; rl!=newRules.end() ; ++rl)
-	allRules.insert(*rl);
+	// Add to the hash of rules all the rules that were newly generated at this step
+	for(rule_hash::iterator rl = newRules.begin() ; rl!=newRules.end() ; ++rl)
+	  bestRules.push(*allRules.insert(*rl).first);
+	update.stats.rules_added += newRules.size();
+      }
+      iteration.add(update.stats);
     }
 
-    rule_hash_set::const_iterator p = allRules.find(bestRule);
-    if(p->good != 0 || p->bad != 0)
+    // With sharded training, the best rule need not be in the local rules.
+    rule_hash::iterator p = allRules.find(bestRule);
+    if(p != allRules.end() && (p->good != 0 || p->bad != 0))
       cerr << "!! " << bestRule.printMe() << " does not have 0 goods and bads (good: " << 
 	bestRule.good << ", bad: " << bestRule.bad << ") !!" << endl;
   }
-  else  // This is the original behaviour of TBL
+  else { // This is the original behaviour of TBL
+    iteration.positions += best_rule_applic_places.size();
     for(position_vector::iterator pos=best_rule_applic_places.begin() ; 
 	pos!=best_rule_applic_places.end() ; 
 	++pos) {
+      if(pos == best_rule_applic_places.begin() || pos->first != (pos-1)->first)
+	iteration.sentences++;
       int tt = 0;
       for(TargetTemplate::pos_vector::const_iterator tid = best_rule_positions.begin() ; 
 	  tid != best_rule_positions.end();
@@ -1086,6 +1616,7 @@ void applyBestRule (const Rule &bestRule)
 	classifIndex.insert(corpus_value, pos->first, pos->second);
       }
     }
+  }
 
   // Erase some of the rules, to save some space. There are two types of rules that are getting
   // deleted: ones that have 0 goods and a bad count > ERASE_USELESS_RULES and the ones for which
@@ -1096,7 +1627,7 @@ void applyBestRule (const Rule &bestRule)
     static rule_vector tmp;
     tmp.clear();
 
-    for(rule_hash_set::iterator thisRule = allRules.begin() ;
+    for(rule_hash::iterator thisRule = allRules.begin() ;
 	thisRule != allRules.end() ; ++thisRule) {
       if(thisRule->good==0) {
 	if(erase_bad_rules > -1 && thisRule->bad > erase_bad_rules)
@@ -1110,14 +1641,566 @@ void applyBestRule (const Rule &bestRule)
 
     if(v_flag)
       cerr << "Removing " << tmp.size() << " rules." << endl;
+    iteration.rules_removed += tmp.size();
 	
     for(int i=0 ; i<tmp.size() ; i++) {
       if(V_flag > 4)
 	cerr << i << ": Erasing rule " << tmp[i].printMe() << " (" << 
 	  tmp[i].good << "," << tmp[i].bad << ")" << endl;
-      allRules.erase(allRules.find(tmp[i]));
+      rule_hash::iterator rule = allRules.find(tmp[i]);
+      bestRules.erase(*rule);
+      allRules.erase(rule);
+    }
+  }
+}
+
+// A checkpoint holds the state of the learner after a number of rules were
+// learned, such that the training can be resumed without recomputing the
+// rule counts: the learned rules, the state of the samples, the rules in
+// allRules with their counts and the counters of the main loop. The
+// dictionary is rebuilt by studyData from the same training data, so it is
+// only checked against the one saved in the checkpoint; the indices are
+// regenerated from the restored samples. If data is appended to the training
+// data (-append), the dictionary is the one of the whole corpus, and the
+// words saved in the checkpoint are translated to it.
+static const char checkpoint_magic[] = "fnTBL-checkpoint";
+static const int checkpoint_version = 1;
+
+struct learner_state {
+  rule_vector learned_rules;
+  int no_repeats;
+  int max_score;
+};
+
+void write_checkpoint(const string& file_name, const learner_state& state) {
+  // Write to a temporary file first, such that a kill during the write
+  // does not destroy the previous checkpoint.
+  string tmp_name = file_name + ".tmp";
+  ofstream out(tmp_name.c_str(), ios::out | ios::binary);
+  if(! out) {
+    cerr << "Could not open the checkpoint file " << tmp_name << " for writing." << endl;
+    return;
+  }
+
+  out.write(checkpoint_magic, sizeof(checkpoint_magic));
+  write_binary(out, checkpoint_version);
+  write_binary(out, static_cast<int>(sizeof(wordType)));
+  write_binary(out, static_cast<int>(PredicateTemplate::Templates.size()));
+  write_binary(out, static_cast<int>(TargetTemplate::Templates.size()));
+
+  const Dictionary& dict = Dictionary::GetDictionary();
+  write_binary(out, dict.size());
+  for(int i=0 ; i<dict.size() ; i++) {
+    const string& word = dict[static_cast<wordType>(i)];
+    write_binary(out, static_cast<int>(word.size()));
+    out.write(word.data(), word.size());
+  }
+
+  writeCorpusState(out);
+
+  write_binary(out, static_cast<int>(state.learned_rules.size()));
+  for(rule_vector::const_iterator rl=state.learned_rules.begin() ; rl!=state.learned_rules.end() ; ++rl)
+    rl->write_binary(out);
+  write_binary(out, state.no_repeats);
+  write_binary(out, state.max_score);
+
+  // Outside the fast mode, the rules are regenerated at each iteration.
+  write_binary(out, allRules.is_on());
+  write_binary(out, static_cast<int>(allRules.is_on() ? allRules.size() : 0));
+  if(allRules.is_on())
+    for(rule_hash::iterator rl=allRules.begin() ; rl!=allRules.end() ; ++rl)
+      rl->write_binary(out);
+
+  out.close();
+  if(! out || rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+    cerr << "Could not write the checkpoint file " << file_name << "." << endl;
+    return;
+  }
+  if(v_flag)
+    cerr << "Wrote checkpoint " << file_name << " after " << state.learned_rules.size() << " rules." << endl;
+}
+
+static void corrupt_checkpoint(const string& file_name, const string& reason) {
+  cerr << "Cannot resume from the checkpoint " << file_name << ": " << reason << "." << endl;
+  exit(3);
+}
+
+// Restores the state saved by write_checkpoint. It needs to be called after
+// the training data was read, and before the indices are generated. The
+// checkpoint holds the state of the first num_lines sentences (all of them
+// if num_lines is -1; the others are the appended ones).
+void read_checkpoint(const string& file_name, learner_state& state, int num_lines = -1) {
+  ifstream in(file_name.c_str(), ios::in | ios::binary);
+  if(! in)
+    corrupt_checkpoint(file_name, "the file could not be opened");
+
+  char magic[sizeof(checkpoint_magic)];
+  int version, word_size, num_pred_templates, num_target_templates;
+  in.read(magic, sizeof(magic));
+  if(! in || memcmp(magic, checkpoint_magic, sizeof(magic)) != 0)
+    corrupt_checkpoint(file_name, "this is not a checkpoint file");
+  read_binary(in, version);
+  read_binary(in, word_size);
+  if(version != checkpoint_version || word_size != sizeof(wordType))
+    corrupt_checkpoint(file_name, "it was written by a different version of fnTBL-train");
+  read_binary(in, num_pred_templates);
+  read_binary(in, num_target_templates);
+  if(num_pred_templates != PredicateTemplate::Templates.size() || 
+     num_target_templates != TargetTemplate::Templates.size())
+    corrupt_checkpoint(file_name, "it was created with different rule templates");
+
+  const Dictionary& dict = Dictionary::GetDictionary();
+  int dict_size;
+  read_binary(in, dict_size);
+  bool same_dictionary = dict_size == dict.size(), known_words = true;
+  wordTypeVector translation(dict_size);
+  string word;
+  for(int i=0 ; known_words && in && i<dict_size ; i++) {
+    int len;
+    read_binary(in, len);
+    word.resize(len);
+    if(len > 0)
+      in.read(&word[0], len);
+    known_words = dict.find(word) != dict.end();
+    if(known_words)
+      translation[i] = dict[word];
+    same_dictionary = same_dictionary && known_words && translation[i] == i;
+  }
+  if(! in)
+    corrupt_checkpoint(file_name, "the file is truncated");
+  if(! known_words || (! same_dictionary && num_lines == -1))
+    corrupt_checkpoint(file_name, "it was created from different training data");
+
+  if(! readCorpusState(in, num_lines, &translation))
+    corrupt_checkpoint(file_name, "the samples do not match the training data");
+
+  int num_rules;
+  read_binary(in, num_rules);
+  state.learned_rules.resize(num_rules);
+  for(int i=0 ; i<num_rules ; i++)
+    if(! state.learned_rules[i].read_binary(in, &translation))
+      corrupt_checkpoint(file_name, "the learned rules cannot be read");
+  read_binary(in, state.no_repeats);
+  read_binary(in, state.max_score);
+
+  bool fast_mode;
+  read_binary(in, fast_mode);
+  read_binary(in, num_rules);
+  bestRules.clear();
+  allRules.clear();
+  if(fast_mode)
+    allRules.turn_on();
+  else
+    allRules.turn_off();
+  Rule rule;
+  for(int i=0 ; i<num_rules ; i++) {
+    if(! rule.read_binary(in, &translation))
+      corrupt_checkpoint(file_name, "the rule set cannot be read");
+    allRules.insert(rule);
+  }
+  if(! in)
+    corrupt_checkpoint(file_name, "the file is truncated");
+  if(fast_mode)
+    bestRules.build(allRules.begin(), allRules.end());
+
+  best_rule_index = state.learned_rules.size();
+  if(v_flag)
+    cerr << "Resuming from checkpoint " << file_name << " after " << best_rule_index << " rules, with " 
+	 << allRules.size() << " rules in the rule set." << endl;
+}
+
+// Incremental training (-append): the sentences of the appended file follow
+// the ones of the training data of the checkpoint, starting with first_line.
+// The rules learned before the checkpoint are applied to them in order, the
+// way fnTBL applies a rule list (all the samples of a sentence that a rule
+// matches are changed at once), and their counts get the ones of the appended
+// samples added. The rules are not rescored on the old samples, so the ones
+// that would no longer be learned on the whole corpus are only counted (the
+// return value) - dropping them would change the state of the old samples.
+int applyLearnedRules(rule_vector& rules, int first_line) {
+  static int 
+    STATE_START = TargetTemplate::STATE_START;
+  int1D places;
+  int under_threshold = 0;
+
+  for(int r=0 ; r<rules.size() ; r++) {
+    Rule& rule = rules[r];
+    const TargetTemplate::pos_vector& positions = TargetTemplate::Templates[rule.target.tid].positions;
+    for(int i=first_line ; i<corpus.size() ; i++) {
+      int numWords = corpus[i].size() - PredicateTemplate::MaxForwardLookup;
+      places.clear();
+      for(int j=-PredicateTemplate::MaxBackwardLookup ; j<numWords ; j++)
+	if(rule.test(corpus[i], j))
+	  places.push_back(j);
+
+      for(int1D::iterator j=places.begin() ; j!=places.end() ; ++j) {
+	rule.update_counts(corpus[i][*j], costs[i]);
+	int t = 0;
+	for(TargetTemplate::pos_vector::const_iterator tid = positions.begin() ; 
+	    tid != positions.end();
+	    ++tid, ++t)
+	  corpus[i][*j][STATE_START + *tid] = rule.target.vals[t];
+	ruleTrace[i][*j].push_back(r);
+      }
+    }
+    if(rule.good - rule.bad <= THRESHOLDSCORE)
+      under_threshold++;
+  }
+  return under_threshold;
+}
+
+// Adds the counts of the appended sentences (the ones starting with
+// first_line) to the fast mode rule counts restored from a checkpoint, such
+// that they are the ones computeScoreForAllRules would compute on the whole
+// corpus: the good counts of the appended samples are collected in a separate
+// table and added to the rules of allRules, whose bad counts are updated with
+// a pass over the appended samples. The rules that only the appended samples
+// generate are scored on the whole corpus with computeScoreForRule, through
+// the indices (so the index has to be generated first).
+void addCountsOfSentences(int first_line) {
+  rule_hash_set ruleSet, table;
+  rule_id_set pRules;
+  
+  ticker tk("Sentences processed: ", 1024);
+  if(v_flag)
+    cerr << "Computing the counts of the appended sentences" << endl;
+
+  for (int i = first_line; i < (int)corpus.size(); i++) {  
+    int numWords = (int)corpus[i].size()-PredicateTemplate::MaxForwardLookup;
+    for (int j = -PredicateTemplate::MaxBackwardLookup; j < numWords; j++) {
+      if(sample_is_completely_correct(corpus[i][j])) continue;
+
+      ruleSet.clear();
+      createRulesForExample(i, j, ruleSet);
+      insertRulesIntoHash(i, j, ruleSet, table);
+    }
+    tk.tick();
+  }
+  tk.clear();
+
+  int1D pos(1);
+  static feature_vector ftrs(TargetTemplate::TRUTH_SIZE);
+  for(int k=0 ; k<ftrs.size() ; ++k)
+    ftrs[k] = TargetTemplate::TRUTH_START+k;
+  for (int i = first_line; i < (int)corpus.size(); i++) {
+    int numWords = (int)corpus[i].size()-PredicateTemplate::MaxForwardLookup;
+    for (int j = -PredicateTemplate::MaxBackwardLookup; j < numWords; j++) {
+      if(sample_is_completely_incorrect(corpus[i][j])) continue;
+
+      pRules.clear();
+      pos[0] = j;
+      createRulesForExample(i, j, pos, pRules, ftrs, true);
+
+      for(rule_id_set::iterator rl = pRules.begin() ; rl!=pRules.end() ; rl++)
+	allRules[*rl].update_bad_counts(corpus[i][j], costs[i]);
+    }
+    tk.tick();
+  }
+  tk.clear();
+
+  rule_vector new_rules;
+  for(rule_hash_set::iterator rl=table.begin() ; rl!=table.end() ; ++rl) {
+    rule_hash::iterator it = allRules.find(*rl);
+    if(it == allRules.end())
+      new_rules.push_back(*rl);
+    else {
+      it->good += rl->good;
+      it->bad += rl->bad;
     }
   }
+  for(rule_vector::iterator rl=new_rules.begin() ; rl!=new_rules.end() ; ++rl) {
+    rl->good = rl->bad = 0;
+    rule_ref new_rule = *allRules.insert(*rl).first;
+    computeScoreForRule(new_rule);
+  }
+
+  bestRules.clear();
+  bestRules.build(allRules.begin(), allRules.end());
+  if(v_flag)
+    cerr << "Added " << new_rules.size() << " new rules, for a total of " << allRules.size() << " rules." << endl;
+}
+
+// Sharded training: the sentences are split between a number of worker
+// processes (sentence k goes to the shard k % num_shards), each of which keeps
+// the fast mode rule counts of its own sentences. The initial process is the
+// coordinator: it finds the rule with the best global score and sends it to
+// the workers, which apply it on their sentences.
+//
+// The global counts of a rule are the sums of its counts in the shards; a
+// shard that does not have the rule in its allRules can still have samples
+// that the rule breaks, so it computes them with computeScoreForRule. To avoid
+// collecting all the rules at each iteration, the coordinator gets the rules
+// of each shard in decreasing order of their local score, and stops when the
+// best global score found is higher than the sum of the (positive) last local
+// scores received - no rule that was not seen yet can score higher than that.
+int num_shards = 1;
+
+enum shard_command { SHARD_BEST_RULES, SHARD_COUNT, SHARD_APPLY, SHARD_STOP };
+
+struct shard_worker {
+  pid_t pid;
+  int fd;
+};
+vector<shard_worker> shard_workers;
+
+// Answers the requests of the coordinator, until it asks the worker to stop.
+void serve_shard(int fd) {
+  string request;
+  rule_heap::rep_type best;
+  while(read_message(fd, request)) {
+    istringstream in(request);
+    ostringstream out;
+    int command;
+    read_binary(in, command);
+    switch(command) {
+    case SHARD_BEST_RULES: {
+      // The local rules with the ranks first .. first+count-1
+      int first, count;
+      read_binary(in, first);
+      read_binary(in, count);
+      bestRules.best(first+count, best);
+      write_binary(out, static_cast<int>(best.size() > first ? best.size()-first : 0));
+      for(int k=first ; k<best.size() ; k++)
+	allRules[best[k]].write_binary(out);
+      break;
+    }
+    case SHARD_COUNT: {
+      int count;
+      read_binary(in, count);
+      Rule rule;
+      for(int k=0 ; k<count ; k++) {
+	rule.read_binary(in);
+	rule_hash::iterator p = allRules.find(rule);
+	if(p != allRules.end()) {
+	  rule.good = p->good;
+	  rule.bad = p->bad;
+	} else {
+	  rule.good = rule.bad = 0;
+	  computeScoreForRule(rule);
+	}
+	write_binary(out, rule.good);
+	write_binary(out, rule.bad);
+      }
+      break;
+    }
+    case SHARD_APPLY: {
+      Rule rule;
+      rule.read_binary(in);
+      applyBestRule(rule);
+      best_rule_index++;
+      continue;
+    }
+    default:
+      return;
+    }
+    if(! write_message(fd, out.str()))
+      return;
+  }
+}
+
+void run_shard_worker(const string& file_name, int shard, int fd) {
+  readInData(const_cast<char *>(file_name.c_str()), shard, num_shards);
+  initializeDefaultCosts(corpus.size());
+  generate_index();
+  allRules.turn_on();
+  computeScoreForAllRules();
+  serve_shard(fd);
+  close(fd);
+  exit(0);
+}
+
+void start_shard_workers(const string& file_name) {
+  for(int shard=0 ; shard<num_shards ; shard++) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      cerr << "Could not create the socket for shard " << shard << "." << endl;
+      exit(4);
+    }
+    pid_t pid = fork();
+    if(pid < 0) {
+      cerr << "Could not start the worker for shard " << shard << "." << endl;
+      exit(4);
+    }
+    if(pid == 0) {
+      close(fds[0]);
+      for(int k=0 ; k<shard_workers.size() ; k++)
+	close(shard_workers[k].fd);
+      run_shard_worker(file_name, shard, fds[1]);
+    }
+    close(fds[1]);
+    shard_worker worker;
+    worker.pid = pid;
+    worker.fd = fds[0];
+    shard_workers.push_back(worker);
+  }
+}
+
+void send_to_shard(int shard, const string& message) {
+  if(! write_message(shard_workers[shard].fd, message)) {
+    cerr << "Lost the connection to the worker for shard " << shard << "." << endl;
+    exit(4);
+  }
+}
+
+void receive_from_shard(int shard, string& message) {
+  if(! read_message(shard_workers[shard].fd, message)) {
+    cerr << "Lost the connection to the worker for shard " << shard << "." << endl;
+    exit(4);
+  }
+}
+
+void stop_shard_workers() {
+  ostringstream out;
+  write_binary(out, static_cast<int>(SHARD_STOP));
+  for(int shard=0 ; shard<shard_workers.size() ; shard++) {
+    write_message(shard_workers[shard].fd, out.str());
+    close(shard_workers[shard].fd);
+    waitpid(shard_workers[shard].pid, 0, 0);
+  }
+  shard_workers.clear();
+}
+
+// Finds the rule with the best global score. Returns false if none of the
+// shards has any rules left.
+bool getBestShardedRule(Rule& best) {
+  int n = shard_workers.size();
+  vector<int> fetched(n, 0);
+  vector<scoreType> last(n, 0);
+  bit_vector exhausted(n, false);
+  rule_hash_set seen;
+  rule_vector fresh;
+  bool found = false;
+  string message;
+
+  for(int batch = 16 ; ; batch *= 2) {
+    // Ask for more rules only the shards that can still have rules with a
+    // positive local score, if there are any.
+    int1D ask;
+    for(int s=0 ; s<n ; s++)
+      if(! exhausted[s] && (fetched[s] == 0 || last[s] > 0))
+	ask.push_back(s);
+    if(ask.empty())
+      for(int s=0 ; s<n ; s++)
+	if(! exhausted[s])
+	  ask.push_back(s);
+    if(ask.empty())
+      break;
+
+    for(int1D::iterator s=ask.begin() ; s!=ask.end() ; ++s) {
+      ostringstream out;
+      write_binary(out, static_cast<int>(SHARD_BEST_RULES));
+      write_binary(out, fetched[*s]);
+      write_binary(out, batch);
+      send_to_shard(*s, out.str());
+    }
+    fresh.clear();
+    for(int1D::iterator s=ask.begin() ; s!=ask.end() ; ++s) {
+      receive_from_shard(*s, message);
+      istringstream in(message);
+      int count;
+      read_binary(in, count);
+      Rule rule;
+      for(int k=0 ; k<count ; k++) {
+	rule.read_binary(in);
+	last[*s] = rule.good - rule.bad;
+	if(seen.insert(rule).second)
+	  fresh.push_back(rule);
+      }
+      fetched[*s] += count;
+      if(count < batch)
+	exhausted[*s] = true;
+    }
+
+    // Get the global counts of the rules seen for the first time.
+    if(! fresh.empty()) {
+      ostringstream out;
+      write_binary(out, static_cast<int>(SHARD_COUNT));
+      write_binary(out, static_cast<int>(fresh.size()));
+      for(rule_vector::iterator rl=fresh.begin() ; rl!=fresh.end() ; ++rl) {
+	rl->write_binary(out);
+	rl->good = rl->bad = 0;
+      }
+      for(int s=0 ; s<n ; s++)
+	send_to_shard(s, out.str());
+      for(int s=0 ; s<n ; s++) {
+	receive_from_shard(s, message);
+	istringstream in(message);
+	for(rule_vector::iterator rl=fresh.begin() ; rl!=fresh.end() ; ++rl) {
+	  scoreType good, bad;
+	  read_binary(in, good);
+	  read_binary(in, bad);
+	  rl->good += good;
+	  rl->bad += bad;
+	}
+      }
+      for(rule_vector::iterator rl=fresh.begin() ; rl!=fresh.end() ; ++rl)
+	if(! found || best < *rl) {
+	  best = *rl;
+	  found = true;
+	}
+    }
+
+    scoreType bound = 0;
+    for(int s=0 ; s<n ; s++)
+      if(! exhausted[s] && last[s] > 0)
+	bound += last[s];
+    if(found) {
+      scoreType score = best.good - best.bad;
+      if(score > bound || (score <= THRESHOLDSCORE && bound <= THRESHOLDSCORE))
+	break;
+    }
+  }
+
+  if(V_flag > 1)
+    cerr << "Looked at " << seen.size() << " rules to find the best one." << endl;
+  return found;
+}
+
+// The main loop of the sharded training; mirrors the one in main.
+void learnShardedRules(ostream& rules, int NUM_REPEATS, int& max_score) {
+  timer tm;
+  Rule lastRule, bestRule;
+  int no_repeats = 0;
+  while(getBestShardedRule(bestRule)) {
+    if(v_flag)
+      cerr << "GOOD:" << bestRule.good << " BAD:"
+	   << bestRule.bad << " SCORE:" << bestRule.good - bestRule.bad
+	   << " RULE: " << bestRule.printMe() << endl;
+
+    if(max_score < 0)
+      max_score = bestRule.good - bestRule.bad;
+
+    if (bestRule.good - bestRule.bad <= THRESHOLDSCORE) 
+      return;
+
+    rules << "GOOD:" << bestRule.good << " BAD:"
+	  << bestRule.bad << " SCORE:" << bestRule.good - bestRule.bad
+	  << " RULE: " << bestRule.printMe() << endl;
+
+    if(lastRule == bestRule) {
+      no_repeats++;
+      if(no_repeats>=NUM_REPEATS) {
+	cerr << "Error - the best rule didn't change! You found a bug in the TBL toolkit!" << endl;
+	exit(1);
+      }
+    } else
+      no_repeats = 0;
+    lastRule = bestRule;
+
+    ostringstream out;
+    write_binary(out, static_cast<int>(SHARD_APPLY));
+    bestRule.write_binary(out);
+    for(int s=0 ; s<shard_workers.size() ; s++)
+      send_to_shard(s, out.str());
+    best_rule_index++;
+
+    tm.mark();
+    if(v_flag)
+      cerr << "Time used in computing rule: " << tm.time_since_last_mark() << " (" 
+	   << tm.milliseconds_since_last_mark() << " milliseconds) " << endl;
+  }
+  if(v_flag)
+    cerr << "Done. All samples have been learned." << endl;
 }
 
 void usage(const string& progname ) {
@@ -1131,6 +2214,22 @@ void usage(const string& progname ) {
        << "  -V <verb_flag>           - turns on the verbosity flag (max 5)" << endl
        << "  -p                       - compute the TBL tree associated with the rule list " << endl
        << "  -t <file>                - saves the TBL tree in the specified file" << endl
+       << "  -threads <n>             - computes the initial rule counts using n threads" << endl
+       << "  -columns                 - stores the corpus by columns (one array per feature)" << endl
+       << "  -checkBatchTests         - checks the AVX2 tests of the rules against the scalar ones (slower)" << endl
+       << "  -checkpoint <file>       - periodically saves the state of the training in the file" << endl
+       << "  -checkpointEvery <n>     - saves a checkpoint every n learned rules (default 100)" << endl
+       << "  -resume <file>           - resumes the training from a checkpoint (the data and parameters have to be the same)" << endl
+       << "  -append <file>           - with -resume, adds the data in the file to the training data of the checkpoint, and" << endl
+       << "                             continues learning on the whole corpus (only the counts of the new data are computed)" << endl
+       << "  -sample <n>              - scores only the rules that correct n random incorrect samples at each iteration" << endl
+       << "  -workingSet <n>          - the number of rules kept between iterations with -sample (default 4 times the sample size)" << endl
+       << "  -sampleCheck <k>         - with -sample, compares the chosen rule with the exact best rule every k iterations" << endl
+       << "  -seed <n>                - the seed of the random number generator (default 1)" << endl
+       << "  -trace <file>            - writes the statistics of each iteration (times, counts, memory) to the file, as CSV" << endl
+       << "  -shards <n>              - splits the training data between n worker processes" << endl
+       << "  -textVocabulary          - writes the vocabulary file as text, one word per line (the default is a binary file" << endl
+       << "                             that fnTBL maps in memory)" << endl
        << endl;
 }
 
@@ -1144,10 +2243,14 @@ int main(int argc, char *argv[]) {
   bool f_flag = true;
   bool o_flag = false;
   bool print_rules = false;
+  bool text_vocabulary = false;
 
   string ruleTemplateFile = "";
   string rule_file = "";
   string tree_file = "tree_file.dat";
+  string checkpoint_file = "", resume_file = "", append_file = "", trace_file = "";
+  int checkpoint_every = 100;
+  int seed = 1;
   for (int i = 3; i < argc; i++) {
     if (!strcmp("-templates", argv[i]) && i+1 < argc) 
       ruleTemplateFile = argv[++i];
@@ -1190,6 +2293,49 @@ int main(int argc, char *argv[]) {
     }
     else if(!strcmp("-minPositiveScore", argv[i]))
       min_positive_score = atoi1(argv[++i]);
+    else if(!strcmp("-threads", argv[i]) && i+1 < argc) {
+      num_threads = atoi1(argv[++i]);
+      if(num_threads < 1)
+	num_threads = 1;
+      if(! HAVE_THREAD_LOCAL && num_threads > 1) {
+	cerr << "This compiler does not support thread local storage; using a single thread." << endl;
+	num_threads = 1;
+      }
+    }
+    else if(!strcmp("-columns", argv[i]))
+      corpus.set_layout(wordType3D::COLUMNS);
+    else if(!strcmp("-checkBatchTests", argv[i]))
+      rule_batch::set_checked(true);
+    else if(!strcmp("-checkpoint", argv[i]) && i+1 < argc)
+      checkpoint_file = argv[++i];
+    else if(!strcmp("-checkpointEvery", argv[i]) && i+1 < argc) {
+      checkpoint_every = atoi1(argv[++i]);
+      if(checkpoint_every < 1)
+	checkpoint_every = 1;
+    }
+    else if(!strcmp("-resume", argv[i]) && i+1 < argc)
+      resume_file = argv[++i];
+    else if(!strcmp("-append", argv[i]) && i+1 < argc)
+      append_file = argv[++i];
+    else if(!strcmp("-sample", argv[i]) && i+1 < argc)
+      sample_size = atoi1(argv[++i]);
+    else if(!strcmp("-workingSet", argv[i]) && i+1 < argc)
+      working_set_size = atoi1(argv[++i]);
+    else if(!strcmp("-sampleCheck", argv[i]) && i+1 < argc)
+      sample_check = atoi1(argv[++i]);
+    else if(!strcmp("-seed", argv[i]) && i+1 < argc)
+      seed = atoi1(argv[++i]);
+    else if(!strcmp("-trace", argv[i]) && i+1 < argc) {
+      trace_file = argv[++i];
+      trace_iterations = true;
+    }
+    else if(!strcmp("-shards", argv[i]) && i+1 < argc) {
+      num_shards = atoi1(argv[++i]);
+      if(num_shards < 1)
+	num_shards = 1;
+    }
+    else if(!strcmp("-textVocabulary", argv[i]))
+      text_vocabulary = true;
     else if(!strcmp("-print_rules", argv[i])) {
       rule_file = argv[++i];
       print_rules = true;
@@ -1200,6 +2346,37 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  // The appended data is added to the state saved in a checkpoint; the
+  // identical samples cannot be collapsed, as the appended ones have to
+  // follow the ones of the checkpoint.
+  if(append_file != "" && resume_file == "") {
+    cerr << "The option -append needs a checkpoint of the training on the old data, given with -resume." << endl;
+    exit(1);
+  }
+  if(append_file != "" && 
+     ! Params::GetParams().valueForParameter("EMPTY_LINES_ARE_SEPARATORS",true) &&
+     ! Params::GetParams().valueForParameter("DONT_COLLAPSE_SAMPLES", false)) {
+    cerr << "The option -append cannot be used when the identical samples are collapsed (set DONT_COLLAPSE_SAMPLES to 1)." << endl;
+    exit(1);
+  }
+
+  // The sampled search does not keep the counts of all the rules.
+  if(sample_size > 0) {
+    f_flag = false;
+    o_flag = true;
+    if(working_set_size <= 0)
+      working_set_size = 4*sample_size;
+  }
+
+  // The sharded training only implements the main loop of the fast mode.
+  if(num_shards > 1 && 
+     (o_flag || I_flag > 0 || compute_probabilities || print_rules || all_rules_thresh > -10000 || trace_iterations ||
+      checkpoint_file != "" || resume_file != "" || append_file != "")) {
+    cerr << "The options -o, -I, -p, -t, -print_rules, -allPositiveRules, -checkpoint, -resume," << endl
+	 << "-append, -sample and -trace cannot be used with -shards." << endl;
+    exit(1);
+  }
+
   log_me_in(argc, argv);
   RuleTemplate::Initialize();
   bool is_stdin = false;
@@ -1227,11 +2404,12 @@ int main(int argc, char *argv[]) {
       of << line << endl;
     of.close();
   }
-  studyData(file_name);
+  studyData(file_name, "", false, append_file);
 
   Rule::Initialize();
 
   const Dictionary& dict = Dictionary::GetDictionary();
+  int old_lines = -1;
 
   if( ceil(log(static_cast<double>(dict.size()))/log(static_cast<double>(2))) > 8*sizeof(wordType) ) {
     cerr << "The representation size is wrong!! There are " << dict.size() << " words, "
@@ -1246,13 +2424,41 @@ int main(int argc, char *argv[]) {
   if(v_flag)
     cerr << "The dictionary has " << Dictionary::GetDictionary().size() << " words!" << endl;
 
-  readInData (const_cast<char *>(file_name.c_str()));
-  initializeDefaultCosts(corpus.size());
   erase_bad_rules = Params::GetParams().valueForParameter("ERASE_USELESS_RULES", -1);
   erase_rule_factor = Params::GetParams().valueForParameter("ERASE_RULES_WITH_USELESS_FACTOR", -1);
   int NUM_REPEATS = Params::GetParams().valueForParameter("NUM_REPEATS", 5);
+
+  if(num_shards > 1) {
+    if(erase_bad_rules > -1 || erase_rule_factor > -1)
+      cerr << "Warning: with -shards, the rules are erased based on their counts in each shard, "
+	   << "so the rule list can differ from the one learned by a single process." << endl;
+    start_shard_workers(file_name);
+  }
+  else {
+    old_lines = readInData (const_cast<char *>(file_name.c_str()));
+    if(append_file != "")
+      readInData(const_cast<char *>(append_file.c_str()), 0, 1, old_lines);
+    initializeDefaultCosts(corpus.size());
+  }
+
+  learner_state state;
+  state.no_repeats = 0;
+  state.max_score = -1;
+  if(resume_file != "")
+    read_checkpoint(resume_file, state, append_file != "" ? old_lines : -1);
+
+  if(append_file != "") {
+    int under_threshold = applyLearnedRules(state.learned_rules, old_lines);
+    if(v_flag)
+      cerr << "Applied the " << state.learned_rules.size() << " learned rules to the " 
+	   << corpus.size() - old_lines << " appended sentences." << endl;
+    if(under_threshold > 0)
+      cerr << "Warning: " << under_threshold << " of the rules learned before the checkpoint score under the threshold "
+	   << "on the whole corpus; they are kept, as dropping them would change the state of the old samples." << endl;
+  }
  
-  generate_index();
+  if(num_shards == 1)
+    generate_index();
 
   ostream *rules;
   smart_open(rules, argv[2]);
@@ -1278,14 +2484,39 @@ int main(int argc, char *argv[]) {
 
   *rules << "#train_voc_file: " << dictionary_file << endl;
   
-  dict.writeToFile(dictionary_file);
+  dict.writeToFile(dictionary_file, text_vocabulary);
+
+  // The rules learned before the checkpoint
+  for(rule_vector::iterator rl=state.learned_rules.begin() ; rl!=state.learned_rules.end() ; ++rl)
+    *rules << "GOOD:" << rl->good << " BAD:"
+	   << rl->bad << " SCORE:" << rl->good - rl->bad
+	   << " RULE: " << rl->printMe() << endl;
+  if(compute_probabilities)
+    chosen_rules = state.learned_rules;
+
+  if(num_shards > 1) {
+    learnShardedRules(*rules, NUM_REPEATS, state.max_score);
+    stop_shard_workers();
+    cerr << "Overall running time: " << tm.time_since_beginning() << " (" << tm.milliseconds_since_beginning() << " milliseconds) " << endl;
+    delete rules;
+    if(is_stdin)
+      unlink(file_name.c_str());
+    return 0;
+  }
 
   int prevScore = 10000000L, actualScore = 0;
   double M_PI_12 = M_PI/12;
   tm.mark();
-  if(f_flag) {
+  if(resume_file != "") {
+    f_flag = allRules.is_on();
+    if(append_file != "" && f_flag)
+      addCountsOfSentences(old_lines);
+  }
+  else if(f_flag) {
     allRules.turn_on();
     computeScoreForAllRules();
+    if(v_flag)
+      allRules.print_statistics(cerr);
     if(print_rules) {
       rule_hash::iterator ri = allRules.begin(), last = allRules.end();
       ostream* rlstr;
@@ -1301,16 +2532,35 @@ int main(int argc, char *argv[]) {
   if(v_flag)
     cerr << "Time spent computing initial counts: " << tm.time_since_last_mark() << endl;
   Rule lastRule;
-  int no_repeats = 0;
-  int max_score = -1;
+  int& no_repeats = state.no_repeats;
+  int& max_score = state.max_score;
+  if(! state.learned_rules.empty())
+    lastRule = state.learned_rules.back();
+  ostream* trace = 0;
+  if(trace_iterations) {
+    smart_open(trace, trace_file);
+    iteration_stats::print_header(*trace);
+  }
+  Rule sampledRule;
+  srand(seed);
   while(1) {
-    createNewRuleSet();
-    if(allRules.size() == 0) {
+    iteration.clear();
+    double lap = trace_iterations ? telemetry_clock() : 0;
+    if(sample_size == 0)
+      createNewRuleSet();
+    if(trace_iterations)
+      telemetry_lap(lap, iteration.generation_time);
+    if(sample_size > 0 ? ! getSampledBestRule(sampledRule) : allRules.size() == 0) {
       if(v_flag)
 	cerr << "Done. All samples have been learned." << endl;
       break;
     }
-    const Rule &bestRule = getBestRule();
+    rule_ref bestRule = sample_size > 0 ? rule_ref(sampledRule) : getBestRule();
+    // bestRule can be changed by applyBestRule, so save what goes in the trace.
+    int rule_count = sample_size > 0 ? working_set.size() : allRules.size();
+    scoreType score = bestRule.good - bestRule.bad;
+    if(trace_iterations)
+      telemetry_lap(lap, iteration.best_rule_time);
     if(v_flag)
       cerr << "GOOD:" << (bestRule).good << " BAD:"
 	   << (bestRule).bad << " SCORE:" << (bestRule).good - (bestRule).bad
@@ -1337,10 +2587,23 @@ int main(int argc, char *argv[]) {
       no_repeats = 0;
     
     lastRule = bestRule;
+    if(checkpoint_file != "")
+      state.learned_rules.push_back(bestRule);
     applyBestRule(bestRule);
     if(compute_probabilities)
       chosen_rules.push_back(bestRule);
     best_rule_index++;
+    if(trace_iterations) {
+      telemetry_lap(lap, iteration.apply_time);
+      *trace << best_rule_index << "," << score << "," << rule_count << "," 
+	     << iteration.sentences << "," << iteration.positions << "," 
+	     << iteration.rules_added << "," << iteration.rules_removed << "," 
+	     << iteration.best_rule_time << "," << iteration.apply_time << "," 
+	     << iteration.count_update_time << "," << iteration.generation_time << "," 
+	     << current_rss_kb() << "," << peak_rss_kb() << endl;
+    }
+    if(checkpoint_file != "" && best_rule_index % checkpoint_every == 0)
+      write_checkpoint(checkpoint_file, state);
     tm.mark();
     if(v_flag)
       cerr << "Time used in computing rule: " << tm.time_since_last_mark() << " (" 
@@ -1353,6 +2616,19 @@ int main(int argc, char *argv[]) {
       computeScoreForAllRules();
     }
   }
+
+  if(trace_iterations)
+    delete trace;
+
+  if(sample_stats.checks > 0)
+    cerr << "Sampled search: the chosen rule was the exact best rule in " << sample_stats.exact << " out of "
+	 << sample_stats.checks << " checks, with " << 100*sample_stats.ratio/sample_stats.checks
+	 << "% of the best score on average." << endl;
+
+  // The final state is saved as well, such that the training can be
+  // continued with a lower threshold.
+  if(checkpoint_file != "")
+    write_checkpoint(checkpoint_file, state);
   
   // This is a hack to help with tasks that have independent samples.
   // All rules that in the end have 0 bads but some positive "semi-goods" will
@@ -1375,8 +2651,11 @@ int main(int argc, char *argv[]) {
       cerr << "Done computing positive rules." << endl;
   }
 
-  if (v_flag)
+  if (v_flag) {
+    allRules.print_statistics(cerr);
     cerr << "Freeing the rule space." << endl;
+  }
+  bestRules.clear();
   allRules.destroy();
   if(compute_probabilities) {
     if(v_flag)
@@ -27,6 +27,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <ctime>
 #include <unistd.h>
 
@@ -47,6 +48,11 @@
 #include "io.h"
 #include "Node.h"
 #include "timer.h"
+#include "rule_batch.h"
+#include "ModelBundle.h"
+#include "rule_transducer.h"
+#include "threads.h"
+#include "message_server.h"
 
 typedef trie<char, bool> word_trie;
 
@@ -74,6 +80,16 @@ ostream* out;
 // By default, run the program in line mode, not entire corpus mode
 bool non_sequential = false;
 
+// With -compiledRules, the rules that can be compiled are applied by the
+// transducer instead of runOneRule; -checkCompiledRules applies them both
+// ways and compares the results.
+bool compiled_rules = false;
+bool check_compiled_rules = false;
+rule_transducer transducer;
+// The number of threads among which the sentences are split when the
+// compiled rules are applied.
+int num_threads = 1;
+
 float general_error = 0.0;
 
 word_index_class corpusIndex;
@@ -124,6 +140,63 @@ void readInRules(char *fileName)
   delete in;
 }
 
+// Reads the first line of the rule file, which names the training
+// vocabulary (split in ls).
+static void readRulesHeader(const char* fileName, line_splitter& ls) {
+  istream* rlsstr;
+  smart_open(rlsstr, fileName);
+  string line;
+  getline(*rlsstr, line);
+  delete rlsstr;
+  ls.split(line);
+  if (ls.size() < 2 || ls[0]!="#train_voc_file:") {
+    cerr << "The rule file looks corrupted, because there is no mentioning of the training vocabulary." << endl << 
+      " Please provide a valid rule file." << endl;
+    exit(1);
+  }
+}
+
+// Compiles the rule file, with the templates, the training vocabulary, the
+// constraints and the tree (if tree_file is not empty) into model_file.
+// The words of the rules and of the constraints are added to the
+// vocabulary, so the model does not depend on the data it is applied to.
+static void compileModel(char* rule_file, const string& tree_file, const string& model_file) {
+  Dictionary& dict = Dictionary::GetDictionary();
+  RuleTemplate::Initialize();
+
+  TBLTree t;
+  string tree_text;
+  if(tree_file != "") {
+    t.readClasses(tree_file);
+    istream* tstr;
+    smart_open(tstr, tree_file);
+    ostringstream text;
+    text << tstr->rdbuf();
+    tree_text = text.str();
+    delete tstr;
+  }
+
+  line_splitter ls;
+  readRulesHeader(rule_file, ls);
+  dict.readFromFile(ls[1]);
+
+  string constraints_file = Params::GetParams()["CONSTRAINTS_FILE"];
+  if(constraints_file != "")
+    Rule::Constraints.read(constraints_file, true);
+
+  cerr << "Reading rules" << endl;
+  readInRules(rule_file);
+  cerr << "Writing the model " << model_file << endl;
+  ModelBundle::write(model_file, allRules, tree_text);
+}
+
+// Adds the positions of the batch on which the rule applies to places.
+static void addRuleMatches(rule_batch& batch, vector<pair<unsigned int, unsigned short> >& places) {
+  const rule_batch::position_vector& matches = batch.evaluate();
+  for(rule_batch::position_vector::const_iterator p=matches.begin() ; p!=matches.end() ; ++p)
+    places.push_back(make_pair(p->first, p->second));
+}
+
 // This runs a rule on the corpus.
 void runOneRule (const Rule &currRule, int ruleID)
 {
@@ -182,15 +255,34 @@ void runOneRule (const Rule &currRule, int ruleID)
   
   word_index_class::iterator endp = thisIndex.end(least_frequent);
 
-  for(word_index_class::iterator it = thisIndex.begin(least_frequent); it != endp ; ++it) {
-    unsigned int i = (*it).line_id();
-    for(AtomicPredicate::position_vector::iterator offset = offsets.begin() ; offset != offsets.end() ; ++offset) {
-      unsigned short int j = (*it).word_id() - *offset;
-      if (j>=-PredicateTemplate::MaxBackwardLookup && j<corpus[i].size()-PredicateTemplate::MaxForwardLookup)
-	if(currRule.test(corpus[i], j))
-	  changedPlaces.push_back(make_pair(i, j));
+  static rule_batch batch(corpus);
+  batch.set_rule(currRule);
+  int first, second;
+  relativePosType d1, d2;
+  if(currRule.get_intersection_features(first, d1, second, d2))
+    // Only the positions where the two least frequent features both appear are tested.
+    for(posting_intersection p(corpusIndex.postings(currRule.predicate.tokens[first]), d1,
+			       corpusIndex.postings(currRule.predicate.tokens[second]), d2) ; ! p.done() ; p.next()) {
+      unsigned int i = p.line_id();
+      int j = p.word_id();
+      if (j>=-PredicateTemplate::MaxBackwardLookup && j<corpus[i].size()-PredicateTemplate::MaxForwardLookup) {
+	batch.add(i, j);
+	if(batch.full())
+	  addRuleMatches(batch, changedPlaces);
+      }
     }
-  }
+  else
+    for(word_index_class::iterator it = thisIndex.begin(least_frequent); it != endp ; ++it) {
+      unsigned int i = (*it).line_id();
+      for(AtomicPredicate::position_vector::iterator offset = offsets.begin() ; offset != offsets.end() ; ++offset) {
+	unsigned short int j = (*it).word_id() - *offset;
+	if (j>=-PredicateTemplate::MaxBackwardLookup && j<corpus[i].size()-PredicateTemplate::MaxForwardLookup)
+	  batch.add(i, j);
+      }
+      if(batch.full())
+	addRuleMatches(batch, changedPlaces);
+    }
+  addRuleMatches(batch, changedPlaces);
 
   static wordType fake_rule_index = Dictionary::GetDictionary()["FAKE_CLASS"];
   for (vector<pair<unsigned,unsigned short> >::iterator thisPosition = changedPlaces.begin();
@@ -231,6 +323,207 @@ void runOneRule (const Rule &currRule, int ruleID)
   }
 }
 
+// A state changed by the transducer in a sentence.
+typedef vector<pair<int, rule_transducer::change> > sentence_change_vector;
+
+// Applies the compiled rules first..last-1 to the sentences handed out by
+// the queue. The sentences are independent, so each thread runs its own
+// copy of the transducer (which keeps the value counts of the current
+// sentence); the changes are kept only if the interpreted rules need them.
+struct compiled_run_job {
+  work_queue& queue;
+  vector<rule_transducer>& transducers;
+  vector<sentence_change_vector>& changes;
+  int first, last;
+
+  compiled_run_job(work_queue& q, vector<rule_transducer>& t, vector<sentence_change_vector>& c, int f, int l):
+    queue(q), transducers(t), changes(c), first(f), last(l) {}
+
+  void operator() (int id) {
+    rule_transducer& t = transducers[id];
+    sentence_change_vector& kept = changes[id];
+    rule_transducer::change_vector sentence_changes;
+    bool keep = ! t.complete();
+    kept.clear();
+    int begin, end;
+    while(queue.get(begin, end))
+      for(int i=begin ; i<end ; i++) {
+	sentence_changes.clear();
+	t.apply(corpus[i], first, last, sentence_changes);
+	if(keep)
+	  for(rule_transducer::change_vector::const_iterator c=sentence_changes.begin() ; c!=sentence_changes.end() ; ++c)
+	    kept.push_back(make_pair(i, *c));
+      }
+  }
+};
+
+// Applies all the rules to the corpus: the runs of compiled rules go
+// through the transducer, in num_threads threads, the other rules through
+// runOneRule (which needs the index).
+void applyCompiledRules() {
+  static vector<rule_transducer> transducers;
+  static vector<sentence_change_vector> changes;
+  if(transducers.size() != num_threads) {
+    transducers.assign(num_threads, transducer);
+    changes.resize(num_threads);
+  }
+
+  for(int r=0 ; r<allRules.size() ; ) {
+    if(! transducer.compiled(r)) {
+      runOneRule(allRules[r], r);
+      r++;
+      continue;
+    }
+
+    int last = transducer.run_end(r);
+    work_queue queue(corpus.size(), 16);
+    compiled_run_job job(queue, transducers, changes, r, last);
+    run_in_threads(job, num_threads);
+
+    // The interpreted rules look up the states in classifIndex
+    for(int t=0 ; t<num_threads ; t++)
+      for(sentence_change_vector::const_iterator c=changes[t].begin() ; c!=changes[t].end() ; ++c) {
+	classifIndex.erase(c->second.old_value, c->first, c->second.word);
+	classifIndex.insert(c->second.value, c->first, c->second.word);
+      }
+    r = last;
+  }
+}
+
+static void saveStates(wordTypeVector& states) {
+  states.clear();
+  for(int i=0 ; i<corpus.size() ; i++) {
+    wordType2D sentence = corpus[i];
+    for(int j=0 ; j<sentence.size() ; j++)
+      for(int k=0 ; k<TargetTemplate::TRUTH_SIZE ; k++)
+	states.push_back(sentence[j][TargetTemplate::STATE_START+k]);
+  }
+}
+
+static void restoreStates(const wordTypeVector& states) {
+  wordTypeVector::const_iterator s = states.begin();
+  for(int i=0 ; i<corpus.size() ; i++) {
+    wordType2D sentence = corpus[i];
+    for(int j=0 ; j<sentence.size() ; j++)
+      for(int k=0 ; k<TargetTemplate::TRUTH_SIZE ; k++)
+	sentence[j][TargetTemplate::STATE_START+k] = *s++;
+  }
+}
+
+// Applies the rules to the corpus with runOneRule, then again (from the same
+// initial states, and with a new index) with the transducer, and exits with
+// an error if the results differ.
+void checkCompiledRules(const set<int>& filter) {
+  static wordTypeVector initial, interpreted, compiled;
+  static int checked_sentences = 0;
+  saveStates(initial);
+  generate_index(filter);
+  for(int r=0 ; r<allRules.size() ; r++)
+    runOneRule(allRules[r], r);
+  saveStates(interpreted);
+
+  restoreStates(initial);
+  corpusIndex.clear();
+  classifIndex.clear();
+  generate_index(filter);
+  applyCompiledRules();
+  saveStates(compiled);
+
+  int p = 0;
+  for(int i=0 ; i<corpus.size() ; i++)
+    for(int j=0 ; j<corpus[i].size() ; j++)
+      for(int k=0 ; k<TargetTemplate::TRUTH_SIZE ; k++, p++)
+	if(compiled[p] != interpreted[p]) {
+	  Dictionary& dict = Dictionary::GetDictionary();
+	  cerr << "The compiled rules disagree with the interpreted ones on sentence " << checked_sentences+i
+	       << ", sample " << j+PredicateTemplate::MaxBackwardLookup << ": " << dict[compiled[p]] 
+	       << " instead of " << dict[interpreted[p]] << endl;
+	  exit(1);
+	}
+  checked_sentences += corpus.size();
+  cerr << "The compiled rules agree with the interpreted ones on " << checked_sentences << " sentences"
+       << (rule_batch::uses_avx2() ? " (the AVX2 tests agree with the scalar ones)" : "") << endl;
+}
+
+// Applies the rules to the batch of samples read by read_lines, prints it
+// and clears the indices and the rule trace for the next batch. With
+// -printErrors, new_errors[0] has to hold the errors of the batch before
+// the rules; new_errors[r+1] gets the errors after rule r.
+static void tagBatch(const set<int>& filter, bool index_needed, ostream& ostr) {
+  if(index_needed && ! check_compiled_rules)
+    generate_index(filter);
+  if(check_compiled_rules)
+    checkCompiledRules(filter);
+  else if(compiled_rules)
+    applyCompiledRules();
+  else
+    for(int r=0 ; r<allRules.size() ; r++) {
+      if(printErrors)
+	new_errors[r+1] = new_errors[r];
+      runOneRule(allRules[r], r);
+    }
+  printCorpusState(ostr, printRT);
+  corpusIndex.clear();
+  classifIndex.clear();
+  for(int k=0 ; k<corpus.size() ; k++)
+    for(int i=0 ; i<corpus[k].size() ; i++)
+      ruleTrace[k][i].clear();
+}
+
+// Answers the requests of the server (-server). The first line of a request
+// is a command:
+//   TAG   - the rest of the request holds samples, in the format of the
+//           examples file; the reply is "OK", followed by the samples as
+//           fnTBL prints them (with the rule traces, if -printRuleTrace
+//           was given)
+//   STATS - the reply is "OK", followed by the latency histogram (the
+//           percentiles are estimated from its buckets)
+// The reply to a request that cannot be answered is "ERROR <reason>".
+// The samples are tagged in the global corpus, indices and rule trace, so
+// the requests are answered one at a time: a large TAG request holds up
+// the requests of all the other connections until it is done.
+class tagging_handler: public message_handler {
+public:
+  tagging_handler(const set<int>& f, bool index, int batch): filter(f), index_needed(index), batch_size(batch) {}
+
+  void handle(const string& request, string& reply) {
+    string::size_type end = request.find('\n');
+    string command = request.substr(0, end);
+    string samples = end == string::npos ? "" : request.substr(end+1);
+
+    ostringstream ostr;
+    if(command == "STATS") {
+      ostr << "OK" << endl;
+      latencies.print(ostr);
+    } else if(command == "TAG") {
+      // The samples are tagged as they are read; a sample with the wrong
+      // number of features turns the reply into an error. read_lines
+      // leaves in the corpus only the sentences it read.
+      istringstream istr(samples);
+      ostringstream tagged;
+      string error;
+      corpus.resize(batch_size);
+      while(read_lines(istr, batch_size, &error)) {
+	tagBatch(filter, index_needed, tagged);
+	corpus.resize(batch_size);
+      }
+      if(error != "")
+	ostr << "ERROR " << error << endl;
+      else
+	ostr << "OK" << endl << tagged.str();
+    } else
+      ostr << "ERROR unknown command " << command << endl;
+    reply = ostr.str();
+  }
+
+  latency_histogram latencies;
+
+private:
+  const set<int>& filter;
+  bool index_needed;
+  int batch_size;
+};
+
 void printRuleTrace(void)
 {
   static int feature_set_size = RuleTemplate::name_map.size();
@@ -243,7 +536,7 @@ void printRuleTrace(void)
   for (int i = 0; i < static_cast<int>(ruleTrace.size()); i++) {
     int maxind = static_cast<int>(corpus[i].size()) - PredicateTemplate::MaxForwardLookup;
     for (int j = -PredicateTemplate::MaxBackwardLookup ; j < maxind ; j++) {
-      wordType1D& vect = corpus[i][j];
+      wordType1D vect = corpus[i][j];
       for(int k=0 ; k<feature_set_size-2*TRUTH_SIZE ; k++)
 	*out << dict[vect[k]] << " ";
       for(int k=STATE_START ; k<STATE_START+TRUTH_SIZE ; k++)
@@ -267,7 +560,7 @@ void printPosition(unsigned int i, unsigned short j) {
     TRUTH_START = TargetTemplate::TRUTH_START,
     STATE_START = TargetTemplate::STATE_START;
   
-  wordType1D& vect = corpus[i][j];
+  wordType1D vect = corpus[i][j];
   for(int k=0 ; k<feature_set_size-2*TRUTH_SIZE ; k++)
     *out << dict[vect[k]] << " ";
   for(int k=STATE_START ; k<STATE_START+TRUTH_SIZE ; k++)
@@ -321,6 +614,22 @@ void usage(const char* prog_name) {
        << " -batchSize <n>      - processes samples/sentences in batches of size n (default 100)" << endl
        << " -o <file>           - will output the result in the specified file (default stdout)" << endl
        << " -nonsequential      - will read the entire file in, and then start to process it" << endl
+       << " -columns            - stores the corpus by columns (one array per feature)" << endl
+       << " -compiledRules      - applies the rules made of feature (sequence) tests as finite-state transducers," << endl
+       << "                       sentence by sentence, without the index" << endl
+       << " -checkCompiledRules - applies the rules both as transducers and with the index, and checks the results" << endl
+       << "                       (and the AVX2 tests of the rules on the index positions against the scalar ones)" << endl
+       << " -threads <n>        - applies the compiled rules (implies -compiledRules) to the sentences of a batch" << endl
+       << "                       in n threads" << endl
+       << " -server <socket>    - loads the rules once and tags the samples sent as length-prefixed requests on" << endl
+       << "                       the Unix socket (or, if <socket> is -, on the standard input and output);" << endl
+       << "                       the words of the examples file are added to the vocabulary, but it is not tagged;" << endl
+       << "                       the requests are tagged one at a time, in one thread, so a long request delays" << endl
+       << "                       the ones of the other connections" << endl
+       << " -maxClients <n>     - the number of connections the server keeps open (default 64)" << endl
+       << " -compile <file>     - compiles the rule list, with the templates, the vocabulary, the constraints" << endl
+       << "                       and the tree (if -t is given), into a binary model and exits (the examples" << endl
+       << "                       are not read); the model can be used in place of the rule list" << endl
        << endl;
 }
 
@@ -328,6 +637,9 @@ int main(int argc, char *argv[]) {
   Dictionary& dict = Dictionary::GetDictionary();
   string tree_file = "";
   string error_file = "";
+  string model_file = "";
+  string server_socket = "";
+  int max_clients = 64;
   int batch_size = 10000;
   bool generate_tree = false;
   timer tm;
@@ -360,6 +672,31 @@ int main(int argc, char *argv[]) {
       non_sequential = true;
     } else if(!strcmp("-batchSize", argv[i])) {
       batch_size = atoi1(argv[++i]);
+    } else if(!strcmp("-compiledRules", argv[i])) {
+      compiled_rules = true;
+    } else if(!strcmp("-checkCompiledRules", argv[i])) {
+      compiled_rules = true;
+      check_compiled_rules = true;
+      rule_batch::set_checked(true);
+    } else if(!strcmp("-threads", argv[i]) && i+1 < argc) {
+      compiled_rules = true;
+      num_threads = atoi1(argv[++i]);
+      if(num_threads < 1)
+	num_threads = 1;
+      if(! HAVE_THREAD_LOCAL && num_threads > 1) {
+	cerr << "This compiler does not support thread local storage; using a single thread." << endl;
+	num_threads = 1;
+      }
+    } else if(!strcmp("-compile", argv[i])) {
+      model_file = argv[++i];
+    } else if(!strcmp("-server", argv[i]) && i+1 < argc) {
+      server_socket = argv[++i];
+    } else if(!strcmp("-maxClients", argv[i]) && i+1 < argc) {
+      max_clients = atoi1(argv[++i]);
+      if(max_clients < 1)
+	max_clients = 1;
+    } else if(!strcmp("-columns", argv[i])) {
+      corpus.set_layout(wordType3D::COLUMNS);
     } else if(!strcmp("-o", argv[i])) {
       output_file = argv[++i];
     } else if(!strcmp("-V",argv[i])) {
@@ -375,7 +712,29 @@ int main(int argc, char *argv[]) {
 
   log_me_in(argc, argv);
 
-  if(p_flag && tree_file == "") {
+  if(compiled_rules && (p_flag || printRT || printErrors || generate_tree)) {
+    cerr << "The compiled rules cannot be used with -p, -soft_probs, -printRuleTrace, -printErrors or -generateProbTree; the rules will be interpreted." << endl;
+    compiled_rules = check_compiled_rules = false;
+  }
+
+  if(server_socket != "" && (p_flag || printErrors || generate_tree || non_sequential)) {
+    cerr << "The server cannot be used with -p, -soft_probs, -printErrors, -generateProbTree or -nonsequential." << endl;
+    exit(1);
+  }
+  if(server_socket == "-" && !strcmp(argv[1], "-")) {
+    cerr << "The examples cannot be read from the standard input when the server uses it." << endl;
+    exit(1);
+  }
+
+  if(model_file != "") {
+    compileModel(argv[2], tree_file, model_file);
+    exit(0);
+  }
+
+  ModelBundle model;
+  bool compiled = model.open(argv[2]);
+
+  if(p_flag && tree_file == "" && ! (compiled && model.hasTree())) {
     cerr << "The TBL tree file is undefined. Please use -t <tree_file> to define it!" << endl;
     usage(argv[0]);
     exit(1);
@@ -385,25 +744,26 @@ int main(int argc, char *argv[]) {
     smart_open(out, output_file);
   else
     out = &cout;
-  RuleTemplate::Initialize();
-  UNK = dict.getIndex(UNK_string);
-  
   TBLTree t;
-
-  if(p_flag)
-    t.readClasses(tree_file);
-
-  istream* rlsstr;
-  smart_open(rlsstr, argv[2]);
   string line;
-  getline(*rlsstr, line);
-  delete rlsstr;
   line_splitter ls;
-  ls.split(line);
-  if (ls[0]!="#train_voc_file:") {
-    cerr << "The rule file looks corrupted, because there is no mentioning of the training vocabulary." << endl << 
-      " Please provide a valid rule file." << endl;
-    exit(1);
+
+  if(compiled) {
+    // The vocabulary of the model already contains the classes of the tree
+    model.loadTemplates();
+    model.loadVocabulary();
+    if(p_flag && tree_file == "") {
+      istringstream tree_text(model.tree());
+      t.readClasses(tree_text);
+    } else if(p_flag)
+      t.readClasses(tree_file);
+  } else {
+    RuleTemplate::Initialize();
+
+    if(p_flag)
+      t.readClasses(tree_file);
+
+    readRulesHeader(argv[2], ls);
   }
 
   string file_name = argv[1];
@@ -431,26 +791,61 @@ int main(int argc, char *argv[]) {
     of.close();
   }
 
-  studyData(file_name.c_str(), ls[1]);
-  Rule::Initialize();
+  // The vocabulary is read first (in studyData), so a binary one can be
+  // used in place
+  if(compiled)
+    studyData(file_name.c_str(), "", true);
+  else
+    studyData(file_name.c_str(), ls[1]);
+  UNK = dict.getIndex(UNK_string);
+  Rule::Initialize(! compiled);
+  if(compiled)
+    model.loadConstraints(Rule::Constraints);
+  // All the words of the data are in the dictionary by now; the ones
+  // missing from a binary vocabulary stay out of its perfect hash
+  if(! dict.frozen())
+    dict.freeze();
   if(non_sequential)
     readInData (const_cast<char*>(file_name.c_str()));
 
   cerr << "Reading rules" << endl;
   if (p_flag) {
-    t.readInTextFormat(tree_file);
+    if(compiled && tree_file == "") {
+      istringstream tree_text(model.tree());
+      t.readInTextFormat(tree_text);
+    } else
+      t.readInTextFormat(tree_file);
     allRules = t.rules;
   }
+  else if(compiled)
+    model.loadRules(allRules);
   else 
     readInRules (argv[2]);
 
   cerr << "Done reading rules" << endl;
 
+  if(compiled_rules) {
+    transducer.compile(allRules);
+    int num_compiled = 0;
+    for(int r=0 ; r<allRules.size() ; r++)
+      num_compiled += transducer.compiled(r);
+    cerr << "Compiled " << num_compiled << " of the " << allRules.size() << " rules" << endl;
+  }
+  // The index is needed only by the interpreted rules
+  bool index_needed = ! compiled_rules || ! transducer.complete();
+
   set<int> filter;
   for(rule_vector::iterator rl = allRules.begin() ; 
       rl!=allRules.end() ;
       ++rl) {
     filter.insert(rl->predicate.tokens[rl->predicate.order[0]]);
+    // runOneRule intersects the positions of these two features
+    int first, second;
+    relativePosType d1, d2;
+    if(rl->get_intersection_features(first, d1, second, d2)) {
+      filter.insert(rl->predicate.tokens[first]);
+      filter.insert(rl->predicate.tokens[second]);
+    }
   }
 
   ostream *errstr;
@@ -459,9 +854,26 @@ int main(int argc, char *argv[]) {
 
   tm.mark();
   int initial_time = tm.seconds_since_last_mark();
+
+  if(server_socket != "") {
+    ruleTrace.resize(batch_size);
+    tagging_handler handler(filter, index_needed, batch_size);
+    message_server server(handler, handler.latencies, max_clients);
+    cerr << "Initialization took " << tm.time_since_last_mark() << endl;
+    if(server_socket == "-")
+      server.serve_stdio();
+    else
+      server.serve_socket(server_socket);
+    handler.latencies.print(cerr);
+    if(is_stdin)
+      unlink(file_name.c_str());
+    cerr << "Superdone" << endl;
+    return 0;
+  }
   
   if(non_sequential) {
-    generate_index(filter);
+    if(index_needed && ! check_compiled_rules)
+      generate_index(filter);
 	
     ruleTrace.resize(corpus_size);
     for(int i=0 ; i<corpus_size ; i++) 
@@ -474,7 +886,7 @@ int main(int argc, char *argv[]) {
     if(printErrors) {
       general_error = 0.0;
       for(int i=0 ; i<corpus.size() ; i++) {
-	wordType2D & vect = corpus[i];
+	wordType2D vect = corpus[i];
 	int max_pos = vect.size() - PredicateTemplate::MaxForwardLookup;
 	for(int j=-PredicateTemplate::MaxBackwardLookup ; j<max_pos ; j++) 
 	  for(int k=0 ; k<TargetTemplate::TRUTH_SIZE ; k++)
@@ -499,14 +911,20 @@ int main(int argc, char *argv[]) {
 	computeSoftProbs(t);
       }
     } else {
-      for (rule_vector::iterator thisRule = allRules.begin(); 
-	   thisRule != allRules.end(); ++thisRule) {
-	runOneRule(*thisRule, ruleID++);
-	if(printErrors)
-	  *errstr << general_error << endl;
-	tk.tick();
+      if(check_compiled_rules)
+	checkCompiledRules(filter);
+      else if(compiled_rules)
+	applyCompiledRules();
+      else {
+	for (rule_vector::iterator thisRule = allRules.begin(); 
+	     thisRule != allRules.end(); ++thisRule) {
+	  runOneRule(*thisRule, ruleID++);
+	  if(printErrors)
+	    *errstr << general_error << endl;
+	  tk.tick();
+	}
+	tk.clear();
       }
-      tk.clear();
 	  
       if(generate_tree) {
 	TBLTree t;
@@ -526,15 +944,8 @@ int main(int argc, char *argv[]) {
     smart_open(filestr, file_name.c_str());
 
     ticker tk("Processed sentences:", 32);
+    // The space of the sentences is reused from one batch to the next.
     corpus.resize(batch_size);
-    int feature_set_size = RuleTemplate::name_map.size();
-    for(int i=0 ; i<corpus.size() ; i++){
-      corpus[i].resize(2000);
-      wordType1D p = corpus[i][0] = new wordType [200*feature_set_size];
-
-      for(int j=1 ; j<corpus[i].size() ; j++)
-	corpus[i][j] = p + feature_set_size*j;
-    }
 
     if(printErrors) {
       errors.resize(allRules.size()+1);
@@ -544,13 +955,11 @@ int main(int argc, char *argv[]) {
     ruleTrace.resize(batch_size);
     int no_lines = 0;
     while (read_lines(*filestr, batch_size)) {
-      generate_index(filter);
-
       fill(new_errors.begin(), new_errors.end(), 0);
 
       if(printErrors)
 	for(int i=0 ; i<corpus.size() ; ++i) {
-	  wordType2D & vect = corpus[i];
+	  wordType2D vect = corpus[i];
 	  int max_pos = vect.size() - PredicateTemplate::MaxForwardLookup;
 	  for(int j=0 ; j<max_pos ; ++j) {
 	    for(int k=0 ; k<TargetTemplate::TRUTH_SIZE ; k++)
@@ -558,23 +967,10 @@ int main(int argc, char *argv[]) {
 								vect[j][TargetTemplate::TRUTH_START+k]);
 	  }
 	}
-	  
-      int ruleID = 0;
-      for (rule_vector::iterator thisRule = allRules.begin(); 
-	   thisRule != allRules.end(); ++thisRule) {
-	if(printErrors)
-	  new_errors[ruleID+1] = new_errors[ruleID];
-	runOneRule(*thisRule, ruleID++);
-      }
+
+      tagBatch(filter, index_needed, *out);
       no_lines += batch_size;
       tk.tick(no_lines, true);
-      printCorpusState(*out, printRT);
-      corpusIndex.clear();
-      classifIndex.clear();
-      for(int k=0 ; k<corpus.size() ; k++)
-	for(int i=0 ; i<corpus[k].size() ; i++) {
-	  ruleTrace[k][i].clear();
-	}
 
       for(int i=0 ; i<errors.size() ; i++)
 	errors[i] += new_errors[i];
@@ -26,4 +26,4 @@
 #include "index.h"
 
 // template <typename T1, typename T2>
-// indexed_map<pair<T1, T2> > word_index<T1, T2>::pair_map;
+// vector<unsigned int> word_index<T1, T2>::sentence_start;
@@ -29,6 +29,7 @@
 #include <list>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include "line_splitter.h"
 #include "common.h"
 #include "index.h"
@@ -41,6 +42,9 @@
 #include "ContainsStringPredicate.h"
 #include "hash_wrapper.h"
 #include "CooccurrencePredicate.h"
+#include "io.h"
+#include <unistd.h>
+#include <errno.h>
 
 typedef PredicateTemplate::PredicateTemplate_vector PredicateTemplate_vector;
 typedef HASH_NAMESPACE::hash_set<Rule> rule_hash_set;
@@ -74,33 +78,17 @@ void process_line (const string1D& features, int lineNum)
   static short int feature_set_size = RuleTemplate::name_map.size();
 
   int new_size = features.size() - PredicateTemplate::MaxBackwardLookup + PredicateTemplate::MaxForwardLookup;
-  if (new_size > corpus[lineNum].capacity()) {
-    wordType1D prev = corpus[lineNum].size()>0 ? corpus[lineNum][0] : 0;
-
-    corpus[lineNum].resize(new_size);
-    wordType1D p = new wordType [corpus[lineNum].capacity()*feature_set_size];
-
-    delete [] prev;
-
-    corpus[lineNum][0] = p;
-  } 
-  else
-    corpus[lineNum].resize(new_size);
-
-  for(int j=0 ; j<new_size ; j++)
-    corpus[lineNum][j] = corpus[lineNum][0] + feature_set_size*j;
+  if(corpus.sample_width() == 0)
+    corpus.set_sample_width(feature_set_size);
+  corpus.resize_sentence(lineNum, new_size);
 
   ruleTrace[lineNum].resize(new_size);
 
   static Dictionary& dict = Dictionary::GetDictionary();
 
   for (int i = 0; i < -PredicateTemplate::MaxBackwardLookup; i++) {
-    wordType1D& vect = corpus[lineNum][i];
-    if(vect == 0) {
-      cerr << "Error - this vector might have not been 0!" << endl << "Line: " << lineNum << ", index " << i << endl;
-      exit(123);
-    }
-    fill(vect, vect+feature_set_size, dict["ZZZ"]); // ZZZ is our fake feature
+    wordType1D vect = corpus[lineNum][i];
+    vect.fill(0, feature_set_size, dict["ZZZ"]); // ZZZ is our fake feature
     dict.increaseCount("ZZZ", feature_set_size);
   }
   
@@ -118,11 +106,7 @@ void process_line (const string1D& features, int lineNum)
       exit(5);
     }
 
-    wordType1D& vect = corpus[lineNum][sample_no];
-    if(vect == 0) {
-      cerr << "Error - this vector might have not been 0!" << endl << "Line: " << lineNum << ", index " << sample_no << endl;
-      exit(123);
-    }
+    wordType1D vect = corpus[lineNum][sample_no];
 
     for(int i=0 ; i<feature_set_size ; i++) {
       vect[i] = dict.increaseCount(ls[i]);
@@ -132,12 +116,8 @@ void process_line (const string1D& features, int lineNum)
   }
 
   for (int i = sample_no; i < sample_no+PredicateTemplate::MaxForwardLookup; i++) {
-    wordType1D& vect = corpus[lineNum][i];
-    if(vect == 0) {
-      cerr << "Error - this vector might have not been 0!" << endl << "Line: " << lineNum << ", index " << i << endl;
-      exit(123);
-    }
-    fill(vect, vect+feature_set_size, dict["ZZZ"]); // ZZZ is our fake feature
+    wordType1D vect = corpus[lineNum][i];
+    vect.fill(0, feature_set_size, dict["ZZZ"]); // ZZZ is our fake feature
     dict.increaseCount("ZZZ", feature_set_size);
   }
 }
@@ -159,10 +139,8 @@ void process_line (const string1D& features, int lineNum)
 //  but did appear in the test data.                                                      //
 //  ------------------------------------------------------------------------------------- //
 
-void studyData(const string& filename, const string& train_filename) {
+void studyData(const string& filename, const string& train_filename, bool vocabulary_loaded, const string& appended_filename) {
   cerr << "Studying the data" << endl;
-  istream* in;
-  smart_open(in, filename);
 
   const Params& p = Params::GetParams();
   bool empty_lines_are_seps = p["EMPTY_LINES_ARE_SEPARATORS"] == "1";
@@ -217,9 +195,10 @@ void studyData(const string& filename, const string& train_filename) {
     if(find(lst.begin(), lst.end(), SubwordPartPredicate::feature_len_pair_list[i].first) == lst.end())
       lst.insert(lst.end(), SubwordPartPredicate::feature_len_pair_list[i].first);
 
-  bool with_train_file = train_filename != "";
+  bool with_train_file = train_filename != "" || vocabulary_loaded;
   if(with_train_file) {
-    dict.readFromFile(train_filename);
+    if(! vocabulary_loaded)
+      dict.readFromFile(train_filename);
 
     wordType real_start = dict.real_word_start_index(), real_end = dict.real_word_end_index();
 
@@ -242,42 +221,58 @@ void studyData(const string& filename, const string& train_filename) {
   bool in_sent = false;
   string truth_sep = Params::GetParams()["TRUTH_SEPARATOR"];
 
-  while (getline(*in, in_line)) {
-    ls.split(in_line);
+  // The appended data (see readInData) is studied with the training data,
+  // so that the dictionary is the one of the whole corpus.
+  string1D file_names(1, filename);
+  if(appended_filename != "")
+    file_names.push_back(appended_filename);
 
-    if(ls.size()>0) {
-      features.resize(ls.size());
-      for(int i=0 ; i<ls.size() ; i++) {
-	words.insert(ls[i]);
-      }
-	  
-      if(!with_train_file)
-	for(list<int>::iterator p=lst.begin() ; p!=lst.end() ; ++p)
-	  real_words.insert(ls[*p]);
-
-      if(truth_sep == "")
-	classifications.insert(ls[ls.size()-1]);
-      else {
-	static line_splitter ts(truth_sep);
-	ts.split(ls[ls.size()-1]);
-	for(int i=0 ; i<ts.size() ; i++)
-	  classifications.insert(ts[i]);
-      }
-		
-      classifications.insert(ls[ls.size()-2]);
+  for(string1D::iterator file=file_names.begin() ; file!=file_names.end() ; ++file) {
+    istream* in;
+    smart_open(in, *file);
 
-      in_sent = true;
-      if(!empty_lines_are_seps) {
-	tk.tick();
-	corpus_size++;
-      }
-    } else {
-      if(empty_lines_are_seps && in_sent) {
-	corpus_size++;
-	tk.tick();
+    while (getline(*in, in_line)) {
+      ls.split(in_line);
+
+      if(ls.size()>0) {
+	features.resize(ls.size());
+	for(int i=0 ; i<ls.size() ; i++) {
+	  words.insert(ls[i]);
+	}
+	    
+	if(!with_train_file)
+	  for(list<int>::iterator p=lst.begin() ; p!=lst.end() ; ++p)
+	    real_words.insert(ls[*p]);
+
+	if(truth_sep == "")
+	  classifications.insert(ls[ls.size()-1]);
+	else {
+	  static line_splitter ts(truth_sep);
+	  ts.split(ls[ls.size()-1]);
+	  for(int i=0 ; i<ts.size() ; i++)
+	    classifications.insert(ts[i]);
+	}
+		  
+	classifications.insert(ls[ls.size()-2]);
+
+	in_sent = true;
+	if(!empty_lines_are_seps) {
+	  tk.tick();
+	  corpus_size++;
+	}
+      } else {
+	if(empty_lines_are_seps && in_sent) {
+	  corpus_size++;
+	  tk.tick();
+	}
+	in_sent = false;
       }
-      in_sent = false;
     }
+
+    if(in_sent && empty_lines_are_seps)
+      corpus_size++;
+    in_sent = false;
+    delete in;
   }
   tk.clear();
 
@@ -294,9 +289,6 @@ void studyData(const string& filename, const string& train_filename) {
 
   cerr << "Creating part-of-word indexes";
 
-  if(in_sent && empty_lines_are_seps)
-    corpus_size++;
-
   // Sort the real_words vocabulary first
   vals.resize(real_words.size());
   iota(vals.begin(), vals.end(), 0);
@@ -331,12 +323,14 @@ void studyData(const string& filename, const string& train_filename) {
   }
   for(int i=0 ; i<strlen("Creating part-of-word indexes") ; i++)
     cerr << "\b";
-
-  delete in;
 }
 
-// Read a fixed number of lines of the data and store them in corpus
-bool read_lines(istream& istr, int num_lines) {
+// Read a fixed number of lines of the data and store them in corpus.
+// If error is given, a sample with the wrong number of features is not
+// fatal: the reading stops there, *error gets the reason and false is
+// returned.
+bool read_lines(istream& istr, int num_lines, string* error) {
+  static int feature_set_size = RuleTemplate::name_map.size();
   const Params& p = Params::GetParams();
   bool empty_lines_are_seps = p["EMPTY_LINES_ARE_SEPARATORS"] == "1";
   static string1D line;
@@ -349,6 +343,14 @@ bool read_lines(istream& istr, int num_lines) {
   while(getline(istr, str)) {
     read_something = true;
     ls.split(str);
+    if(error && ls.size() != 0 && ls.size() != feature_set_size) {
+      ostringstream message;
+      message << "the sample \"" << str << "\" has " << ls.size() << " features instead of " << feature_set_size;
+      *error = message.str();
+      read_something = false;
+      line.clear();
+      break;
+    }
     if(ls.size() == 0) {
       if(line.size()>0) {
 	process_line(line, lines_read);
@@ -378,8 +380,13 @@ bool read_lines(istream& istr, int num_lines) {
   return read_something;
 }
 
-// This function is called to read in the corpus.
-void readInData ( char *filename)
+// This function is called to read in the corpus. If num_shards is larger
+// than 1, only the sentences whose number modulo num_shards is shard are kept.
+// The sentences are stored starting with first_line: a file appended to the
+// training data (studied with it by studyData) is read after it, with
+// first_line being the number of sentences read before. Returns the number of
+// sentences read.
+int readInData ( char *filename, int shard, int num_shards, int first_line)
 {
   istream* in;
 
@@ -389,19 +396,24 @@ void readInData ( char *filename)
 
   smart_open(in, filename);
 
-  cerr << "Reading " << corpus_size << " sentences !" << endl;
-  corpus.resize(corpus_size);
-  ruleTrace.resize(corpus_size);
+  if(first_line == 0) {
+    int shard_size = (corpus_size - shard + num_shards - 1) / num_shards;
+    cerr << "Reading " << shard_size << " sentences !" << endl;
+    corpus.resize(shard_size);
+    ruleTrace.resize(shard_size);
+  }
   string1D current_line;
-  int lineNum = 0;
+  int lineNum = first_line, sentence = 0;
   string linestr;
   line_splitter ls;
   while(getline(*in, linestr)) {
     ls.split(linestr);
     if (ls.size() == 0) {
       if (current_line.size() > 0) {
-	process_line(current_line, lineNum);
-	lineNum++;
+	if (sentence++ % num_shards == shard) {
+	  process_line(current_line, lineNum);
+	  lineNum++;
+	}
 	tk.tick();
       }
       current_line.clear();
@@ -409,8 +421,10 @@ void readInData ( char *filename)
       // If the samples are independent, then put each one in its own "sentence".
       if(! empty_lines_are_seps) {
 	current_line.push_back(linestr);
-	process_line(current_line, lineNum);
-	lineNum++;
+	if (sentence++ % num_shards == shard) {
+	  process_line(current_line, lineNum);
+	  lineNum++;
+	}
 	current_line.clear();
 	tk.tick();
       } 
@@ -421,10 +435,11 @@ void readInData ( char *filename)
   tk.clear();
   delete in;
 
-  if (current_line.size() > 0) 
-    process_line(current_line, lineNum);
+  if (current_line.size() > 0 && sentence % num_shards == shard) 
+    process_line(current_line, lineNum++);
 
   cerr << "Done reading data." << endl;
+  return lineNum - first_line;
 }
 
 void generate_index(const set<int>& filter) {
@@ -463,7 +478,7 @@ void generate_index(const set<int>& filter) {
     }
 
     for( ; j<sent_max ; j++) {
-      wordType1D& vect = corpus[i][j];
+      wordType1D vect = corpus[i][j];
 
       static wordType_set words;
       seen.clear();
@@ -508,8 +523,7 @@ void generate_index(const set<int>& filter) {
 }
 
 void clear_corpus() {
-  for(wordType3D::iterator i=corpus.begin() ; i!=corpus.end() ; ++i)
-    delete [] i->begin()[0];
+  corpus.clear();
 }
 
 void printCorpusState(ostream& out, bool printRT)
@@ -523,7 +537,7 @@ void printCorpusState(ostream& out, bool printRT)
 
   for (int i = 0; i < static_cast<int>(corpus.size()); i++) {
     for (int j = -PredicateTemplate::MaxBackwardLookup ; j < static_cast<int>(corpus[i].size()) - PredicateTemplate::MaxForwardLookup ; j++) {
-      wordType1D& vect = corpus[i][j];
+      wordType1D vect = corpus[i][j];
       for(int k=0 ; k<feature_set_size-2*TRUTH_SIZE ; k++)
 	out << dict[vect[k]] << " ";
       for(int k=STATE_START ; k<STATE_START+TRUTH_SIZE ; k++)
@@ -543,3 +557,99 @@ void printCorpusState(ostream& out, bool printRT)
   }
 }
 
+// Saves the current state of the samples (the state features and the rule
+// trace) in binary form.
+void writeCorpusState(ostream& out) {
+  int TRUTH_SIZE = TargetTemplate::TRUTH_SIZE,
+    STATE_START = TargetTemplate::STATE_START;
+
+  write_binary(out, static_cast<int>(corpus.size()));
+  for (int i = 0; i < static_cast<int>(corpus.size()); i++) {
+    int size = corpus[i].size();
+    write_binary(out, size);
+    for (int j = 0 ; j < size ; j++)
+      for (int k = STATE_START ; k < STATE_START+TRUTH_SIZE ; k++)
+	write_binary(out, corpus[i][j][k]);
+    for (int j = 0 ; j < size ; j++) {
+      write_binary(out, static_cast<int>(ruleTrace[i][j].size()));
+      if(ruleTrace[i][j].size() > 0)
+	out.write(reinterpret_cast<const char*>(&ruleTrace[i][j][0]), ruleTrace[i][j].size()*sizeof(wordType));
+    }
+  }
+}
+
+// Restores the state saved by writeCorpusState. Returns false if the saved
+// samples do not match the ones that were read in. The saved state is the
+// one of the first num_lines sentences (all of them if num_lines is -1); if
+// translation is given, the saved words are the indices of a different
+// dictionary, and translation maps them to the ones of the current one.
+bool readCorpusState(istream& in, int num_lines, const wordTypeVector* translation) {
+  int TRUTH_SIZE = TargetTemplate::TRUTH_SIZE,
+    STATE_START = TargetTemplate::STATE_START;
+
+  if(num_lines == -1)
+    num_lines = corpus.size();
+  int saved_lines;
+  if(! read_binary(in, saved_lines) || saved_lines != num_lines)
+    return false;
+  for (int i = 0; i < num_lines; i++) {
+    int size;
+    if(! read_binary(in, size) || size != static_cast<int>(corpus[i].size()))
+      return false;
+    for (int j = 0 ; j < size ; j++)
+      for (int k = STATE_START ; k < STATE_START+TRUTH_SIZE ; k++) {
+	wordType& value = corpus[i][j][k];
+	if(! read_binary(in, value))
+	  return false;
+	if(translation) {
+	  if(value >= translation->size())
+	    return false;
+	  value = (*translation)[value];
+	}
+      }
+    for (int j = 0 ; j < size ; j++) {
+      int count;
+      if(! read_binary(in, count))
+	return false;
+      ruleTrace[i][j].resize(count);
+      if(count > 0)
+	in.read(reinterpret_cast<char*>(&ruleTrace[i][j][0]), count*sizeof(wordType));
+    }
+  }
+  return ! in.fail();
+}
+
+bool write_message(int fd, const string& message) {
+  unsigned int size = message.size();
+  string buffer(reinterpret_cast<const char*>(&size), sizeof(size));
+  buffer += message;
+  for(string::size_type done = 0 ; done < buffer.size() ; ) {
+    ssize_t n = write(fd, buffer.data()+done, buffer.size()-done);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+static bool read_fully(int fd, char* buffer, size_t size) {
+  for(size_t done = 0 ; done < size ; ) {
+    ssize_t n = read(fd, buffer+done, size-done);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+bool read_message(int fd, string& message) {
+  unsigned int size;
+  if(! read_fully(fd, reinterpret_cast<char*>(&size), sizeof(size)))
+    return false;
+  message.resize(size);
+  return size == 0 || read_fully(fd, &message[0], size);
+}
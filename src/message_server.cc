@@ -0,0 +1,222 @@
+/*
+  Implements the server of length-prefixed requests (message_server).
+
+  This file is part of the fnTBL distribution.
+
+  Copyright (c) 2001 Johns Hopkins University and Radu Florian and Grace Ngai.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software, fnTBL version 1.0, and associated
+  documentation files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished
+  to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "message_server.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "io.h"
+
+static volatile sig_atomic_t stop_serving = 0;
+
+static void stop_handler(int) {
+  stop_serving = 1;
+}
+
+void message_server::serve_socket(const string& path) {
+  struct sockaddr_un addr;
+  if(path.size() >= sizeof(addr.sun_path)) {
+    cerr << "The socket name " << path << " is too long." << endl;
+    exit(4);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path.c_str());
+
+  unlink(path.c_str());
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+     listen(listen_fd, max_clients) != 0) {
+    cerr << "Could not listen on the socket " << path << ": " << strerror(errno) << endl;
+    exit(4);
+  }
+  fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+  // A client that goes away is noticed when its reply cannot be written.
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+  cerr << "Serving on " << path << endl;
+
+  vector<struct pollfd> fds;
+  while(! stop_serving) {
+    fds.resize(clients.size()+1);
+    fds[0].fd = listen_fd;
+    fds[0].events = clients.size() < max_clients ? POLLIN : 0;
+    // A client with a complete request already read (it sent several at
+    // once) is answered in this round, without waiting for its socket.
+    bool waiting = false;
+    for(int i=0 ; i<clients.size() ; i++) {
+      const client& c = clients[i];
+      fds[i+1].fd = c.fd;
+      fds[i+1].events = 0;
+      if(c.output.size() > 0)
+	fds[i+1].events = POLLOUT;
+      else if(c.ready != 0)
+	waiting = true;
+      else if(! c.closed)
+	fds[i+1].events = POLLIN;
+    }
+    if(poll(&fds[0], fds.size(), waiting ? 0 : -1) < 0) {
+      if(errno == EINTR)
+	continue;
+      cerr << "The server could not wait for its clients: " << strerror(errno) << endl;
+      break;
+    }
+
+    // Each client gets at most one request answered per round.
+    int kept = 0;
+    for(int i=0 ; i<clients.size() ; i++) {
+      client& c = clients[i];
+      short revents = fds[i+1].revents;
+      bool ok = true;
+      if(c.output.size() > 0 && revents != 0)
+	ok = write_output(c);
+      else if((fds[i+1].events & POLLIN) && revents != 0)
+	ok = read_input(c);
+
+      int complete = ok ? complete_request(c) : 0;
+      if(complete < 0) {
+	cerr << "A request is longer than " << max_message << " bytes; closing its connection." << endl;
+	ok = false;
+      } else if(complete > 0) {
+	if(c.ready == 0)
+	  c.ready = telemetry_clock();
+	if(c.output.size() == 0) {
+	  answer(c);
+	  if(complete_request(c) > 0)
+	    c.ready = telemetry_clock();
+	  ok = write_output(c);
+	}
+      }
+
+      if(ok && (! c.closed || c.output.size() > 0 || complete_request(c) > 0))
+	std::swap(clients[kept++], c);
+      else
+	close(c.fd);
+    }
+    clients.erase(clients.begin()+kept, clients.end());
+
+    if(fds[0].revents & POLLIN)
+      while(clients.size() < max_clients) {
+	int fd = accept(listen_fd, 0, 0);
+	if(fd < 0)
+	  break;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	clients.push_back(client(fd));
+      }
+  }
+
+  for(int i=0 ; i<clients.size() ; i++)
+    close(clients[i].fd);
+  clients.clear();
+  close(listen_fd);
+  unlink(path.c_str());
+}
+
+void message_server::serve_stdio() {
+  signal(SIGPIPE, SIG_IGN);
+  string request, reply;
+  while(read_message(0, request)) {
+    double start = telemetry_clock();
+    reply.clear();
+    handler.handle(request, reply);
+    latencies.add(telemetry_clock() - start);
+    if(! write_message(1, reply))
+      break;
+  }
+}
+
+// Reads what the client sent, up to the end of the first complete request.
+// Returns false if the connection failed.
+bool message_server::read_input(client& c) {
+  char buffer[65536];
+  while(complete_request(c) == 0) {
+    ssize_t n = read(c.fd, buffer, sizeof(buffer));
+    if(n > 0)
+      c.input.append(buffer, n);
+    else if(n == 0) {
+      c.closed = true;
+      break;
+    } else if(errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    else if(errno != EINTR)
+      return false;
+  }
+  return true;
+}
+
+// Writes as much of the reply as the socket takes. Returns false if the
+// connection failed.
+bool message_server::write_output(client& c) {
+  while(c.written < c.output.size()) {
+    ssize_t n = write(c.fd, c.output.data()+c.written, c.output.size()-c.written);
+    if(n > 0)
+      c.written += n;
+    else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return true;
+    else if(n == 0 || errno != EINTR)
+      return false;
+  }
+  c.output.clear();
+  c.written = 0;
+  return true;
+}
+
+// 1 if the input of the client starts with a complete request, 0 if not,
+// -1 if the request is too long.
+int message_server::complete_request(const client& c) const {
+  unsigned int size;
+  if(c.input.size() < sizeof(size))
+    return 0;
+  memcpy(&size, c.input.data(), sizeof(size));
+  if(size > max_message)
+    return -1;
+  return c.input.size() - sizeof(size) >= size ? 1 : 0;
+}
+
+void message_server::answer(client& c) {
+  unsigned int size;
+  memcpy(&size, c.input.data(), sizeof(size));
+  string request = c.input.substr(sizeof(size), size), reply;
+  c.input.erase(0, sizeof(size)+size);
+
+  handler.handle(request, reply);
+  size = reply.size();
+  c.output.assign(reinterpret_cast<const char*>(&size), sizeof(size));
+  c.output += reply;
+  latencies.add(telemetry_clock() - c.ready);
+  c.ready = 0;
+}